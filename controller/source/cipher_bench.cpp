@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common.hpp"
+#include "gdpr_metadata.hpp"
+#include "encryption/cipher_engine.hpp"
+
+using controller::cipher_engine;
+
+/*
+ * Compares the cipher suites of the cipher_engine on the current CPU.
+ * Every suite encrypts and decrypts (into reused buffers) roughly the same number of bytes
+ * for every payload size; the output is in CSV format.
+ *
+ * Options:
+ *   --suites <comma separated suites>  (default: all, i.e., none,aes-128-gcm,aes-256-gcm,chacha20-poly1305)
+ *   --sizes <comma separated payload sizes in bytes>  (default: 100,1024,4096,16384,65536)
+ *   --mb <megabytes processed per suite and payload size>  (default: 256)
+ */
+auto main(int argc, char* argv[]) -> int
+{
+  auto args = std::span(argv, static_cast<size_t>(argc));
+
+  std::vector<cipher_suite> suites;
+  const std::string suites_arg = get_command_line_argument(args, "--suites");
+  if (suites_arg.empty()) {
+    for (size_t suite = 0; suite < controller::num_cipher_suites; suite++) {
+      suites.push_back(static_cast<cipher_suite>(suite));
+    }
+  } else {
+    for (const auto& name : controller::split_comma_string(suites_arg)) {
+      auto suite = controller::parse_cipher_suite(name);
+      if (!suite) {
+        std::cerr << "Invalid cipher suite: " << name << std::endl;
+        return 1;
+      }
+      suites.push_back(suite.value());
+    }
+  }
+
+  std::vector<size_t> payload_sizes {100, 1024, 4096, 16384, 65536};
+  const std::string sizes_arg = get_command_line_argument(args, "--sizes");
+  if (!sizes_arg.empty()) {
+    payload_sizes.clear();
+    for (const auto& size : controller::split_comma_string(sizes_arg)) {
+      payload_sizes.push_back(std::stoul(size));
+    }
+  }
+
+  const std::string mb_arg = get_command_line_argument(args, "--mb");
+  const size_t bytes_per_size = (mb_arg.empty() ? size_t{256} : std::stoul(mb_arg)) << 20U;
+
+  cipher_engine* cipher = cipher_engine::get_instance();
+  std::cout << "suite,payload_bytes,encrypt_ns_per_op,encrypt_mb_per_s,decrypt_ns_per_op,decrypt_mb_per_s" << std::endl;
+  for (const cipher_suite suite : suites) {
+    if (!cipher->set_cipher_suite(cipher_key_type::db_key, suite)) {
+      return 1;
+    }
+    for (const size_t payload_size : payload_sizes) {
+      const std::string payload(payload_size, 'x');
+      const size_t iterations = std::max<size_t>(1, bytes_per_size / std::max<size_t>(1, payload_size));
+      std::string ciphertext(cipher_engine::encrypted_size(payload_size), '\0');
+      std::string plaintext(payload_size, '\0');
+
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; i++) {
+        if (!cipher->encrypt(payload, cipher_key_type::db_key, std::span<char>(ciphertext))) {
+          return 1;
+        }
+      }
+      const std::chrono::duration<double> encrypt_duration = std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; i++) {
+        if (!cipher->decrypt(ciphertext, cipher_key_type::db_key, std::span<char>(plaintext))) {
+          return 1;
+        }
+      }
+      const std::chrono::duration<double> decrypt_duration = std::chrono::steady_clock::now() - start;
+      if (plaintext != payload) {
+        std::cerr << "Decrypted payload mismatch for " << controller::cipher_suite_name(suite) << std::endl;
+        return 1;
+      }
+
+      const double megabytes = static_cast<double>(iterations * payload_size) / (1U << 20U);
+      const auto ns_per_op = [&](std::chrono::duration<double> duration) {
+        return duration.count() * 1e9 / static_cast<double>(iterations);
+      };
+      std::cout << controller::cipher_suite_name(suite) << "," << payload_size << ","
+                << ns_per_op(encrypt_duration) << "," << megabytes / encrypt_duration.count() << ","
+                << ns_per_op(decrypt_duration) << "," << megabytes / decrypt_duration.count() << std::endl;
+    }
+  }
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <span>
+#include <iostream>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
@@ -28,6 +29,7 @@ constexpr std::string PUTM_FAILED      = "7";
 constexpr std::string GET_LOGS_FAILED  = "8";
 constexpr std::string INVALID_COMMAND  = "9";
 constexpr std::string UNKNOWN_ERROR    = "10";
+constexpr std::string GET_KEYS_FAILED  = "11";
 
 /* Parse the value corresponding to given option. Return empty string if not found. */
 auto inline get_command_line_argument(const auto& args, const std::string& option) -> std::string
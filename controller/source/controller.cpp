@@ -1,10 +1,13 @@
 #include <iostream>
 #include <string>
+#include <charconv>
 #include "absl/strings/match.h" // for StartsWith function
 #include <chrono>
 #include <thread>
 #include <cassert>
 #include <functional>
+#include <array>
+#include <utility>
 #include <sys/mman.h>
 
 #include "default_policy.hpp"
@@ -16,18 +19,43 @@
 #include "logging/logger.hpp"
 #include "logging/monitor.hpp"
 #include "gdpr_regulator.hpp"
+#include "index/purpose_index.hpp"
+#include "index/expiration_index.hpp"
+#include "index/expiry_reaper.hpp"
+#include "index/user_dictionary.hpp"
+#include "index/policy_store.hpp"
+#include "purpose_registry.hpp"
+#include "encryption/key_rotator.hpp"
 
 using controller::default_policy;
 using controller::cipher_engine;
 using controller::query;
+using controller::prepared_queries;
 using controller::query_rewriter;
 using controller::gdpr_filter;
+using controller::policy_validator;
 using controller::logger;
 using controller::gdpr_monitor;
 using controller::gdpr_regulator;
+using controller::purpose_index;
+using controller::expiration_index;
+using controller::expiry_reaper;
+using controller::key_rotator;
+using controller::user_dictionary;
+using controller::policy_store;
+using controller::purpose_registry;
+
+// Default rate of the background deletion of expired values: batch_size keys per interval
+constexpr int64_t default_reaper_interval_ms = 1000;
+constexpr std::size_t default_reaper_batch_size = 100;
+// Default rate of the background re-encryption after a key rotation: batch_size keys per interval
+constexpr int64_t default_rotation_interval_ms = 100;
+constexpr std::size_t default_rotation_batch_size = 100;
 
 // Declare a thread-local default_policy object
 thread_local default_policy def_policy;
+// and its access checks, compiled when the policy of the client is received
+thread_local policy_validator def_validator;
 
 auto receive_policy(int socket) -> std::optional<default_policy>
 {
@@ -66,18 +94,22 @@ auto handle_get(const std::unique_ptr<kv_client> &client,
                 const query &query_args,
                 const default_policy &def_policy) -> std::string 
 {
-  auto res = client->gdpr_get(query_args.key());
-  auto filter = std::make_shared<gdpr_filter>(res);
+  // only the metadata are decrypted until the access is granted
+  auto res = client->gdpr_get_sealed(query_args.key());
+  const gdpr_filter filter(sealed_metadata(res));
 
   // Check if the retrieved value requires logging
   auto monitor = gdpr_monitor(filter, query_args, def_policy);
-  bool is_valid = filter->validate(query_args, def_policy);
+  bool is_valid = filter.validate(def_validator.specialize(query_args));
   // Perform the logging of the (in)valid operation -- if needed
   monitor.monitor_query(is_valid);
   if (is_valid) {
     // if the key exists and complies with the gdpr rules
     // then return the value of the get operation
-    return controller::remove_gdpr_metadata(std::move(res.value()));
+    auto value = client->gdpr_unseal(res.value());
+    if (value) {
+      return controller::remove_gdpr_metadata(std::move(value.value()));
+    }
   }
   
   return GET_FAILED;// GET_FAILED: Non existing key or does not comply with GDPR rules;
@@ -87,7 +119,8 @@ auto handle_put(const std::unique_ptr<kv_client> &client,
                 const query &query_args,
                 const default_policy &def_policy) -> std::string 
 {
-  auto res = client->gdpr_get(query_args.key());
+  // the current value is replaced, only its metadata are needed
+  auto res = client->gdpr_get_sealed(query_args.key());
 
   bool is_valid = true;
   // if the key does not exist, perform the put
@@ -97,30 +130,43 @@ auto handle_put(const std::unique_ptr<kv_client> &client,
     auto monitor = gdpr_monitor(query_args, def_policy);
     // construct the gdpr metadata for the new value
     query_rewriter rewriter(query_args, def_policy, query_args.value());
+    if (!rewriter.is_valid()) {
+      monitor.monitor_query(false);
+      return PUT_FAILED; // PUT_FAILED: the ids of the new users are not persisted
+    }
     // Perform the logging of the valid operation -- if needed
     monitor.monitor_query(is_valid, rewriter.new_value());
-    auto ret_val = client->gdpr_put(query_args.key(), rewriter.new_value());
+    auto ret_val = client->gdpr_put(query_args.key(), rewriter.new_value(), rewriter.expiration());
 
     if (ret_val) {
+      purpose_index::get_instance()->update(query_args.key(), rewriter.purpose(), rewriter.objection());
+      expiration_index::get_instance()->schedule(query_args.key(), rewriter.expiration());
       return PUT_SUCCESS;
     }
     return PUT_FAILED; //PUT_FAILED: Failed to put value
   }
 
   // if the key exists and complies with the gdpr rules, perform the put
-  auto filter = std::make_shared<gdpr_filter>(res);
-  if ((is_valid = filter->validate(query_args, def_policy))) {
+  const gdpr_filter filter(sealed_metadata(res));
+  if ((is_valid = filter.validate(def_validator.specialize(query_args)))) {
     // Check if the retrieved value requires logging
     // the query args do not need to be checked since they cannot update the 
     // gpdr metadata of the value -- only putm operations can
     auto monitor = gdpr_monitor(filter, query_args, def_policy);
     // update the current value with the new one without modifying any metadata
-    query_rewriter rewriter(res.value(), query_args.value());
+    query_rewriter rewriter(res->metadata(), query_args.value());
+    if (!rewriter.is_valid()) {
+      monitor.monitor_query(false);
+      return PUT_FAILED; // PUT_FAILED: the ids of the users of a legacy value are not persisted
+    }
     // Perform the logging of the valid operation -- if needed
     monitor.monitor_query(is_valid, rewriter.new_value());
-    auto ret_val = client->gdpr_put(query_args.key(), rewriter.new_value());
+    auto ret_val = client->gdpr_put(query_args.key(), rewriter.new_value(), filter.expiration());
 
     if (ret_val) {
+      // the metadata are unchanged, but the key may predate the index
+      purpose_index::get_instance()->update(query_args.key(), filter.purpose(), filter.objection());
+      expiration_index::get_instance()->schedule(query_args.key(), filter.expiration());
       return PUT_SUCCESS;
     }
     return PUT_FAILED; // PUT_FAILED: Failed to put value
@@ -137,11 +183,12 @@ auto handle_delete(const std::unique_ptr<kv_client> &client,
                   const query &query_args,
                   const default_policy &def_policy) -> std::string 
 {
-  auto res = client->gdpr_get(query_args.key());
-  auto filter = std::make_shared<gdpr_filter>(res);
+  // the value is deleted, only its metadata are needed
+  auto res = client->gdpr_get_sealed(query_args.key());
+  const gdpr_filter filter(sealed_metadata(res));
   // Check if the retrieved value requires logging
   auto monitor = gdpr_monitor(filter, query_args, def_policy);
-  bool is_valid = filter->validate(query_args, def_policy);
+  bool is_valid = filter.validate(def_validator.specialize(query_args));
   // Perform the logging of the (in)valid operation -- if needed
   monitor.monitor_query(is_valid);
   
@@ -151,6 +198,8 @@ auto handle_delete(const std::unique_ptr<kv_client> &client,
     auto ret_val = client->gdpr_del(query_args.key());
 
     if (ret_val) {
+      purpose_index::get_instance()->remove(query_args.key());
+      expiration_index::get_instance()->cancel(query_args.key());
       return DELETE_SUCCESS;
     }
     return DELETE_FAILED; // DELETE_FAILED: Failed to delete key
@@ -164,11 +213,11 @@ auto handle_get_metadata(const std::unique_ptr<kv_client> &client,
                 const default_policy &def_policy) -> std::string
 {
   auto res = client->gdpr_getm(query_args.key());
-  auto filter = std::make_shared<gdpr_filter>(res);
+  const gdpr_filter filter(res);
 
   // Check if the retrieved key requires logging
   auto monitor = gdpr_monitor(filter, query_args, def_policy);
-  bool is_valid = filter->validate(query_args, def_policy);
+  bool is_valid = filter.validate(def_validator.specialize(query_args));
   // Perform the logging of the (in)valid operation -- if needed
   monitor.monitor_query(is_valid);
   if (is_valid) {
@@ -184,7 +233,8 @@ auto handle_put_metadata(const std::unique_ptr<kv_client> &client,
                 const query &query_args,
                 const default_policy &def_policy) -> std::string
 {
-  auto res = client->gdpr_get(query_args.key());
+  // only the metadata are decrypted until the update is granted
+  auto res = client->gdpr_get_sealed(query_args.key());
 
   bool is_valid = true;
   // if the key does not exist, return the error
@@ -192,18 +242,28 @@ auto handle_put_metadata(const std::unique_ptr<kv_client> &client,
     return "PUTM_FAILED: The specified key does not exist";
   }
   // if the key exists and complies with the gdpr rules, perform the GDPR metadata update
-  auto filter = std::make_shared<gdpr_filter>(res);
-  if ((is_valid = filter->validate(query_args, def_policy))) {
+  const gdpr_filter filter(sealed_metadata(res));
+  if ((is_valid = filter.validate(def_validator.specialize(query_args)))) {
+    auto value = client->gdpr_unseal(res.value());
+    if (!value) {
+      return PUTM_FAILED; // PUTM_FAILED: Failed to decrypt the value
+    }
     // Check if the retrieved value requires logging
     // the query args do not need to be checked since they cannot update the
     // gpdr metadata of the value -- only putm operations can
     auto monitor = gdpr_monitor(filter, query_args, def_policy);
     // update the current value with the new one without modifying any metadata
-    query_rewriter rewriter(res.value(), query_args);
+    query_rewriter rewriter(value.value(), query_args);
+    if (!rewriter.is_valid()) {
+      monitor.monitor_query(false);
+      return PUTM_FAILED; // PUTM_FAILED: the ids of the new users are not persisted
+    }
     // Perform the logging of the valid operation -- if needed
     monitor.monitor_query(is_valid, rewriter.new_value());
-    auto ret_val = client->gdpr_putm(query_args.key(), rewriter.new_value());
+    auto ret_val = client->gdpr_putm(query_args.key(), rewriter.new_value(), rewriter.expiration());
     if (ret_val) {
+      purpose_index::get_instance()->update(query_args.key(), rewriter.purpose(), rewriter.objection());
+      expiration_index::get_instance()->schedule(query_args.key(), rewriter.expiration());
       return PUTM_SUCCESS;
     }
     return PUTM_FAILED; // PUTM_FAILED: Failed to put value
@@ -216,8 +276,9 @@ auto handle_put_metadata(const std::unique_ptr<kv_client> &client,
   return PUTM_FAILED; // PUTM_FAILED: Invalid key or does not comply with GDPR rules
 }
 
-auto handle_get_logs(const query &query_args,
-                     const default_policy &def_policy) -> std::string 
+auto handle_get_logs([[maybe_unused]] const std::unique_ptr<kv_client> &client,
+                     const query &query_args,
+                     const default_policy &def_policy) -> std::string
 {
 
   /* if the current key does not match with the regulator key, return */
@@ -261,6 +322,53 @@ auto handle_get_logs(const query &query_args,
   return response.str();
 }
 
+auto handle_get_keys([[maybe_unused]] const std::unique_ptr<kv_client> &client,
+                     const query &query_args,
+                     const default_policy &def_policy) -> std::string
+{
+  /* the purpose index exposes keys of all the users, restrict it to the regulator key */
+  if (!gdpr_regulator::validate_reg_key(query_args, def_policy)) {
+    return GET_KEYS_FAILED; // GET_KEYS_FAILED: Invalid regulator key
+  }
+
+  // if no purposes are given in the query, use the defaults of the client session
+  auto purposes = query_args.cond_purpose().any() ? query_args.cond_purpose() : def_policy.purpose();
+  auto *index = purpose_index::get_instance();
+
+  if (query_args.opcode() == controller::operation::count_keys) {
+    return std::to_string(index->count_keys(purposes));
+  }
+
+  // return the comma separated keys that fit in a single response message
+  std::string response;
+  for (const auto& key : index->find_keys(purposes)) {
+    if (response.length() + key.length() + 1 > max_msg_size) {
+      break;
+    }
+    response.append(key).append(1, ',');
+  }
+  return response;
+}
+
+using query_handler = auto (*)(const std::unique_ptr<kv_client> &client,
+                               const query &query_args,
+                               const default_policy &def_policy) -> std::string;
+
+/* The handler of every operation, indexed by the opcode of the query (nullptr: INVALID_COMMAND) */
+constexpr auto query_handlers = [] {
+  std::array<query_handler, controller::num_operations> handlers {};
+  handlers[controller::operation::get] = handle_get;
+  handlers[controller::operation::put] = handle_put;
+  handlers[controller::operation::del] = handle_delete;
+  handlers[controller::operation::getm] = handle_get_metadata;
+  handlers[controller::operation::putm] = handle_put_metadata;
+  // current client resembles the regulator
+  handlers[controller::operation::get_logs] = handle_get_logs;
+  handlers[controller::operation::get_keys] = handle_get_keys;
+  handlers[controller::operation::count_keys] = handle_get_keys;
+  return handlers;
+}();
+
 auto handle_connection
 (int socket, const std::string& db_type, const std::string& db_address) -> void
 {
@@ -268,6 +376,7 @@ auto handle_connection
   auto received_policy = receive_policy(socket);
   if (received_policy) {
     def_policy = *received_policy;
+    def_validator = policy_validator(def_policy);
   } else {
     std::cerr << "Failed to receive client policy." << std::endl;
     safe_close_socket(socket);
@@ -276,6 +385,8 @@ auto handle_connection
 
   // Create the connection with the database instance
   std::unique_ptr<kv_client> client = kv_factory::create(db_type, db_address);
+  // the query templates that the client prepares on this connection
+  prepared_queries prepared;
 
   // Allocate a large buffer using mmap to hold the message and its size
   void* buffer = mmap(nullptr, max_msg_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
@@ -300,36 +411,25 @@ auto handle_connection
     query query_args(static_cast<char*>(buffer));
     std::string response;
 
-    if (query_args.cmd() == "exit") [[unlikely]] {
+    if (query_args.opcode() == controller::operation::quit) [[unlikely]] {
       std::cout << "Client exiting..." << std::endl;
       break;
     }
-    else if (query_args.cmd() == "invalid") [[unlikely]] {
-      response = INVALID_COMMAND;
+    // the execution of a prepared query runs the command of its template
+    if (query_args.opcode() == controller::operation::execute) {
+      query_args = prepared.bind(query_args).value_or(query());
     }
-    else [[likely]] {
-      if (query_args.cmd() == "get") {
-        response = handle_get(client, query_args, def_policy);
-      }
-      else if (query_args.cmd() == "put") {
-        response = handle_put(client, query_args, def_policy);
-      }
-      else if (query_args.cmd() == "delete") {
-        response = handle_delete(client, query_args, def_policy);
-      }
-      else if (query_args.cmd() == "putm") { /* ignore for now */
-        response = handle_put_metadata(client, query_args, def_policy);
-      }
-      else if (query_args.cmd() == "getm") { /* ignore for now */
-        response = handle_get_metadata(client, query_args, def_policy);
-      }
-      else if (query_args.cmd() == "getlogs") {
-        // current client resembles the regulator
-        response = handle_get_logs(query_args, def_policy);
-      }
-      else {
-        response = INVALID_COMMAND;
-      }
+    if (query_args.opcode() == controller::operation::prepare) {
+      auto handle = prepared.prepare(static_cast<char*>(buffer));
+      // the handles are answered as "#<handle>", unlike the numeric response codes
+      response = handle.has_value() ? "#" + std::to_string(handle.value()) : INVALID_COMMAND;
+    }
+    // dispatch on the opcode, the invalid queries have no handler
+    else if (const query_handler handler = query_handlers[query_args.opcode()]; handler != nullptr) [[likely]] {
+      response = handler(client, query_args, def_policy);
+    }
+    else {
+      response = INVALID_COMMAND;
     }
 
     // Check the message size
@@ -352,6 +452,58 @@ auto handle_connection
   safe_close_socket(socket);
 }
 
+static auto parse_key_id(std::string_view key_id) -> std::optional<uint8_t>
+{
+  unsigned int parsed_id = 0;
+  const auto [end, error] = std::from_chars(key_id.data(), key_id.data() + key_id.size(), parsed_id);
+  if (error != std::errc() || end != key_id.data() + key_id.size() || parsed_id >= controller::max_key_ids) {
+    return std::nullopt;
+  }
+  return static_cast<uint8_t>(parsed_id);
+}
+
+/*
+ * Set up the key ring of the key type from the options "--<prefix>_encryptionkey" (the active key),
+ * "--<prefix>_keyid" (its key id, 0 by default) and "--<prefix>_oldkeys" ("<id>:<key>,..." the keys of
+ * the previous rotations, which remain valid for decryption until the data are migrated).
+ * Returns whether old keys were loaded, i.e., whether the data need to be migrated to the active key.
+ */
+static auto init_key_ring(const auto& args, const std::string& prefix, cipher_key_type key_type) -> bool
+{
+  auto *cipher = cipher_engine::get_instance();
+  const std::string encryption_key = get_command_line_argument(args, "--" + prefix + "_encryptionkey");
+  const std::string key_id = get_command_line_argument(args, "--" + prefix + "_keyid");
+  bool key_set = false;
+  if (key_id.empty()) {
+    key_set = cipher->init_encryption_key(encryption_key, key_type);
+  } else {
+    auto parsed_id = parse_key_id(key_id);
+    key_set = parsed_id.has_value() && !encryption_key.empty() &&
+              cipher->add_encryption_key(encryption_key, key_type, parsed_id.value()) &&
+              cipher->activate_encryption_key(key_type, parsed_id.value());
+  }
+  if (!key_set) {
+    std::cerr << "cipher engine error at the " << prefix << " encryption key init phase" << std::endl;
+    std::quick_exit(1);
+  }
+
+  const std::string old_keys = get_command_line_argument(args, "--" + prefix + "_oldkeys");
+  if (old_keys.empty()) {
+    return false;
+  }
+  for (const auto& old_key : controller::split_comma_string(old_keys)) {
+    const size_t separator = old_key.find(':');
+    auto old_key_id = parse_key_id(std::string_view(old_key).substr(0, separator));
+    if (separator == std::string::npos || !old_key_id.has_value() ||
+        old_key_id.value() == cipher->active_key_id(key_type) ||
+        !cipher->add_encryption_key(std::string_view(old_key).substr(separator + 1), key_type, old_key_id.value())) {
+      std::cerr << "--" << prefix << "_oldkeys <id>:<key>,... argument is invalid!" << std::endl;
+      std::quick_exit(1);
+    }
+  }
+  return true;
+}
+
 auto main(int argc, char* argv[]) -> int
 { 
   /* initialize the client object that exports put/get/delete API */
@@ -367,20 +519,78 @@ auto main(int argc, char* argv[]) -> int
   const std::string log_path = get_command_line_argument(args, "--logpath");
   logger::get_instance()->init_log_path(log_path);
 
-  // set the database encryption key based on the input parameter
-  const std::string db_encryption_key = get_command_line_argument(args, "--db_encryptionkey");
-  if (!cipher_engine::get_instance()->init_encryption_key(db_encryption_key, cipher_key_type::db_key)) {
-    std::cerr << "cipher engine error at the db encryption key init phase" << std::endl;
+  // set the database and log encryption keys, along with the keys of their previous rotations
+  const bool db_key_rotated = init_key_ring(args, "db", cipher_key_type::db_key);
+  const bool log_key_rotated = init_key_ring(args, "log", cipher_key_type::log_key);
+
+  // set the cipher suites of the new values and log entries, the existing ones remain readable
+  for (const auto& [option, key_type] : {std::pair{"--db_cipher", cipher_key_type::db_key},
+                                         std::pair{"--log_cipher", cipher_key_type::log_key}}) {
+    const std::string suite_name = get_command_line_argument(args, option);
+    if (suite_name.empty()) {
+      continue;
+    }
+    auto suite = controller::parse_cipher_suite(suite_name);
+    if (!suite || !cipher_engine::get_instance()->set_cipher_suite(key_type, suite.value())) {
+      std::cerr << option << " {aes-128-gcm,aes-256-gcm,chacha20-poly1305,none} argument is invalid!" << std::endl;
+      std::quick_exit(1);
+    }
+  }
+
+  // load the user dictionary and the policy store, whose records are encrypted with the db key.
+  // The stored metadata refer to their ids, so they belong to the database: no default path, which would
+  // depend on the working directory and silently start empty stores for an existing database
+  const std::string users_path = get_command_line_argument(args, "--users_path");
+  const std::string policies_path = get_command_line_argument(args, "--policies_path");
+  if (users_path.empty() || policies_path.empty()) {
+    std::cerr << "--users_path <file> and --policies_path <file> arguments must be passed!" << std::endl;
+    std::quick_exit(1);
+  }
+  if (!user_dictionary::get_instance()->init(users_path)) {
+    std::cerr << "--users_path: the user dictionary cannot be loaded!" << std::endl;
+    std::quick_exit(1);
+  }
+  if (!policy_store::get_instance()->init(policies_path)) {
+    std::cerr << "--policies_path: the policy store cannot be loaded!" << std::endl;
     std::quick_exit(1);
   }
 
-  // set the log encryption key based on the input parameter
-  const std::string log_encryption_key = get_command_line_argument(args, "--log_encryptionkey");
-  if (!cipher_engine::get_instance()->init_encryption_key(log_encryption_key, cipher_key_type::log_key)) {
-    std::cerr << "cipher engine error at the log encryption key init phase" << std::endl;
+  // load the purpose names, purpose0 .. purpose63 by default
+  const std::string purposes_path = get_command_line_argument(args, "--purposes_path");
+  if (!purposes_path.empty() && !purpose_registry::get_instance()->init(purposes_path)) {
+    std::cerr << "--purposes_path: the purpose registry cannot be loaded!" << std::endl;
     std::quick_exit(1);
   }
 
+  // Start the background deletion of the expired values, unless it is disabled with interval 0
+  const std::string reaper_interval_ms = get_command_line_argument(args, "--reaper_interval_ms");
+  const std::string reaper_batch_size = get_command_line_argument(args, "--reaper_batch_size");
+  const auto reaper_interval = std::chrono::milliseconds(
+      reaper_interval_ms.empty() ? default_reaper_interval_ms : std::stoll(reaper_interval_ms));
+  std::unique_ptr<expiry_reaper> reaper;
+  if (reaper_interval.count() > 0) {
+    reaper = std::make_unique<expiry_reaper>(
+        kv_factory::create(db_type, db_address),
+        reaper_batch_size.empty() ? default_reaper_batch_size : std::stoull(reaper_batch_size),
+        reaper_interval);
+    reaper->start();
+  }
+
+  // After a key rotation, migrate the values and the logs to the active keys in the background
+  std::unique_ptr<key_rotator> rotator;
+  #ifdef ENCRYPTION_ENABLED
+  if (db_key_rotated || log_key_rotated) {
+    const std::string rotation_interval_ms = get_command_line_argument(args, "--rotation_interval_ms");
+    const std::string rotation_batch_size = get_command_line_argument(args, "--rotation_batch_size");
+    rotator = std::make_unique<key_rotator>(
+        kv_factory::create(db_type, db_address),
+        rotation_batch_size.empty() ? default_rotation_batch_size : std::stoull(rotation_batch_size),
+        std::chrono::milliseconds(rotation_interval_ms.empty() ? default_rotation_interval_ms
+                                                               : std::stoll(rotation_interval_ms)));
+    rotator->start();
+  }
+  #endif
+
   // Create a socket and accept for clients
   std::string controller_address = get_command_line_argument(args, "--controller_address");
   std::string controller_port = get_command_line_argument(args, "--controller_port");
@@ -1,4 +1,5 @@
 #include "default_policy.hpp"
+#include "purpose_registry.hpp"
 
 namespace controller {
 
@@ -35,8 +36,10 @@ default_policy::default_policy(const std::string &input)
   this->m_expiration = stoll(option_map["-expTime"]);
   this->m_encryption = str_to_bool(std::string_view(option_map["-encryption"]));
   this->m_monitor = str_to_bool(std::string_view(option_map["-monitor"]));
-  set_bitmap(this->m_purpose, split_comma_string(std::string_view(option_map["-purpose"])));
-  set_bitmap(this->m_objection, split_comma_string(std::string_view(option_map["-objection"])));
+  if (!set_bitmap(this->m_purpose, std::string_view(option_map["-purpose"])) ||
+      !set_bitmap(this->m_objection, std::string_view(option_map["-objection"]))) {
+    throw std::invalid_argument("Error: purpose not registered.");
+  }
 }
 
 // default_policy::~default_policy()
@@ -65,12 +68,12 @@ auto default_policy::encryption() const -> bool
   return this->m_encryption;
 }
 
-auto default_policy::purpose() const -> std::bitset<num_purposes>
+auto default_policy::purpose() const -> purpose_bitmap
 {
   return this->m_purpose;
 }
 
-auto default_policy::objection() const -> std::bitset<num_purposes>
+auto default_policy::objection() const -> purpose_bitmap
 {
   return this->m_objection;
 }
@@ -20,8 +20,8 @@ public:
   /* private members getters */
   [[nodiscard]] auto user_key() const -> std::string_view;
   [[nodiscard]] auto encryption() const -> bool;
-  [[nodiscard]] auto purpose() const -> std::bitset<num_purposes>;
-  [[nodiscard]] auto objection() const -> std::bitset<num_purposes>;
+  [[nodiscard]] auto purpose() const -> purpose_bitmap;
+  [[nodiscard]] auto objection() const -> purpose_bitmap;
   [[nodiscard]] auto origin() const -> std::string_view;
   [[nodiscard]] auto expiration() const -> int64_t;
   [[nodiscard]] auto share() const -> std::string_view;
@@ -31,8 +31,8 @@ private:
   // default policy fields
   std::string m_user_key;
   bool m_encryption;
-  std::bitset<num_purposes> m_purpose;
-  std::bitset<num_purposes> m_objection;
+  purpose_bitmap m_purpose;
+  purpose_bitmap m_objection;
   std::string m_origin;
   int64_t m_expiration;
   std::string m_share;
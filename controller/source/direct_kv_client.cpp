@@ -54,17 +54,22 @@ auto main(int argc, char* argv[]) -> int
 
     const query query_args(input);
     std::string result;
-    if (query_args.cmd() == "get") {
-      result = handle_get(query_args, client);
-    } else if (query_args.cmd() == "put") {
-      result = handle_put(query_args, client);
-    } else if (query_args.cmd() == "delete") {
-      result = handle_delete(query_args, client);
-    } else if (query_args.cmd() == "exit") {
+    if (query_args.opcode() == controller::operation::quit) {
       std::cout << "Exiting..." << std::endl;
       break;
-    } else {
-      result = INVALID_COMMAND;
+    }
+    switch (query_args.opcode()) {
+      case controller::operation::get:
+        result = handle_get(query_args, client);
+        break;
+      case controller::operation::put:
+        result = handle_put(query_args, client);
+        break;
+      case controller::operation::del:
+        result = handle_delete(query_args, client);
+        break;
+      default:
+        result = INVALID_COMMAND;
     }
     std::cout << result << std::endl;
   }
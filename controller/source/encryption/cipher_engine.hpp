@@ -1,8 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <cstring>
+#include <iostream>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <array>
 #include <vector>
 #include <algorithm>
@@ -26,12 +33,64 @@ enum class cipher_key_type {
   max_key   // Maximum key value for range checking
 };
 
+// Cipher suites, recorded in the format tag (first byte) of every ciphertext
+enum class cipher_suite : uint8_t {
+  none,               // No encryption: the plaintext follows the header
+  aes_128_gcm,        // AES-GCM with a 128-bit key
+  aes_256_gcm,        // AES-GCM with a 256-bit key
+  chacha20_poly1305,  // ChaCha20-Poly1305, for CPUs without AES instructions
+  max_suite           // Maximum suite value for range checking
+};
+
 namespace controller
 {
 
 constexpr int encryption_key_len = 16; // 128 bits for AES-GCM-128
-constexpr int initialization_vector_len = 12; // 96 bits for AES-GCM
-constexpr int tag_len = 16; // 128 bits for AES-GCM-128
+constexpr int max_encryption_key_len = 32; // 256 bits for AES-GCM-256 and ChaCha20-Poly1305
+constexpr int format_tag_len = 1; // cipher suite (low nibble) and key id (high nibble) of the ciphertext
+constexpr int max_key_ids = 16; // key ids of every key type, as recorded in the format tag
+constexpr uint8_t format_suite_mask = 0x0FU;
+constexpr unsigned int format_key_id_shift = 4;
+constexpr int initialization_vector_len = 12; // 96 bits for AES-GCM and ChaCha20-Poly1305
+constexpr int tag_len = 16; // 128 bits for AES-GCM and ChaCha20-Poly1305
+constexpr int nonce_prefix_len = 8; // random per-thread part of the IV
+constexpr int nonce_counter_len = initialization_vector_len - nonce_prefix_len; // per-thread counter part of the IV
+constexpr int num_key_types = static_cast<int>(cipher_key_type::max_key);
+constexpr size_t num_cipher_suites = static_cast<size_t>(cipher_suite::max_suite);
+// Length of the header preceding the encrypted value: format tag | iv | tag | ciphertext length
+constexpr size_t ciphertext_header_len = format_tag_len + initialization_vector_len + tag_len + sizeof(int);
+constexpr size_t initialization_vector_offset = format_tag_len;
+constexpr size_t tag_offset = initialization_vector_offset + initialization_vector_len;
+constexpr size_t length_offset = tag_offset + tag_len;
+// Ciphertexts written before the format tag: "iv | tag | ciphertext length | encrypted value", always
+// encrypted with AES-128-GCM under the key configured at the time, which is the key id 0 of the ring
+constexpr size_t legacy_header_len = ciphertext_header_len - format_tag_len;
+constexpr uint8_t legacy_key_id = 0;
+
+/* The format tag of a ciphertext encrypted with the suite under the key id */
+constexpr auto format_tag(cipher_suite suite, uint8_t key_id) -> char {
+  return static_cast<char>(static_cast<uint8_t>(key_id << format_key_id_shift) | static_cast<uint8_t>(suite));
+}
+
+/* Names of the cipher suites, as given in the command line options */
+inline auto cipher_suite_name(cipher_suite suite) -> std::string_view {
+  switch (suite) {
+    case cipher_suite::none: return "none";
+    case cipher_suite::aes_128_gcm: return "aes-128-gcm";
+    case cipher_suite::aes_256_gcm: return "aes-256-gcm";
+    case cipher_suite::chacha20_poly1305: return "chacha20-poly1305";
+    default: return "invalid";
+  }
+}
+
+inline auto parse_cipher_suite(std::string_view name) -> std::optional<cipher_suite> {
+  for (size_t suite = 0; suite < num_cipher_suites; suite++) {
+    if (cipher_suite_name(static_cast<cipher_suite>(suite)) == name) {
+      return static_cast<cipher_suite>(suite);
+    }
+  }
+  return std::nullopt;
+}
 
 class encrypt_result
 {
@@ -78,10 +137,94 @@ public:
   }
 
   /**
-   * Encrypts the input using the specified encryption key type.
+   * Size of the ciphertext of a plaintext_len bytes input (header followed by the encrypted bytes).
+   */
+  static constexpr auto encrypted_size(size_t plaintext_len) -> size_t {
+    return ciphertext_header_len + plaintext_len;
+  }
+
+  /**
+   * Size of the plaintext of the ciphertext, as encoded in its header (0 if the header is truncated).
+   */
+  static auto decrypted_size(std::string_view ciphertext) -> size_t {
+    if (ciphertext.size() < ciphertext_header_len) {
+      return 0;
+    }
+    int ciphertext_len = 0;
+    std::memcpy(&ciphertext_len, ciphertext.data() + length_offset, sizeof(int));
+    return ciphertext_len < 0 ? 0 : static_cast<size_t>(ciphertext_len);
+  }
+
+  /**
+   * Size of the first message of the ciphertext (header and encrypted bytes), or std::nullopt
+   * if its header is truncated or its length exceeds the ciphertext.
+   */
+  static auto message_size(std::string_view ciphertext) -> std::optional<size_t> {
+    if (ciphertext.size() < ciphertext_header_len) {
+      return std::nullopt;
+    }
+    const size_t size = encrypted_size(decrypted_size(ciphertext));
+    if (size > ciphertext.size()) {
+      return std::nullopt;
+    }
+    return size;
+  }
+
+  /**
+   * Cipher suite and key id of the first message of the ciphertext, as recorded in its format tag.
+   */
+  static auto ciphertext_suite(std::string_view ciphertext) -> cipher_suite {
+    return ciphertext.empty() ? cipher_suite::max_suite
+                              : static_cast<cipher_suite>(static_cast<uint8_t>(ciphertext[0]) & format_suite_mask);
+  }
+
+  static auto ciphertext_key_id(std::string_view ciphertext) -> uint8_t {
+    return ciphertext.empty() ? 0 : static_cast<uint8_t>(static_cast<uint8_t>(ciphertext[0]) >> format_key_id_shift);
+  }
+
+  /**
+   * Whether the ciphertext was written before the format tag: its messages (one, or two for the split
+   * format) only line up with the legacy header. A tagged ciphertext always lines up with its own header,
+   * so it is never taken for a legacy one.
+   */
+  static auto is_legacy_ciphertext(std::string_view ciphertext) -> bool {
+    return !ciphertext.empty() && !spans_messages(ciphertext, format_tag_len) && spans_messages(ciphertext, 0);
+  }
+
+  /**
+   * Rewrites a legacy ciphertext (see is_legacy_ciphertext) in the tagged format, by prepending the format tag
+   * of AES-128-GCM under legacy_key_id to each of its messages; the MACs remain valid.
+   * Returns false if the ciphertext is not a legacy one, which is left untouched.
+   */
+  static auto upgrade_legacy_ciphertext(std::string& ciphertext) -> bool {
+    if (!is_legacy_ciphertext(ciphertext)) {
+      return false;
+    }
+    std::string upgraded;
+    upgraded.reserve(ciphertext.size() + 2 * format_tag_len);
+    std::string_view remaining = ciphertext;
+    while (!remaining.empty()) {
+      const size_t size = spanned_message_size(remaining, 0).value_or(remaining.size());
+      upgraded.append(1, format_tag(cipher_suite::aes_128_gcm, legacy_key_id));
+      upgraded.append(remaining.substr(0, size));
+      remaining.remove_prefix(size);
+    }
+    ciphertext = std::move(upgraded);
+    return true;
+  }
+
+  /**
+   * Size of a value encrypted in the split format (see encrypt_split).
+   */
+  static constexpr auto split_encrypted_size(size_t metadata_len, size_t value_len) -> size_t {
+    return encrypted_size(metadata_len) + encrypted_size(value_len);
+  }
+
+  /**
+   * Encrypts the input using the specified encryption key type, with the cipher suite set for it.
    * 
-   * If successful, output's first initialization_vector_len chars contain 
-   * the initialization vector (iv) in plain text.
+   * If successful, output's first char is the format tag, i.e., the cipher suite and the id of the active key.
+   * Following initialization_vector_len chars contain the initialization vector (iv) in plain text.
    * Following tag_len chars contain calculated MAC. 
    * Next 4 bytes contain the size of the encrypted value.
    * The rest of the output string contains ciphered form of the input based on encryption key.
@@ -92,86 +235,83 @@ public:
    */
   auto encrypt(std::string_view input, cipher_key_type key_type) -> encrypt_result {
     static encrypt_result failed_encrypt_result {{}, /*success*/ false};
-    
-    const unsigned char* key = get_encryption_key(key_type);
-    if (key == nullptr) {
-      std::cerr << "Invalid encryption key type!" << std::endl;
-      return failed_encrypt_result;
-    }
 
-    /* Generate a random IV */
-    std::array<unsigned char, initialization_vector_len> initialization_vector{};
-    if (RAND_bytes(initialization_vector.data(), sizeof(initialization_vector)) != 1) {
-      std::cerr << "Failed to generate random initialization vector!" << std::endl;
-      return failed_encrypt_result;
-    }
-
-    /* Create and initialise the context */
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (ctx == nullptr) {
-      std::cerr << "Failed to create encryption context!" << std::endl;
+    std::string result_string(encrypted_size(input.size()), '\0');
+    if (!encrypt(input, key_type, std::span<char>(result_string)).has_value()) {
       return failed_encrypt_result;
     }
+    return encrypt_result {std::move(result_string), /*success*/ true};
+  }
 
-    /* Initialise the encryption operation. */
-    if (EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, key, initialization_vector.data()) != 1) {
-      std::cerr << "Failed to initialize encryption!" << std::endl;
-      EVP_CIPHER_CTX_free(ctx);
-      return failed_encrypt_result;
+  /**
+   * Encrypts the input into the caller-provided output buffer, in the same format as above.
+   *
+   * The output must hold at least encrypted_size(input.size()) bytes. The input may be placed
+   * at ciphertext_header_len bytes inside the output buffer to encrypt in place.
+   *
+   * @param input The plaintext to encrypt.
+   * @param keyType The encryption key type to use.
+   * @param output The buffer that receives the ciphertext.
+   * @param aad Additional data authenticated by the MAC but not encrypted, needed again for the decryption.
+   * @return The length of the ciphertext, or std::nullopt on failure.
+   */
+  auto encrypt(std::string_view input, cipher_key_type key_type, std::span<char> output,
+               std::string_view aad = {}) -> std::optional<size_t> {
+    if (!valid_key_type(key_type)) {
+      return std::nullopt;
     }
 
-    int ciphertext_len = 0;
-    /* max ciphertext len for a n bytes of plaintext is n + AES_BLOCK_SIZE bytes */
-    std::vector<unsigned char> ciphertext(input.size() + static_cast<size_t>(EVP_CIPHER_CTX_block_size(ctx)));
-    /* Provide the plaintext to be encrypted, and obtain the encrypted output. */
-    if (EVP_EncryptUpdate(ctx, ciphertext.data(), &ciphertext_len, reinterpret_cast<const unsigned char*>(input.data()), static_cast<int>(input.size())) != 1) {
-      std::cerr << "Failed to perform encryption!" << std::endl;
-      EVP_CIPHER_CTX_free(ctx);
-      return failed_encrypt_result;
-    }
+    return encrypt_message(get_thread_state(), key_type, active_key_id(key_type), get_cipher_suite(key_type),
+                           input, output, aad);
+  }
 
-    /* Finalise the encryption. */
-    int final_len = 0;
-    if (EVP_EncryptFinal_ex(ctx, ciphertext.data() + ciphertext_len, &final_len) != 1) {
-      std::cerr << "Failed to finalize encryption!" << std::endl;
-      EVP_CIPHER_CTX_free(ctx);
-      return failed_encrypt_result;
+  /**
+   * Encrypts a batch of independent messages into the caller-provided output buffer.
+   *
+   * Every message is encrypted in the same format as above, with its own IV, so the
+   * ciphertexts can be decrypted individually. The batch shares the key checks and the
+   * suite selection, and the ciphertexts are laid out back to back in the output buffer,
+   * which must hold the sum of the encrypted_size of the inputs.
+   * The messages are still encrypted one after the other (the EVP interface has no multi-buffer
+   * AES-GCM), so the cost per message is the one of encrypt; see cipher_perf_test.
+   *
+   * @param inputs The plaintexts to encrypt.
+   * @param keyType The encryption key type to use.
+   * @param output The buffer that receives the ciphertexts.
+   * @param ciphertexts Receives the view of every ciphertext inside the output buffer.
+   * @return The success status; the batch fails as a whole.
+   */
+  auto encrypt_batch(std::span<const std::string_view> inputs, cipher_key_type key_type,
+                     std::span<char> output, std::span<std::string_view> ciphertexts) -> bool {
+    if (!valid_key_type(key_type) || ciphertexts.size() < inputs.size()) {
+      std::cerr << "Invalid encryption batch!" << std::endl;
+      return false;
     }
 
-    ciphertext_len += final_len;
-
-    /* Retrieve the MAC (Message Authentication Code) of the ciphertext */
-    std::vector<unsigned char> mac(tag_len);
-    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, tag_len, mac.data()) != 1) {
-      std::cerr << "Failed to extract MAC!" << std::endl;
-      EVP_CIPHER_CTX_free(ctx);
-      return failed_encrypt_result;
+    thread_cipher_state& state = get_thread_state();
+    const uint8_t key_id = active_key_id(key_type);
+    const cipher_suite suite = get_cipher_suite(key_type);
+    size_t offset = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      auto message_output = output.subspan(std::min(offset, output.size()));
+      auto ciphertext_len = encrypt_message(state, key_type, key_id, suite, inputs[i], message_output);
+      if (!ciphertext_len.has_value()) {
+        return false;
+      }
+      ciphertexts[i] = std::string_view(message_output.data(), ciphertext_len.value());
+      offset += ciphertext_len.value();
     }
-
-    /* Clean up */
-    EVP_CIPHER_CTX_free(ctx);
-
-    std::string result_string;
-    result_string.reserve(initialization_vector_len + tag_len + sizeof(int) + ciphertext_len);
-
-    result_string.append(reinterpret_cast<const char*>(initialization_vector.data()), initialization_vector_len);
-    result_string.append(reinterpret_cast<const char*>(mac.data()), tag_len);
-
-    // Encode the ciphertext length as a 4-byte integer
-    result_string.append(reinterpret_cast<const char*>(&ciphertext_len), sizeof(int));
-
-    result_string.append(reinterpret_cast<const char*>(ciphertext.data()), 
-                         static_cast<std::string::size_type>(ciphertext_len));
-
-    return encrypt_result {std::move(result_string), /*success*/ true};
+    return true;
   }
 
-
   /**
    * Decrypts the ciphertext using the specified encryption key type.
    * 
-   * First initialization_vector_len chars are expected to be the initialization vector,
+   * The first char is expected to be the format tag, followed by the initialization vector,
    * the calculated MAC, the size of the encrypted value, and the actual encrypted value.
+   * The ciphertext is decrypted with the suite and the key of its format tag, whatever the current
+   * suite and active key, as long as its key is still in the key ring.
+   * A ciphertext written before the format tag is decrypted with the legacy key (see is_legacy_ciphertext).
    * 
    * @param ciphertext The ciphertext to decrypt.
    * @param keyType The encryption key type to use.
@@ -180,72 +320,216 @@ public:
   auto decrypt(std::string_view ciphertext, cipher_key_type key_type) -> decrypt_result {
     static decrypt_result failed_decrypt_result {{}, /*success*/ false};
 
-    const unsigned char* key = get_encryption_key(key_type);
-    if (key == nullptr) {
-      std::cerr << "Invalid encryption key type!" << std::endl;
+    if (is_legacy_ciphertext(ciphertext)) {
+      std::string upgraded(ciphertext);
+      upgrade_legacy_ciphertext(upgraded);
+      return decrypt(upgraded, key_type);
+    }
+
+    std::string result_string(decrypted_size(ciphertext), '\0');
+    auto plaintext_len = decrypt(ciphertext, key_type, std::span<char>(result_string));
+    if (!plaintext_len.has_value()) {
       return failed_decrypt_result;
     }
+    result_string.resize(plaintext_len.value());
+    return decrypt_result {std::move(result_string), /*success*/ true};
+  }
 
-    // Extract the components from the result string
-    const auto* iv = reinterpret_cast<const unsigned char*>(ciphertext.data());
-    const auto* mac = iv + initialization_vector_len;
-    const auto* len_bytes = mac + tag_len;
-    const auto* encrypted_value = len_bytes + sizeof(int);
+  /**
+   * Decrypts the ciphertext into the caller-provided output buffer.
+   *
+   * The output must hold at least decrypted_size(ciphertext) bytes. It may start at
+   * ciphertext_header_len bytes inside the ciphertext to decrypt in place.
+   *
+   * @param ciphertext The ciphertext to decrypt.
+   * @param keyType The encryption key type to use.
+   * @param output The buffer that receives the plaintext.
+   * @param aad The additional authenticated data the ciphertext was encrypted with.
+   * @return The length of the plaintext, or std::nullopt on failure.
+   */
+  auto decrypt(std::string_view ciphertext, cipher_key_type key_type, std::span<char> output,
+               std::string_view aad = {}) -> std::optional<size_t> {
+    if (!valid_key_type(key_type)) {
+      return std::nullopt;
+    }
 
-    // Retrieve the ciphertext length from the 4-byte integer
-    int ciphertext_len = 0;
-    std::memcpy(&ciphertext_len, len_bytes, sizeof(int));
+    return decrypt_message(get_thread_state(), key_type, ciphertext, output, aad, /*allow_plaintext*/ false);
+  }
 
-    // Create and initialize the context
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (ctx == nullptr) {
-        std::cerr << "Failed to create decryption context!" << std::endl;
-        return failed_decrypt_result;
+  /**
+   * Decrypts the ciphertext held in the buffer in place: on success the buffer contains the plaintext.
+   * No memory is allocated, the buffer is only shrunk. On failure its content is unspecified.
+   *
+   * @param buffer The ciphertext to decrypt, replaced by the plaintext.
+   * @param keyType The encryption key type to use.
+   * @return The success status.
+   */
+  auto decrypt_in_place(std::string& buffer, cipher_key_type key_type) -> bool {
+    if (buffer.size() < ciphertext_header_len) {
+      std::cerr << "Ciphertext is shorter than its header!" << std::endl;
+      return false;
     }
+    auto plaintext_len = decrypt(buffer, key_type, std::span<char>(buffer).subspan(ciphertext_header_len));
+    if (!plaintext_len.has_value()) {
+      return false;
+    }
+    buffer.erase(0, ciphertext_header_len);
+    buffer.resize(plaintext_len.value());
+    return true;
+  }
 
-    // Initialize the decryption operation
-    if (EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, key, iv) != 1) {
-        std::cerr << "Failed to initialize decryption!" << std::endl;
-        EVP_CIPHER_CTX_free(ctx);
-        return failed_decrypt_result;
+  /**
+   * Decrypts a batch of independent ciphertexts in place, sharing the key checks among them.
+   * The buffers that fail to decrypt are reset to std::nullopt, the empty ones are skipped.
+   *
+   * @param buffers The ciphertexts to decrypt, replaced by the plaintexts.
+   * @param keyType The encryption key type to use.
+   * @return The number of buffers that failed to decrypt.
+   */
+  auto decrypt_batch_in_place(std::span<std::optional<std::string>> buffers, cipher_key_type key_type) -> size_t {
+    if (!valid_key_type(key_type)) {
+      return buffers.size();
     }
+    thread_cipher_state& state = get_thread_state();
+    size_t failures = 0;
+    for (auto& buffer : buffers) {
+      if (!buffer.has_value()) {
+        continue;
+      }
+      std::string& ciphertext = buffer.value();
+      std::optional<size_t> plaintext_len;
+      if (ciphertext.size() >= ciphertext_header_len) {
+        plaintext_len = decrypt_message(state, key_type, ciphertext,
+                                        std::span<char>(ciphertext).subspan(ciphertext_header_len),
+                                        /*aad*/ {}, /*allow_plaintext*/ false);
+      }
+      if (!plaintext_len.has_value()) {
+        buffer = std::nullopt;
+        failures++;
+        continue;
+      }
+      ciphertext.erase(0, ciphertext_header_len);
+      ciphertext.resize(plaintext_len.value());
+    }
+    return failures;
+  }
 
-    // Provide the ciphertext to be decrypted, and obtain the decrypted output
-    int plaintext_len = 0;
-    std::vector<unsigned char> plaintext(static_cast<unsigned int>(ciphertext_len));
-    if (EVP_DecryptUpdate(ctx, plaintext.data(), &plaintext_len, encrypted_value, ciphertext_len) != 1) {
-        std::cerr << "Failed to perform decryption!" << std::endl;
-        EVP_CIPHER_CTX_free(ctx);
-        return failed_decrypt_result;
+  /**
+   * Encrypts a value with its gdpr metadata in the split format: the metadata are encrypted as a
+   * small envelope, followed by the value encrypted as a separate message that authenticates the
+   * MAC of the envelope as additional data. Both messages have the format of encrypt above, so the
+   * metadata can be decrypted (and the access checked) without decrypting the value, while the value
+   * cannot be moved under the envelope of another object.
+   *
+   * The envelope always uses the suite set for the key type. A non-sensitive value may be stored with
+   * the none suite: it is then written first and the envelope authenticates the whole value message
+   * as additional data instead, so neither the value nor its suite can be changed without the key.
+   * The value is then still hashed in full by GHASH, on every encryption and envelope decryption. Authenticating
+   * a digest of the value instead would be slower: SHA-256 runs at about a sixth of the speed of GHASH.
+   *
+   * The output must hold at least split_encrypted_size(metadata.size(), value.size()) bytes.
+   *
+   * @param metadata The gdpr metadata prefix of the value.
+   * @param value The value itself.
+   * @param keyType The encryption key type to use.
+   * @param output The buffer that receives the ciphertext.
+   * @param value_suite The cipher suite of the value part, defaults to the suite set for the key type.
+   * @return The length of the ciphertext, or std::nullopt on failure.
+   */
+  auto encrypt_split(std::string_view metadata, std::string_view value, cipher_key_type key_type,
+                     std::span<char> output, std::optional<cipher_suite> value_suite = std::nullopt)
+      -> std::optional<size_t> {
+    if (!valid_key_type(key_type)) {
+      return std::nullopt;
+    }
+    if (output.size() < split_encrypted_size(metadata.size(), value.size())) {
+      std::cerr << "Encryption output buffer is too small!" << std::endl;
+      return std::nullopt;
     }
 
-    // Set the expected MAC value
-    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, tag_len, const_cast<unsigned char*>(mac)) != 1) {
-        std::cerr << "Failed to set MAC value!" << std::endl;
-        EVP_CIPHER_CTX_free(ctx);
-        return failed_decrypt_result;
+    thread_cipher_state& state = get_thread_state();
+    // both messages are encrypted under the same key
+    const uint8_t key_id = active_key_id(key_type);
+    const cipher_suite suite = get_cipher_suite(key_type);
+    if (value_suite == cipher_suite::none && suite != cipher_suite::none) {
+      const size_t envelope_size = encrypted_size(metadata.size());
+      auto value_message = output.subspan(envelope_size);
+      auto value_len = encrypt_message(state, key_type, key_id, cipher_suite::none, value, value_message);
+      if (!value_len.has_value()) {
+        return std::nullopt;
+      }
+      auto envelope_len = encrypt_message(state, key_type, key_id, suite, metadata, output,
+                                          std::string_view(value_message.data(), value_len.value()));
+      if (!envelope_len.has_value()) {
+        return std::nullopt;
+      }
+      return envelope_len.value() + value_len.value();
     }
 
-    // Finalize the decryption
-    int final_len = 0;
-    if (EVP_DecryptFinal_ex(ctx, plaintext.data() + plaintext_len, &final_len) != 1) {
-        std::cerr << "Failed to finalize decryption!" << std::endl;
-        EVP_CIPHER_CTX_free(ctx);
-        return failed_decrypt_result;
+    auto envelope_len = encrypt_message(state, key_type, key_id, suite, metadata, output);
+    if (!envelope_len.has_value()) {
+      return std::nullopt;
     }
-    plaintext_len += final_len;
+    auto value_len = encrypt_message(state, key_type, key_id, value_suite.value_or(suite), value,
+                                     output.subspan(envelope_len.value()),
+                                     envelope_mac(std::string_view(output.data(), envelope_len.value())));
+    if (!value_len.has_value()) {
+      return std::nullopt;
+    }
+    return envelope_len.value() + value_len.value();
+  }
 
-    // Clean up
-    EVP_CIPHER_CTX_free(ctx);
+  /**
+   * Decrypts the metadata envelope of a ciphertext in the split format into the caller-provided output
+   * buffer, which must hold at least decrypted_size(ciphertext) bytes; it may start at ciphertext_header_len
+   * bytes inside the ciphertext to decrypt in place.
+   *
+   * @param ciphertext The whole ciphertext, envelope included.
+   * @param envelope_size The size of the metadata envelope, i.e., message_size(ciphertext).
+   * @param keyType The encryption key type to use.
+   * @param output The buffer that receives the metadata.
+   * @return The length of the metadata, or std::nullopt on failure.
+   */
+  auto decrypt_split_envelope(std::string_view ciphertext, size_t envelope_size, cipher_key_type key_type,
+                              std::span<char> output) -> std::optional<size_t> {
+    if (!valid_key_type(key_type) || envelope_size > ciphertext.size()) {
+      std::cerr << "Invalid ciphertext envelope!" << std::endl;
+      return std::nullopt;
+    }
+    // the envelope of a value stored in plaintext authenticates the whole value message
+    const std::string_view value_message = ciphertext.substr(envelope_size);
+    const std::string_view aad = ciphertext_suite(value_message) == cipher_suite::none ? value_message
+                                                                                         : std::string_view();
+    return decrypt_message(get_thread_state(), key_type, ciphertext.substr(0, envelope_size), output, aad,
+                           /*allow_plaintext*/ false);
+  }
 
-    std::string result_string = std::string(reinterpret_cast<const char*>(plaintext.data()),
-                                     static_cast<std::string::size_type>(plaintext_len));
-    
-    return decrypt_result {std::move(result_string), /*success*/ true};
+  /**
+   * Decrypts the value part of a ciphertext in the split format into the caller-provided output buffer,
+   * which must hold at least decrypted_size(ciphertext.substr(envelope_size)) bytes.
+   *
+   * A value part stored with the none suite is only accepted for a non-sensitive value, once its
+   * envelope has been decrypted (see decrypt_split_envelope).
+   *
+   * @param ciphertext The whole ciphertext, envelope included.
+   * @param envelope_size The size of the metadata envelope, i.e., message_size(ciphertext).
+   * @param keyType The encryption key type to use.
+   * @param output The buffer that receives the value.
+   * @param non_sensitive Whether the metadata of the envelope mark the value as non-sensitive.
+   * @return The length of the value, or std::nullopt on failure.
+   */
+  auto decrypt_split_value(std::string_view ciphertext, size_t envelope_size, cipher_key_type key_type,
+                           std::span<char> output, bool non_sensitive = false) -> std::optional<size_t> {
+    if (!valid_key_type(key_type) || envelope_size > ciphertext.size()) {
+      std::cerr << "Invalid ciphertext envelope!" << std::endl;
+      return std::nullopt;
+    }
+    return decrypt_message(get_thread_state(), key_type, ciphertext.substr(envelope_size), output,
+                           envelope_mac(ciphertext), /*allow_plaintext*/ non_sensitive);
   }
 
   /**
-   * Initializes the encryption key for the specified key type.
+   * Initializes the active encryption key for the specified key type.
    * If no encryption key is provided, it falls back to the default test key.
    *
    * @param encryption_key The encryption key to set.
@@ -255,48 +539,544 @@ public:
                           cipher_key_type key_type = cipher_key_type::max_key) -> bool 
   {
     if (!encryption_key.empty()) {
-      const unsigned char* key = get_encryption_key(key_type);
-      if (key == nullptr) {
-        std::cerr << "Invalid encryption key type!" << std::endl;
+      if (!valid_key_type(key_type)) {
         return false;
       }
+      return set_key_slot(key_type, active_key_id(key_type), encryption_key);
+    }
+    return true;
+  }
 
-      if (encryption_key.size() != encryption_key_len) {
-        std::cerr << "Failed to set encryption key. Expected length is " << encryption_key_len 
-                  << ", given length is " <<  encryption_key.size()
-                  << ". Falling back to the default key." << std::endl;
+  /**
+   * Adds an encryption key to the key ring of the key type under the key id, without activating it.
+   * The ciphertexts recorded with the key id become readable, e.g., those of the previous rotations.
+   *
+   * @param encryption_key The encryption key, 16 or 32 bytes long.
+   * @param keyType The encryption key type.
+   * @param key_id The id of the key, recorded in the format tag of its ciphertexts.
+   */
+  auto add_encryption_key(std::string_view encryption_key, cipher_key_type key_type, uint8_t key_id) -> bool {
+    if (!valid_key_type(key_type) || key_id >= max_key_ids) {
+      std::cerr << "Invalid encryption key id!" << std::endl;
+      return false;
+    }
+    return set_key_slot(key_type, key_id, encryption_key);
+  }
+
+  /**
+   * Activates the key id of the key ring for the new ciphertexts of the key type. The ciphertexts
+   * of the other keys of the ring remain readable, until they are migrated to the active key.
+   */
+  auto activate_encryption_key(cipher_key_type key_type, uint8_t key_id) -> bool {
+    if (!valid_key_type(key_type) || key_id >= max_key_ids) {
+      std::cerr << "Invalid encryption key id!" << std::endl;
+      return false;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_key_ring_mutex);
+    if (m_key_ring[static_cast<size_t>(key_type)][key_id].m_len == 0) {
+      std::cerr << "No encryption key with id " << static_cast<int>(key_id) << "!" << std::endl;
+      return false;
+    }
+    m_active_key_ids[static_cast<size_t>(key_type)].store(key_id, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Rotates the key of the key type: the new key is added under the first free id after the active
+   * one and activated, while the previous keys remain valid for decryption.
+   *
+   * @return The id of the new key, or std::nullopt if the key ring is full.
+   */
+  auto rotate_encryption_key(std::string_view encryption_key, cipher_key_type key_type) -> std::optional<uint8_t> {
+    if (!valid_key_type(key_type)) {
+      return std::nullopt;
+    }
+    const uint8_t active_id = active_key_id(key_type);
+    for (int offset = 1; offset < max_key_ids; offset++) {
+      const auto key_id = static_cast<uint8_t>((active_id + offset) % max_key_ids);
+      if (has_encryption_key(key_type, key_id)) {
+        continue;
+      }
+      if (!add_encryption_key(encryption_key, key_type, key_id) || !activate_encryption_key(key_type, key_id)) {
+        return std::nullopt;
+      }
+      return key_id;
+    }
+    std::cerr << "The encryption key ring is full, retire a key first!" << std::endl;
+    return std::nullopt;
+  }
+
+  /**
+   * Removes an inactive key from the key ring, once no ciphertext uses it anymore.
+   */
+  auto retire_encryption_key(cipher_key_type key_type, uint8_t key_id) -> bool {
+    if (!valid_key_type(key_type) || key_id >= max_key_ids || key_id == active_key_id(key_type)) {
+      std::cerr << "Invalid or active encryption key id!" << std::endl;
+      return false;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_key_ring_mutex);
+    key_slot& slot = m_key_ring[static_cast<size_t>(key_type)][key_id];
+    OPENSSL_cleanse(slot.m_key.data(), slot.m_key.size());
+    slot.m_len = 0;
+    m_key_generation[static_cast<size_t>(key_type)].fetch_add(1, std::memory_order_release);
+    return true;
+  }
+
+  auto has_encryption_key(cipher_key_type key_type, uint8_t key_id) const -> bool {
+    if (!valid_key_type(key_type) || key_id >= max_key_ids) {
+      return false;
+    }
+    std::shared_lock<std::shared_mutex> lock(m_key_ring_mutex);
+    return m_key_ring[static_cast<size_t>(key_type)][key_id].m_len != 0;
+  }
+
+  auto active_key_id(cipher_key_type key_type) const -> uint8_t {
+    return m_active_key_ids[static_cast<size_t>(key_type)].load(std::memory_order_acquire);
+  }
+
+  /**
+   * Whether all the encrypted messages of the ciphertext (e.g., both messages of the split format)
+   * use the active key of the key type. The messages stored with the none suite are not considered,
+   * and a malformed ciphertext does not use it. Neither does a legacy ciphertext, so that the key
+   * rotator rewrites it in the tagged format.
+   */
+  auto uses_active_key(std::string_view ciphertext, cipher_key_type key_type) const -> bool {
+    if (is_legacy_ciphertext(ciphertext)) {
+      return false;
+    }
+    const uint8_t active_id = active_key_id(key_type);
+    while (!ciphertext.empty()) {
+      auto size = message_size(ciphertext);
+      if (!size.has_value()) {
         return false;
       }
-      std::memcpy(const_cast<unsigned char*>(key), encryption_key.data(), encryption_key_len);
+      if (ciphertext_suite(ciphertext) != cipher_suite::none && ciphertext_key_id(ciphertext) != active_id) {
+        return false;
+      }
+      ciphertext.remove_prefix(size.value());
     }
     return true;
   }
 
+  /**
+   * Sets the cipher suite of the new ciphertexts of the key type. The existing ciphertexts
+   * remain readable, as they are decrypted with the suite of their format tag.
+   *
+   * @param keyType The encryption key type.
+   * @param suite The cipher suite, where none stores the plaintext after the header.
+   */
+  auto set_cipher_suite(cipher_key_type key_type, cipher_suite suite) -> bool {
+    if (!valid_key_type(key_type) || suite >= cipher_suite::max_suite) {
+      std::cerr << "Invalid cipher suite!" << std::endl;
+      return false;
+    }
+    if (suite != cipher_suite::none && get_evp_cipher(suite) == nullptr) {
+      std::cerr << "Cipher suite " << cipher_suite_name(suite) << " is not supported!" << std::endl;
+      return false;
+    }
+    m_cipher_suites[static_cast<size_t>(key_type)].store(suite, std::memory_order_relaxed);
+    return true;
+  }
+
+  auto get_cipher_suite(cipher_key_type key_type) const -> cipher_suite {
+    return m_cipher_suites[static_cast<size_t>(key_type)].load(std::memory_order_relaxed);
+  }
+
   private:
-    cipher_engine() = default;
-    // Default database encryption key
-    unsigned char m_db_key[encryption_key_len] = "012345678901234";
-    // Default gdpr log encryption key
-    unsigned char m_log_key[encryption_key_len] = "123401234567890";
-    // Array of encryption key
-    const unsigned char* m_encryption_keys[2] = { m_db_key, m_log_key }; 
+    cipher_engine() {
+      // Default test keys of the database and the gdpr logs, under the key id 0
+      set_key_slot(cipher_key_type::db_key, 0, std::string_view("012345678901234", encryption_key_len));
+      set_key_slot(cipher_key_type::log_key, 0, std::string_view("123401234567890", encryption_key_len));
+    }
 
     /**
-     * Retrieves the encryption key based on the specified key type.
+     * Per-thread cipher state.
+     *
+     * Every thread keeps one encryption and one decryption context per key type, key id and cipher
+     * suite, initialized once with the cipher and the key (so the key schedule is computed once); for
+     * every message only the IV is set. The contexts are re-initialized when the key ring changes.
+     * They are created on first use, so only the keys in use (usually the active one) have contexts.
      *
-     * @param keyType The encryption key type.
-     * @return The encryption key for the specified key type.
+     * IVs follow the deterministic construction of NIST SP 800-38D (8.2.1): a fixed field
+     * (8 random bytes drawn per thread) followed by a 4-byte invocation counter. A (key, IV) pair
+     * is therefore never reused within a thread, and the 64-bit random fields make a collision
+     * between threads or processes negligible. The fixed field is drawn again when the counter wraps.
+     * The same construction is used for the 96-bit nonces of ChaCha20-Poly1305.
      */
-    const unsigned char* get_encryption_key(cipher_key_type key_type) const {
+    struct thread_cipher_state
+    {
+      template <typename T>
+      using key_suite_array = std::array<std::array<std::array<T, num_cipher_suites>, max_key_ids>, num_key_types>;
+      using context_array = key_suite_array<EVP_CIPHER_CTX*>;
+      using generation_array = key_suite_array<uint64_t>;
+
+      context_array m_encrypt_ctx {};
+      context_array m_decrypt_ctx {};
+      generation_array m_encrypt_generation {};
+      generation_array m_decrypt_generation {};
+      std::array<unsigned char, nonce_prefix_len> m_nonce_prefix {};
+      uint32_t m_nonce_counter {0};
+      bool m_has_nonce_prefix {false};
+
+      thread_cipher_state() = default;
+      thread_cipher_state(const thread_cipher_state&) = delete;
+      thread_cipher_state& operator=(const thread_cipher_state&) = delete;
+
+      ~thread_cipher_state() {
+        for (const auto& contexts : {m_encrypt_ctx, m_decrypt_ctx}) {
+          for (const auto& key_contexts : contexts) {
+            for (const auto& suite_contexts : key_contexts) {
+              for (auto* ctx : suite_contexts) {
+                EVP_CIPHER_CTX_free(ctx);
+              }
+            }
+          }
+        }
+      }
+
+      bool next_nonce(std::array<unsigned char, initialization_vector_len>& nonce) {
+        if (!m_has_nonce_prefix || m_nonce_counter == UINT32_MAX) {
+          if (RAND_bytes(m_nonce_prefix.data(), nonce_prefix_len) != 1) {
+            return false;
+          }
+          m_nonce_counter = 0;
+          m_has_nonce_prefix = true;
+        }
+        m_nonce_counter++;
+        std::memcpy(nonce.data(), m_nonce_prefix.data(), nonce_prefix_len);
+        std::memcpy(nonce.data() + nonce_prefix_len, &m_nonce_counter, nonce_counter_len);
+        return true;
+      }
+    };
+
+    /* The MAC of the first message of the ciphertext, which authenticates the rest of a split ciphertext */
+    static std::string_view envelope_mac(std::string_view ciphertext) {
+      return ciphertext.substr(tag_offset, tag_len);
+    }
+
+    /* Size of the first message of the ciphertext when its header starts after header_offset bytes */
+    static std::optional<size_t> spanned_message_size(std::string_view ciphertext, size_t header_offset) {
+      const size_t header_len = legacy_header_len + header_offset;
+      if (ciphertext.size() < header_len) {
+        return std::nullopt;
+      }
+      int ciphertext_len = 0;
+      std::memcpy(&ciphertext_len, ciphertext.data() + header_offset + (length_offset - format_tag_len), sizeof(int));
+      if (ciphertext_len < 0 || static_cast<size_t>(ciphertext_len) > ciphertext.size() - header_len) {
+        return std::nullopt;
+      }
+      return header_len + static_cast<size_t>(ciphertext_len);
+    }
+
+    /* Whether the ciphertext is made of exactly one or two messages whose headers start after header_offset bytes */
+    static bool spans_messages(std::string_view ciphertext, size_t header_offset) {
+      for (int message = 0; message < 2 && !ciphertext.empty(); message++) {
+        auto size = spanned_message_size(ciphertext, header_offset);
+        if (!size.has_value()) {
+          return false;
+        }
+        ciphertext.remove_prefix(size.value());
+      }
+      return ciphertext.empty();
+    }
+
+    static thread_cipher_state& get_thread_state() {
+      thread_local thread_cipher_state state;
+      return state;
+    }
+
+    static const EVP_CIPHER* get_evp_cipher(cipher_suite suite) {
+      switch (suite) {
+        case cipher_suite::aes_128_gcm:
+          return EVP_aes_128_gcm();
+        case cipher_suite::aes_256_gcm:
+          return EVP_aes_256_gcm();
+        case cipher_suite::chacha20_poly1305:
+          return EVP_chacha20_poly1305();
+        default:
+          return nullptr;
+      }
+    }
+
+    /* An encryption key of the key ring */
+    struct key_slot
+    {
+      std::array<unsigned char, max_encryption_key_len> m_key {};
+      // 0 when there is no key with this id
+      size_t m_len {0};
+    };
+
+    /**
+     * Derives the key of the suite from the key of the key ring: the key is used as is when its
+     * length matches the suite, otherwise the suite uses (a prefix of) its SHA-256 digest.
+     */
+    static bool derive_suite_key(const key_slot& slot, const EVP_CIPHER* cipher,
+                                 std::array<unsigned char, max_encryption_key_len>& suite_key) {
+      if (static_cast<size_t>(EVP_CIPHER_key_length(cipher)) == slot.m_len) {
+        std::memcpy(suite_key.data(), slot.m_key.data(), slot.m_len);
+        return true;
+      }
+      unsigned int digest_len = 0;
+      return EVP_Digest(slot.m_key.data(), slot.m_len, suite_key.data(), &digest_len, EVP_sha256(), nullptr) == 1;
+    }
+
+    /**
+     * Returns the thread's context for the key type, key id and suite, with the cipher and the key set up.
+     */
+    EVP_CIPHER_CTX* get_context(thread_cipher_state& state, cipher_key_type key_type, uint8_t key_id,
+                                cipher_suite suite, bool encrypt) {
+      const auto key_index = static_cast<size_t>(key_type);
+      const auto suite_index = static_cast<size_t>(suite);
+      auto& ctx = encrypt ? state.m_encrypt_ctx[key_index][key_id][suite_index]
+                          : state.m_decrypt_ctx[key_index][key_id][suite_index];
+      auto& generation = encrypt ? state.m_encrypt_generation[key_index][key_id][suite_index]
+                                 : state.m_decrypt_generation[key_index][key_id][suite_index];
+      const uint64_t key_generation = m_key_generation[key_index].load(std::memory_order_acquire);
+
+      if (ctx != nullptr && generation == key_generation) {
+        return ctx;
+      }
+      const EVP_CIPHER* cipher = get_evp_cipher(suite);
+      if (cipher == nullptr) {
+        std::cerr << "Invalid cipher suite!" << std::endl;
+        return nullptr;
+      }
+      key_slot slot;
+      {
+        std::shared_lock<std::shared_mutex> lock(m_key_ring_mutex);
+        slot = m_key_ring[key_index][key_id];
+      }
+      if (slot.m_len == 0) {
+        std::cerr << "No encryption key with id " << static_cast<int>(key_id) << "!" << std::endl;
+        return nullptr;
+      }
+      if (ctx == nullptr) {
+        ctx = EVP_CIPHER_CTX_new();
+        if (ctx == nullptr) {
+          std::cerr << "Failed to create cipher context!" << std::endl;
+          return nullptr;
+        }
+      }
+      std::array<unsigned char, max_encryption_key_len> key {};
+      const bool key_derived = derive_suite_key(slot, cipher, key);
+      const int init_result = !key_derived ? 0 : encrypt ? EVP_EncryptInit_ex(ctx, cipher, nullptr, key.data(), nullptr)
+                                                         : EVP_DecryptInit_ex(ctx, cipher, nullptr, key.data(), nullptr);
+      OPENSSL_cleanse(key.data(), key.size());
+      OPENSSL_cleanse(slot.m_key.data(), slot.m_key.size());
+      if (init_result != 1) {
+        std::cerr << "Failed to initialize cipher context!" << std::endl;
+        EVP_CIPHER_CTX_free(ctx);
+        ctx = nullptr;
+        return nullptr;
+      }
+      generation = key_generation;
+      return ctx;
+    }
+
+    /**
+     * Encrypts one message with the suite under the key id, using the next IV of the thread.
+     */
+    std::optional<size_t> encrypt_message(thread_cipher_state& state, cipher_key_type key_type, uint8_t key_id,
+                                          cipher_suite suite, std::string_view input, std::span<char> output,
+                                          std::string_view aad = {}) {
+      if (output.size() < encrypted_size(input.size())) {
+        std::cerr << "Encryption output buffer is too small!" << std::endl;
+        return std::nullopt;
+      }
+
+      const int input_len = static_cast<int>(input.size());
+      if (suite == cipher_suite::none) {
+        /* The input is stored as is, with an empty IV and MAC */
+        std::memset(output.data(), 0, ciphertext_header_len);
+        output[0] = format_tag(suite, key_id);
+        std::memcpy(output.data() + length_offset, &input_len, sizeof(int));
+        if (input.data() != output.data() + ciphertext_header_len) {
+          std::memmove(output.data() + ciphertext_header_len, input.data(), input.size());
+        }
+        return encrypted_size(input.size());
+      }
+
+      /* Get the thread's context with the expanded key */
+      EVP_CIPHER_CTX* ctx = get_context(state, key_type, key_id, suite, /*encrypt*/ true);
+      if (ctx == nullptr) {
+        return std::nullopt;
+      }
+
+      /* Generate a unique IV and set it for this message */
+      std::array<unsigned char, initialization_vector_len> initialization_vector{};
+      if (!state.next_nonce(initialization_vector)) {
+        std::cerr << "Failed to generate initialization vector!" << std::endl;
+        return std::nullopt;
+      }
+      if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, initialization_vector.data()) != 1) {
+        std::cerr << "Failed to initialize encryption!" << std::endl;
+        return std::nullopt;
+      }
+
+      /* The AEAD modes are stream modes: the ciphertext has the same length as the plaintext */
+      auto* ciphertext = reinterpret_cast<unsigned char*>(output.data()) + ciphertext_header_len;
+      int ciphertext_len = 0;
+      /* Provide the additional authenticated data, if any */
+      if (!aad.empty() && EVP_EncryptUpdate(ctx, nullptr, &ciphertext_len, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) != 1) {
+        std::cerr << "Failed to authenticate additional data!" << std::endl;
+        return std::nullopt;
+      }
+      /* Provide the plaintext to be encrypted, and obtain the encrypted output. */
+      if (EVP_EncryptUpdate(ctx, ciphertext, &ciphertext_len, reinterpret_cast<const unsigned char*>(input.data()), input_len) != 1) {
+        std::cerr << "Failed to perform encryption!" << std::endl;
+        return std::nullopt;
+      }
+
+      /* Finalise the encryption. */
+      int final_len = 0;
+      if (EVP_EncryptFinal_ex(ctx, ciphertext + ciphertext_len, &final_len) != 1) {
+        std::cerr << "Failed to finalize encryption!" << std::endl;
+        return std::nullopt;
+      }
+
+      ciphertext_len += final_len;
+
+      /* Retrieve the MAC (Message Authentication Code) of the ciphertext, right after the IV */
+      auto* mac = reinterpret_cast<unsigned char*>(output.data()) + tag_offset;
+      if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, tag_len, mac) != 1) {
+        std::cerr << "Failed to extract MAC!" << std::endl;
+        return std::nullopt;
+      }
+
+      output[0] = format_tag(suite, key_id);
+      std::memcpy(output.data() + initialization_vector_offset, initialization_vector.data(), initialization_vector_len);
+      // Encode the ciphertext length as a 4-byte integer
+      std::memcpy(output.data() + length_offset, &ciphertext_len, sizeof(int));
+
+      return ciphertext_header_len + static_cast<size_t>(ciphertext_len);
+    }
+
+    /**
+     * Decrypts one message with the suite and the key recorded in its format tag.
+     * As the format tag is not authenticated, a message of the none suite is refused unless the caller
+     * allows it, or none is the suite set for the key type.
+     */
+    std::optional<size_t> decrypt_message(thread_cipher_state& state, cipher_key_type key_type,
+                                          std::string_view ciphertext, std::span<char> output,
+                                          std::string_view aad, bool allow_plaintext) {
+      if (ciphertext.size() < ciphertext_header_len) {
+        std::cerr << "Ciphertext is shorter than its header!" << std::endl;
+        return std::nullopt;
+      }
+
+      // Extract the components from the result string
+      const cipher_suite suite = ciphertext_suite(ciphertext);
+      const uint8_t key_id = ciphertext_key_id(ciphertext);
+      if (suite >= cipher_suite::max_suite) {
+        std::cerr << "Invalid cipher suite!" << std::endl;
+        return std::nullopt;
+      }
+      const auto* iv = reinterpret_cast<const unsigned char*>(ciphertext.data()) + initialization_vector_offset;
+      const auto* mac = reinterpret_cast<const unsigned char*>(ciphertext.data()) + tag_offset;
+      const auto* encrypted_value = reinterpret_cast<const unsigned char*>(ciphertext.data()) + ciphertext_header_len;
+
+      // Retrieve the ciphertext length from the 4-byte integer
+      int ciphertext_len = 0;
+      std::memcpy(&ciphertext_len, ciphertext.data() + length_offset, sizeof(int));
+      if (ciphertext_len < 0 || static_cast<size_t>(ciphertext_len) > ciphertext.size() - ciphertext_header_len) {
+        std::cerr << "Invalid ciphertext length!" << std::endl;
+        return std::nullopt;
+      }
+      if (output.size() < static_cast<size_t>(ciphertext_len)) {
+        std::cerr << "Decryption output buffer is too small!" << std::endl;
+        return std::nullopt;
+      }
+
+      if (suite == cipher_suite::none) {
+        if (!allow_plaintext && get_cipher_suite(key_type) != cipher_suite::none) {
+          std::cerr << "Refusing an unencrypted ciphertext!" << std::endl;
+          return std::nullopt;
+        }
+        // The value is stored in plaintext
+        if (output.data() != ciphertext.data() + ciphertext_header_len) {
+          std::memmove(output.data(), encrypted_value, static_cast<size_t>(ciphertext_len));
+        }
+        return static_cast<size_t>(ciphertext_len);
+      }
+
+      // Get the thread's context of the suite with the expanded key and set the IV of this message
+      EVP_CIPHER_CTX* ctx = get_context(state, key_type, key_id, suite, /*encrypt*/ false);
+      if (ctx == nullptr || EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) != 1) {
+        std::cerr << "Failed to initialize decryption!" << std::endl;
+        return std::nullopt;
+      }
+
+      // Provide the additional authenticated data, if any
+      auto* plaintext = reinterpret_cast<unsigned char*>(output.data());
+      int plaintext_len = 0;
+      if (!aad.empty() && EVP_DecryptUpdate(ctx, nullptr, &plaintext_len, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) != 1) {
+        std::cerr << "Failed to authenticate additional data!" << std::endl;
+        return std::nullopt;
+      }
+
+      // Provide the ciphertext to be decrypted, and obtain the decrypted output
+      if (EVP_DecryptUpdate(ctx, plaintext, &plaintext_len, encrypted_value, ciphertext_len) != 1) {
+        std::cerr << "Failed to perform decryption!" << std::endl;
+        return std::nullopt;
+      }
+
+      // Set the expected MAC value
+      if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, tag_len, const_cast<unsigned char*>(mac)) != 1) {
+        std::cerr << "Failed to set MAC value!" << std::endl;
+        return std::nullopt;
+      }
+
+      // Finalize the decryption
+      int final_len = 0;
+      if (EVP_DecryptFinal_ex(ctx, plaintext + plaintext_len, &final_len) != 1) {
+        std::cerr << "Failed to finalize decryption!" << std::endl;
+        return std::nullopt;
+      }
+      plaintext_len += final_len;
+
+      return static_cast<size_t>(plaintext_len);
+    }
+
+    // Incremented on every change of the key ring, so that the threads refresh their contexts
+    std::array<std::atomic<uint64_t>, num_key_types> m_key_generation {};
+    // Cipher suite of the new ciphertexts of every key type
+    std::array<std::atomic<cipher_suite>, num_key_types> m_cipher_suites {cipher_suite::aes_128_gcm,
+                                                                          cipher_suite::aes_128_gcm};
+    // Key id of the new ciphertexts of every key type
+    std::array<std::atomic<uint8_t>, num_key_types> m_active_key_ids {};
+    // Keys of every key type by key id; read only when a thread (re-)initializes a context
+    std::array<std::array<key_slot, max_key_ids>, num_key_types> m_key_ring {};
+    mutable std::shared_mutex m_key_ring_mutex;
+
+    static bool valid_key_type(cipher_key_type key_type) {
       if (key_type >= cipher_key_type::max_key) {
         std::cerr << "Invalid encryption key type!" << std::endl;
-        return nullptr;
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * Sets the key of the key ring under the key id; the threads expand the new key into their
+     * contexts on their next operation.
+     */
+    bool set_key_slot(cipher_key_type key_type, uint8_t key_id, std::string_view encryption_key) {
+      if (encryption_key.size() != encryption_key_len && encryption_key.size() != max_encryption_key_len) {
+        std::cerr << "Failed to set encryption key. Expected length is " << encryption_key_len
+                  << " or " << max_encryption_key_len << ", given length is " <<  encryption_key.size()
+                  << ". Falling back to the default key." << std::endl;
+        return false;
       }
-      return m_encryption_keys[static_cast<int>(key_type)];
+      std::unique_lock<std::shared_mutex> lock(m_key_ring_mutex);
+      key_slot& slot = m_key_ring[static_cast<size_t>(key_type)][key_id];
+      std::memcpy(slot.m_key.data(), encryption_key.data(), encryption_key.size());
+      slot.m_len = encryption_key.size();
+      m_key_generation[static_cast<size_t>(key_type)].fetch_add(1, std::memory_order_release);
+      return true;
     }
 
 // NOLINTEND
 };
 
 
-} // namespace controller
\ No newline at end of file
+} // namespace controller
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../kv_client/kv_client.hpp"
+#include "../logging/logger.hpp"
+#include "cipher_engine.hpp"
+
+namespace controller {
+
+/**
+ * Background thread that migrates the stored values and the log files to the active keys
+ * of the key ring after a key rotation, while the controller keeps serving the requests.
+ *
+ * Every interval it re-encrypts the values of at most batch_size keys, walking the key space
+ * with the backend scan, and once the scan is complete, at most batch_size log files.
+ * The values and log files that fail to be re-encrypted are then retried, at most batch_size per interval,
+ * and the pass is only complete once none of them is left; a new pass starts when an active key changes again.
+ * The keys of the previous rotations can be retired once a pass is complete.
+ */
+class key_rotator
+{
+public:
+  key_rotator(std::unique_ptr<kv_client> client, std::size_t batch_size,
+              std::chrono::milliseconds interval)
+      : m_client{std::move(client)},
+        m_batch_size{batch_size},
+        m_interval{interval}
+  {
+  }
+
+  ~key_rotator() { stop(); }
+
+  key_rotator(const key_rotator&) = delete;
+  auto operator=(const key_rotator&) -> key_rotator& = delete;
+  key_rotator(key_rotator&&) = delete;
+  auto operator=(key_rotator&&) -> key_rotator& = delete;
+
+  auto start() -> void {
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  auto stop() -> void {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  /* Whether all the data use the active keys, as of the last complete pass */
+  [[nodiscard]] auto pass_complete() const -> bool {
+    return m_pass_complete.load(std::memory_order_acquire);
+  }
+
+  /* Number of values and log files of the current pass that failed to be re-encrypted and wait for a retry */
+  [[nodiscard]] auto num_failures() const -> std::size_t {
+    return m_num_failures.load(std::memory_order_acquire);
+  }
+
+private:
+  using key_ids = std::pair<uint8_t, uint8_t>;
+
+  std::unique_ptr<kv_client> m_client;
+  std::size_t m_batch_size;
+  std::chrono::milliseconds m_interval;
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop{false};
+
+  // state of the current pass, only accessed by the rotator thread
+  std::optional<key_ids> m_pass_key_ids;
+  std::string m_cursor;
+  bool m_scan_complete{false};
+  std::vector<std::string> m_log_files;
+  std::size_t m_next_log_file{0};
+  std::size_t m_num_values{0};
+  std::size_t m_num_log_entries{0};
+  // retried in order, once the scan and the log files are done
+  std::deque<std::string> m_failed_keys;
+  std::deque<std::string> m_failed_log_files;
+  bool m_retrying{false};
+  std::atomic<std::size_t> m_num_failures{0};
+  std::atomic<bool> m_pass_complete{false};
+
+  auto run() -> void {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cv.wait_for(lock, m_interval, [this]() { return m_stop; })) {
+      lock.unlock();
+      migrate_batch();
+      lock.lock();
+    }
+  }
+
+  auto start_pass(key_ids active_key_ids) -> void {
+    m_pass_key_ids = active_key_ids;
+    m_cursor.clear();
+    m_scan_complete = false;
+    m_log_files.clear();
+    m_next_log_file = 0;
+    m_num_values = 0;
+    m_num_log_entries = 0;
+    m_failed_keys.clear();
+    m_failed_log_files.clear();
+    m_retrying = false;
+    update_num_failures();
+    m_pass_complete.store(false, std::memory_order_release);
+  }
+
+  auto migrate_batch() -> void {
+    auto *cipher = cipher_engine::get_instance();
+    const key_ids active_key_ids{cipher->active_key_id(cipher_key_type::db_key),
+                                 cipher->active_key_id(cipher_key_type::log_key)};
+    if (m_pass_key_ids != active_key_ids) {
+      start_pass(active_key_ids);
+    }
+    if (m_pass_complete.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    if (!m_scan_complete) {
+      migrate_values();
+      return;
+    }
+    if (m_next_log_file < m_log_files.size()) {
+      migrate_log_files();
+      return;
+    }
+    retry_failures();
+  }
+
+  auto migrate_values() -> void {
+    auto page = m_client->gdpr_scan(m_cursor, m_batch_size);
+    if (!page) {
+      // retried on the next interval
+      return;
+    }
+    for (auto& key : page->m_keys) {
+      migrate_value(std::move(key));
+    }
+    m_cursor = std::move(page->m_cursor);
+    if (m_cursor.empty()) {
+      m_scan_complete = true;
+      const std::filesystem::path logs_dir(logger::get_instance()->get_logs_dir());
+      const std::string_view extension = logger::get_instance()->get_logs_extension();
+      std::error_code error;
+      for (const auto& entry : std::filesystem::directory_iterator(logs_dir, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == extension) {
+          m_log_files.push_back(entry.path().string());
+        }
+      }
+    }
+  }
+
+  auto migrate_log_files() -> void {
+    const std::size_t end = std::min(m_log_files.size(), m_next_log_file + m_batch_size);
+    for (; m_next_log_file < end; m_next_log_file++) {
+      migrate_log_file(std::move(m_log_files[m_next_log_file]));
+    }
+  }
+
+  auto retry_failures() -> void {
+    if (!m_retrying && (!m_failed_keys.empty() || !m_failed_log_files.empty())) {
+      m_retrying = true;
+      std::cerr << "Key rotation: " << m_failed_keys.size() << " values and " << m_failed_log_files.size()
+                << " log files failed to be re-encrypted, they are retried before the pass completes" << std::endl;
+    }
+    for (std::size_t retried = 0; retried < m_batch_size && !m_failed_keys.empty(); retried++) {
+      std::string key = std::move(m_failed_keys.front());
+      m_failed_keys.pop_front();
+      migrate_value(std::move(key));
+    }
+    for (std::size_t retried = 0; retried < m_batch_size && !m_failed_log_files.empty(); retried++) {
+      std::string log_file = std::move(m_failed_log_files.front());
+      m_failed_log_files.pop_front();
+      migrate_log_file(std::move(log_file));
+    }
+    if (m_failed_keys.empty() && m_failed_log_files.empty()) {
+      m_pass_complete.store(true, std::memory_order_release);
+      std::cerr << "Key rotation: re-encrypted " << m_num_values << " values and " << m_num_log_entries
+                << " log entries with the active keys" << std::endl;
+    }
+  }
+
+  auto migrate_value(std::string key) -> void {
+    const rekey_result result = m_client->gdpr_rekey(key);
+    if (result == rekey_result::rewritten) {
+      m_num_values++;
+    } else if (result == rekey_result::failed) {
+      m_failed_keys.push_back(std::move(key));
+    }
+    update_num_failures();
+  }
+
+  auto migrate_log_file(std::string log_file) -> void {
+    auto num_entries = logger::get_instance()->reencrypt_log(log_file);
+    if (num_entries.has_value()) {
+      m_num_log_entries += num_entries.value();
+    } else {
+      m_failed_log_files.push_back(std::move(log_file));
+    }
+    update_num_failures();
+  }
+
+  auto update_num_failures() -> void {
+    m_num_failures.store(m_failed_keys.size() + m_failed_log_files.size(), std::memory_order_release);
+  }
+};
+
+} // namespace controller
@@ -1,59 +1,17 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include "gdpr_filter.hpp"
 
 namespace controller {
 
-/* deserialize the metadata from the retrieved value and place them in the fields of the filter class */
+/* check the structure of the metadata of the retrieved value, the fields are decoded by the checks */
 gdpr_filter::gdpr_filter(std::optional<std::string_view> ret_value)
-    : m_valid{false},
-      m_encryption{false},
-      m_expiration{0},
-      m_monitor{false}
 {
   if (ret_value) {
     m_valid = true;
-    std::string_view value = *ret_value;
-    size_t start = 0;
-    size_t end = 0;
-    int count = 0;
-
-    // retrieve the metadata fields without the actual value
-    while (count < metadata_prefix_fields && (end = value.find('|', start)) != std::string_view::npos) {
-      std::string_view token = value.substr(start, end - start);
-
-      switch (count) {
-        case usr: 
-          m_user_key = token;
-          break;
-        case encr:
-          m_encryption = (token == "1");
-          break;
-        case pur:
-          m_purpose = std::bitset<num_purposes>(std::stoull(std::string(token)));
-          break;
-        case obj:
-          m_objection = std::bitset<num_purposes>(std::stoull(std::string(token)));
-          break;
-        case org:
-          m_origin = token;
-          break;
-        case exp:
-          m_expiration = std::stoll(std::string(token));
-          break;
-        case shr:
-          m_share = token;
-          break;
-        case log:
-          m_monitor = (token == "1");
-          break;
-        default:
-          break;
-      }
-      start = end + 1;
-      count++;
-    }
-
-    if (count != metadata_prefix_fields) {
+    m_metadata = metadata_view(*ret_value);
+    if (!m_metadata.is_valid()) {
       throw std::invalid_argument("Invalid GDPR metadata format");
     }
   }
@@ -63,125 +21,115 @@ gdpr_filter::gdpr_filter(std::optional<std::string_view> ret_value)
 // {
 // }
 
-/* Perform the validation checks for the gdpr metadata */
-auto gdpr_filter::validate(const controller::query &query_args, 
-                            const controller::default_policy &def_policy) const -> bool
+/* Compile the checks of the session policy: resolve its session key and its default purposes */
+policy_validator::policy_validator(const default_policy &def_policy)
+    : m_purpose{def_policy.purpose()}
 {
-  if (!this->is_valid()) {
-    // no value found for the query key
-    #ifndef NDEBUG
-    std::cout << "no value returned by the query" << std::endl;
-    #endif
-    return false;
+  auto user_id = user_dictionary::get_instance()->find_id(def_policy.user_key());
+  if (user_id.has_value()) {
+    m_user_id = user_id.value();
+  } else {
+    // the session user is assigned an id by its first put, resolve it again until then
+    m_unresolved_user_key = def_policy.user_key();
   }
-  if (!validate_session_key(query_args.user_key(), def_policy.user_key())) {
-    // if no user is specified in the query, 
-    // choose the current user to check if he/she
-    // is the owner or the KV pair is shared w/ him/her
-    #ifndef NDEBUG
-    std::cout << "client key not in the owner/share groups of the KV pair" << std::endl;
-    #endif
-    return false;
+  if (m_purpose.any()) {
+    m_checks |= check_purpose;
   }
-  if (!validate_pur(query_args.cond_purpose(), def_policy.purpose())) {
-    // query purposes are not in the KV purposes list 
-    #ifndef NDEBUG
-    std::cout << "query purposes not in the allowed purposes of use of the KV pair" << std::endl;
-    #endif
-    return false;
+}
+
+/* Fold the overrides and the conditional predicates of the query into the checks of the session */
+auto policy_validator::specialize(const query &query_args) const -> policy_validator
+{
+  policy_validator validator(*this);
+  auto *dictionary = user_dictionary::get_instance();
+  // the session key of the query overrides the one of the session
+  if (query_args.user_key().has_value()) {
+    validator.m_user_id = dictionary->find_id(query_args.user_key().value()).value_or(no_user);
+  } else if (!m_unresolved_user_key.empty()) {
+    validator.m_user_id = dictionary->find_id(m_unresolved_user_key).value_or(no_user);
   }
-  if (!validate_obj(query_args.cond_purpose(), def_policy.purpose())) {
-    // query purposes are in the KV objection list 
-    #ifndef NDEBUG
-    std::cout << "query purposes in the objections of the KV pair" << std::endl;
-    #endif
-    return false;
+  // the query purposes override the defaults of the session
+  if (query_args.cond_purpose().any()) {
+    validator.m_purpose = query_args.cond_purpose();
+    validator.m_checks |= check_purpose;
   }
-  // if (!validate_org(query_args.cond_origin(), def_policy.origin())) {
-  //   // query purposes are in the KV objection list 
-  //   #ifndef NDEBUG
-  //   std::cout << "query origin requirement different than the KV pair" << std::endl;
-  //   #endif
-  //   return false;
-  // }
-  if (!validate_exp_time()) {
-    // value expired
-    // TODO: delete the value from the DB
-    #ifndef NDEBUG
-    std::cout << "expired KV pair" << std::endl;
-    #endif
-    return false;
-  }
-  // if (check_monitoring()) {
-  //   // TODO: perform logging of the operation
-  //   #ifndef NDEBUG
-  //   std::cout << "Monitor required" << std::endl;
-  //   #endif
-  // }
-  return true;
-}
-
-/* Validate that the user session key belongs to the owner or the share_with set */
-auto gdpr_filter::validate_session_key(std::optional<std::string_view> query_user_key,
-                                        std::string_view def_user_key) const -> bool
-{
-  std::string_view user_key = query_user_key.value_or(def_user_key);
-  // Check if the user that requests the data is the owner (likely)
-  if (user_key == this->user_key()) {
-    return true;
+  // the values must not be expired, and objExpIs requires them to remain valid until the given time
+  const int64_t current_time = std::chrono::duration_cast<std::chrono::seconds>(
+                                 std::chrono::system_clock::now().time_since_epoch()
+                               ).count();
+  validator.m_min_expiration = std::max(current_time, query_args.cond_expiration());
+  if (!query_args.cond_origin().empty()) {
+    validator.m_origin = query_args.cond_origin();
+    validator.m_checks |= check_origin;
   }
-  
-  // If the user is not the owner, check if the data is shared with the client-user
-  // Check if share user string contains user_key as a sub-token separated by commas
-  std::string_view share = this->share();
+  // objShareIs lists the user keys that the value must be shared with
+  const std::string_view share = query_args.cond_share();
   size_t start = 0;
-  size_t end = 0;
-  while ((end = share.find(',', start)) != std::string_view::npos) {
-    if (user_key == share.substr(start, end - start)) {
-      return true;
+  while (start < share.size()) {
+    size_t end = share.find(',', start);
+    if (end == std::string_view::npos) {
+      end = share.size();
+    }
+    if (end > start) {
+      const uint32_t user_id = dictionary->find_id(share.substr(start, end - start)).value_or(no_user);
+      if (user_id < num_users) {
+        validator.m_share |= uint64_t{1} << user_id;
+      } else {
+        validator.m_share_overflow.push_back(user_id);
+      }
+      validator.m_checks |= check_share;
     }
     start = end + 1;
   }
-
-  // Check if the user key matches the last user in the shared users string
-  // if not, the function will return false
-  return (user_key == share.substr(start));
+  return validator;
 }
 
-/* Validate that the purpose of the query is indeed in the allowed purposes */
-auto gdpr_filter::validate_pur(const std::bitset<num_purposes> &query_pur,
-                                const std::bitset<num_purposes> &def_pur) const -> bool
+auto policy_validator::validate(const metadata_view &metadata) const -> bool
 {
-  if (query_pur.any()) {
-    // the query purposes override the defaults
-    return (this->purpose() & query_pur) == query_pur;
+  // the user is the owner (likely) or the value is shared with the user; unknown users match neither
+  const int64_t expiration = metadata.expiration();
+  bool valid = m_user_id != no_user && (m_user_id == metadata.owner() || metadata.is_shared_with(m_user_id)) &&
+               (expiration == 0 || expiration >= m_min_expiration);
+  // the values allow the purposes of the query and do not object to any of them
+  if ((m_checks & check_purpose) != 0) {
+    valid = valid && metadata.purpose().contains_all(m_purpose) && !metadata.objection().intersects(m_purpose);
   }
-
-  // if no query purposes are given, use the defaults of the client session
-  return (this->purpose() & def_pur) == def_pur;
+  if ((m_checks & check_origin) != 0) {
+    valid = valid && metadata.origin() == m_origin;
+  }
+  if ((m_checks & check_share) != 0) {
+    valid = valid && (metadata.share_bitmap() & m_share) == m_share &&
+            std::all_of(m_share_overflow.begin(), m_share_overflow.end(),
+                        [&](uint32_t user_id) { return metadata.is_shared_with(user_id); });
+  }
+  return valid;
 }
 
-/* Validate that the purpose of the query is not in the obejction list */
-auto gdpr_filter::validate_obj(const std::bitset<num_purposes> &query_pur,
-                                const std::bitset<num_purposes> &def_pur) const -> bool
+/* Perform the validation checks for the gdpr metadata */
+auto gdpr_filter::validate(const policy_validator &validator) const -> bool
 {
-  if (query_pur.any()) {
-    // the query purposes override the defaults
-    return ((this->objection() & query_pur) == 0);
+  if (!this->is_valid()) {
+    // no value found for the query key
+    #ifndef NDEBUG
+    std::cout << "no value returned by the query" << std::endl;
+    #endif
+    return false;
+  }
+  const bool valid = validator.validate(this->m_metadata);
+  #ifndef NDEBUG
+  if (!valid) {
+    std::cout << "the gdpr metadata of the KV pair do not satisfy the query" << std::endl;
   }
-  
-  // if no query purposes are given, use the defaults of the client session
-  return ((this->objection() & def_pur) == 0);
+  #endif
+  return valid;
 }
 
-// /* Validate that the requested query origin is the same with the KV pair */
-// auto gdpr_filter::validate_org(const std::string &query_org,
-//                                 const std::string &def_org) const -> bool
-// {
-//   std::string origin = query_org.empty() ? def_org : query_org;
-//   // Check if the origins match
-//   return (origin == this->origin());
-// }
+/* Perform the validation checks for the gdpr metadata, compiling the checks of the policy for this query */
+auto gdpr_filter::validate(const controller::query &query_args, 
+                            const controller::default_policy &def_policy) const -> bool
+{
+  return validate(policy_validator(def_policy).specialize(query_args));
+}
 
 /* Validate that the KV pair is not expired */
 auto gdpr_filter::validate_exp_time() const -> bool
@@ -207,44 +155,44 @@ auto gdpr_filter::is_valid() const -> bool
   return this->m_valid;
 }
 
-auto gdpr_filter::user_key() const -> std::string_view
+auto gdpr_filter::owner() const -> uint32_t
 {
-  return this->m_user_key;
+  return this->m_metadata.owner();
 }
 
 auto gdpr_filter::encryption() const -> bool
 {
-  return this->m_encryption;
+  return this->m_metadata.encryption();
 }
 
-auto gdpr_filter::purpose() const -> std::bitset<num_purposes>
+auto gdpr_filter::purpose() const -> purpose_bitmap
 {
-  return this->m_purpose;
+  return this->m_metadata.purpose();
 }
 
-auto gdpr_filter::objection() const -> std::bitset<num_purposes>
+auto gdpr_filter::objection() const -> purpose_bitmap
 {
-  return this->m_objection;
+  return this->m_metadata.objection();
 }
 
 auto gdpr_filter::origin() const -> std::string_view
 {
-  return this->m_origin;
+  return this->m_metadata.origin();
 }
 
 auto gdpr_filter::expiration() const -> int64_t
 {
-  return this->m_expiration;
+  return this->m_metadata.expiration();
 }
 
-auto gdpr_filter::share() const -> std::string_view
+auto gdpr_filter::is_shared_with(uint32_t user_id) const -> bool
 {
-  return this->m_share;
+  return this->m_metadata.is_shared_with(user_id);
 }
 
 auto gdpr_filter::monitor() const -> bool
 {
-  return this->m_monitor;
+  return this->m_metadata.monitor();
 }
 
 } // namespace controller
\ No newline at end of file
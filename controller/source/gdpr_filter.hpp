@@ -3,42 +3,81 @@
 #include <string>
 #include <optional>
 #include <sstream>
+#include <vector>
 
-#include "gdpr_metadata.hpp"
+#include "metadata_resolver.hpp"
 #include "query.hpp"
 #include "default_policy.hpp"
 
 namespace controller {
 
-/* class that performs the check of the gdpr metadata */
+/*
+ * The access checks of a client session, compiled once from its default policy into their operands:
+ * the user id of the session key and the required purposes. specialize() folds in the conditions of a
+ * query, so that validate() evaluates only the checks that can fail, as comparisons and bit operations
+ * on the metadata of the value.
+ * Note: it views the strings of the default policy and of the query, which outlive it.
+ */
+class policy_validator
+{
+public:
+  policy_validator() = default;
+  explicit policy_validator(const default_policy &def_policy);
+
+  /* The checks of the session with the overrides and the conditional predicates of the query */
+  [[nodiscard]] auto specialize(const query &query_args) const -> policy_validator;
+  /* Whether the metadata of the value satisfy the checks */
+  [[nodiscard]] auto validate(const metadata_view &metadata) const -> bool;
+
+private:
+  // the checks beyond the session key and the expiration, set only if they can fail
+  static constexpr uint8_t check_purpose = 0x01U;
+  static constexpr uint8_t check_origin = 0x02U;
+  static constexpr uint8_t check_share = 0x04U;
+  // the id of the unknown users, which match no value (not even the legacy values of unknown owners)
+  static constexpr uint32_t no_user = unknown_user;
+
+  uint8_t m_checks{0};
+  // the session key, while it has no id in the user dictionary
+  std::string_view m_unresolved_user_key;
+  uint32_t m_user_id{no_user};
+  // the purposes of use, which the value must allow and not object to
+  purpose_bitmap m_purpose;
+  // the values must be valid at least until then (the current time of the query, or a later objExpIs)
+  int64_t m_min_expiration{0};
+  // objOrigIs: the origin of the value
+  std::string_view m_origin;
+  // objShareIs: the users the value must be shared with, as the share bitmap and the ids beyond it
+  uint64_t m_share{0};
+  std::vector<uint32_t> m_share_overflow;
+};
+
+/*
+ * class that performs the check of the gdpr metadata
+ * It is a non-owning view of the retrieved value, meant to live on the stack of the request handler:
+ * every check decodes only the metadata fields it needs, and validate() stops at the first failing check.
+ */
 class gdpr_filter
 {
 public:
-	gdpr_filter();
+	gdpr_filter() = default;
   explicit gdpr_filter(std::optional<std::string_view> ret_value);
   // ~gdpr_filter();
 
   [[nodiscard]] auto is_valid() const -> bool;
 
-  [[nodiscard]] auto user_key() const -> std::string_view;
+  [[nodiscard]] auto owner() const -> uint32_t;
   [[nodiscard]] auto encryption() const -> bool;
-  [[nodiscard]] auto purpose() const -> std::bitset<num_purposes>;
-  [[nodiscard]] auto objection() const -> std::bitset<num_purposes>;
+  [[nodiscard]] auto purpose() const -> purpose_bitmap;
+  [[nodiscard]] auto objection() const -> purpose_bitmap;
   [[nodiscard]] auto origin() const -> std::string_view;
   [[nodiscard]] auto expiration() const -> int64_t;
-  [[nodiscard]] auto share() const -> std::string_view;
+  [[nodiscard]] auto is_shared_with(uint32_t user_id) const -> bool;
   [[nodiscard]] auto monitor() const -> bool;
 
+  [[nodiscard]] auto validate(const policy_validator &validator) const -> bool;
   [[nodiscard]] auto validate(const controller::query &query_args, 
                               const controller::default_policy &def_policy) const -> bool;
-  [[nodiscard]] auto validate_session_key(const std::optional<std::string_view> query_user_key,
-                                          std::string_view def_user_key) const -> bool;
-  [[nodiscard]] auto validate_pur(const std::bitset<num_purposes> &query_pur,
-                                  const std::bitset<num_purposes> &def_pur) const -> bool;
-  [[nodiscard]] auto validate_obj(const std::bitset<num_purposes> &query_pur,
-                                  const std::bitset<num_purposes> &def_pur) const -> bool;
-  // [[nodiscard]] auto validate_org(const std::string &query_org,
-  //                                 const std::string &def_org) const -> bool;
   [[nodiscard]] auto validate_exp_time() const -> bool;
   [[nodiscard]] auto check_monitoring() const -> bool;
 
@@ -46,17 +85,9 @@ private:
   // valid field that indicates if there is a value to be returned
   bool m_valid{false};
   
-  // metadata fields
-  // Note on data types: it is okay to have std::string_view for the fields
-  // as the result value that they are based on outlives the gdpr_filter object
-  std::string_view m_user_key{};
-  bool m_encryption{false};
-  std::bitset<num_purposes> m_purpose;
-  std::bitset<num_purposes> m_objection;
-  std::string_view m_origin{};
-  int64_t m_expiration;
-  std::string_view m_share{};
-  bool m_monitor{false};
+  // metadata fields, decoded on access
+  // Note: it is okay to only view the result value, as it outlives the gdpr_filter object
+  metadata_view m_metadata;
 };
 
 } // namespace controller
\ No newline at end of file
@@ -1,19 +1,30 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <array>
 #include <vector>
 #include <unordered_map>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
 #include <bitset>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include "purpose_bitmap.hpp"
 
 namespace controller {
 
 constexpr int num_users = 64;
-constexpr int num_purposes = 64;
+// the owner id of the legacy values whose user key has no id, which matches no user
+constexpr uint32_t unknown_user = UINT32_MAX;
+
 constexpr int metadata_prefix_fields = 8;
 
 enum metadata_fields {
@@ -29,55 +40,6 @@ enum metadata_fields {
   max_gdpr_field_guard
 };
 
-// NOLINTBEGIN(cert-err58-cpp)
-static const std::unordered_map<std::string, std::size_t> pur_index = []() {
-  std::unordered_map<std::string, std::size_t> temp;
-  for (std::size_t i = 0; i < num_purposes; i++) {
-    std::string value = "purpose" + std::to_string(i);
-    temp[value] = i;
-  }
-  return temp;
-}();
-// NOLINTEND(cert-err58-cpp)
-
-/* return the mapping between purposes and indexes in bitmap*/
-auto inline get_pur() -> std::unordered_map<std::string, std::size_t>
-{
-  return pur_index;
-}
-
-/* 
- *  takes as arguments a bitset and a vector of strings
- *  identifies the respective bit for each key based on the defined map of purposes
- *  and sets the appropriate bits
- */
-template<std::size_t N>
-auto inline set_bitmap(std::bitset<N> &bits, const std::vector<std::string> &bit_keys) -> void {
-  std::size_t index = 0;
-  for (const auto &bit_key : bit_keys) {
-    index = get_pur()[bit_key];
-    bits.set(index);
-  }
-}
-
-/* 
- *  takes as arguments a bitset and
- *  identifies the respective set bits and, based on the defined map of purposes,
- *  returns a comma separated string with the appropriate set of purposes
- */
-template<std::size_t N>
-auto inline get_purposes_string(std::bitset<N> &bits) -> std::string {
-  // Iterate over the bits and check each one
-  std::stringstream res;
-  for (size_t i = 0; i < bits.size(); i++) {
-    if (bits.test(i)) {
-      // The i-th bit is set
-      res << "purpose" << i << ",";
-    }
-  }
-  return res.str();
-}
-
 auto inline split_comma_string(std::string_view str) -> std::vector<std::string> {
   std::vector<std::string> result;
   size_t start = 0;
@@ -95,23 +57,36 @@ auto inline split_comma_string(std::string_view str) -> std::vector<std::string>
   return result;
 }
 
-/* convert "true" -> true, "false" -> false without a copy */
-auto inline str_to_bool(std::string_view str) -> bool {
-  auto equals_ignore_case = [](std::string_view lhs, std::string_view rhs) -> bool {
-    if (lhs.size() != rhs.size()) {
-      return false;
-    }
-    return std::equal(lhs.begin(), lhs.end(), rhs.begin(),
-                      [](char a, char b) { return std::tolower(a) == std::tolower(b); });
-  };
+/* compare the strings ignoring the case of ASCII letters, without a copy */
+constexpr auto equals_ignore_case(std::string_view lhs, std::string_view rhs) -> bool {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  // ASCII case folding, w/o the locale lookups of std::tolower
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char lhs_char, char rhs_char) {
+    return (lhs_char == rhs_char) ||
+           ((lhs_char | 0x20) == (rhs_char | 0x20) && (lhs_char | 0x20) >= 'a' && (lhs_char | 0x20) <= 'z');
+  });
+}
 
+/* convert "true" -> true, "false" -> false without a copy, std::nullopt for any other string */
+auto inline parse_bool(std::string_view str) -> std::optional<bool> {
   if (equals_ignore_case(str, "true")) {
     return true;
   }
   if (equals_ignore_case(str, "false")) {
     return false;
   }
-  throw std::runtime_error("Invalid string value: " + std::string(str));
+  return std::nullopt;
+}
+
+/* convert "true" -> true, "false" -> false without a copy */
+auto inline str_to_bool(std::string_view str) -> bool {
+  auto value = parse_bool(str);
+  if (!value.has_value()) {
+    throw std::runtime_error("Invalid string value: " + std::string(str));
+  }
+  return value.value();
 }
 
 /* convert true -> "true", false -> "false" */
@@ -129,37 +104,294 @@ auto inline get_expiration_time(int64_t secs_from_now) -> int64_t {
   return std::chrono::duration_cast<std::chrono::seconds>(expiration_time.time_since_epoch()).count();
 }
 
-/**
- * Removes the metadata from the given string containing GDPR metadata and returns the actual value.
- * The input string is modified in-place.
+/*
+ * GDPR metadata prefix of the stored values.
  *
- * @param value The string containing the GDPR metadata and actual value.
- * @return The actual value after removing the metadata.
+ * Values are written with a versioned binary prefix. Most values share their metadata with many
+ * others (the default policy of their client), so their prefix is a metadata_reference: the id
+ * of the policy record that holds the metadata in the policy_store, and the expiration time of
+ * the value. The policy records, and the values whose record cannot be stored, hold the metadata
+ * inline: a fixed-size metadata_header (flags, owner id, lengths, bitmaps and expiration time,
+ * integers in host byte order) followed by the words of the purpose and objection bitmaps beyond
+ * the first 64 purposes (only if some of these purposes are set), by the ids of the share list
+ * that do not fit in the share bitmap and by the origin.
+ * The owner and the users the value is shared with are ids of the user_dictionary: the ids below
+ * num_users are bits of the share bitmap, the others are listed after the header.
+ * The first byte (metadata_magic) is neither printable nor the first byte of a UTF-8 character,
+ * so it tells the binary prefix apart from the legacy text prefix
+ * "<usr>|<encr>|<pur>|<obj>|<org>|<exp>|<shr>|<log>|", which is still read, as is version 1 of
+ * the binary prefix (with the user keys as strings).
  */
-auto inline remove_gdpr_metadata(std::string value) -> std::string {
-  size_t last_delimiter_idx = value.find_last_of('|');
-  if (last_delimiter_idx != std::string::npos && last_delimiter_idx + 1 < value.length())
-  {
-    // Erase the metadata and return the actual value
-    value.erase(0, last_delimiter_idx + 1);
-  } 
-  return value;
+constexpr uint8_t metadata_magic = 0xA7U;
+constexpr uint8_t metadata_version_user_keys = 1;
+constexpr uint8_t metadata_version_inline = 2;
+constexpr uint8_t metadata_version_policy = 3;
+constexpr uint8_t metadata_flag_encryption = 0x01U;
+constexpr uint8_t metadata_flag_monitor = 0x02U;
+
+struct metadata_header
+{
+  uint8_t m_magic {metadata_magic};
+  uint8_t m_version {metadata_version_inline};
+  uint8_t m_flags {0};
+  // the number of words of each purpose bitmap after the header, i.e., beyond the first word
+  uint8_t m_purpose_words {0};
+  uint32_t m_owner {0};
+  uint32_t m_origin_length {0};
+  uint32_t m_share_overflow_count {0};
+  uint64_t m_purpose {0};
+  uint64_t m_objection {0};
+  int64_t m_expiration {0};
+  uint64_t m_share {0};
+};
+static_assert(sizeof(metadata_header) == 48, "metadata_header must not contain implicit padding");
+static_assert(num_purpose_words - 1 <= UINT8_MAX, "metadata_header counts the purpose words in a byte");
+static_assert(num_users <= 64, "the share bitmap of metadata_header holds 64 users");
+
+/* Prefix of the values that refer to a policy record for their metadata */
+struct metadata_reference
+{
+  uint8_t m_magic {metadata_magic};
+  uint8_t m_version {metadata_version_policy};
+  uint8_t m_flags {0};
+  uint8_t m_reserved {0};
+  uint32_t m_reserved_2 {0};
+  uint64_t m_policy_id {0};
+  int64_t m_expiration {0};
+};
+static_assert(sizeof(metadata_reference) == 24, "metadata_reference must not contain implicit padding");
+
+/* Version 1 of the binary prefix, followed by the user key, the origin and the share list */
+struct metadata_header_v1
+{
+  uint8_t m_magic {metadata_magic};
+  uint8_t m_version {metadata_version_user_keys};
+  uint8_t m_flags {0};
+  uint8_t m_reserved {0};
+  uint32_t m_user_key_length {0};
+  uint32_t m_origin_length {0};
+  uint32_t m_share_length {0};
+  uint64_t m_purpose {0};
+  uint64_t m_objection {0};
+  int64_t m_expiration {0};
+};
+static_assert(sizeof(metadata_header_v1) == 40, "metadata_header_v1 must not contain implicit padding");
+
+/* The decoded GDPR metadata of a value; the origin is a view into the value */
+struct gdpr_metadata
+{
+  uint32_t m_owner {0};
+  bool m_encryption {false};
+  purpose_bitmap m_purpose;
+  purpose_bitmap m_objection;
+  std::string_view m_origin;
+  int64_t m_expiration {0};
+  // the users the value is shared with: the ids below num_users as bits, the others as a list
+  std::bitset<num_users> m_share;
+  std::vector<uint32_t> m_share_overflow;
+  bool m_monitor {false};
+  // length of the encoded prefix, i.e., the offset of the value
+  size_t m_prefix_length {0};
+};
+
+auto inline is_binary_metadata(std::string_view value) -> bool {
+  return !value.empty() && static_cast<uint8_t>(value[0]) == metadata_magic;
+}
+
+/* Whether the value is in the current formats, i.e., the metadata of a policy record or a reference to one */
+auto inline is_current_metadata(std::string_view value) -> bool {
+  return value.size() > 1 && is_binary_metadata(value) &&
+         (static_cast<uint8_t>(value[1]) == metadata_version_inline ||
+          static_cast<uint8_t>(value[1]) == metadata_version_policy);
+}
+
+/* Whether the value is the inline metadata of a policy record, which is complete on its own */
+auto inline is_inline_metadata(std::string_view policy) -> bool {
+  return policy.size() >= sizeof(metadata_header) && is_binary_metadata(policy) &&
+         static_cast<uint8_t>(policy[1]) == metadata_version_inline;
+}
+
+/* The number of words of each purpose bitmap of the metadata that follow the header */
+auto inline extra_purpose_words(const gdpr_metadata& metadata) -> size_t {
+  const size_t words = std::max(metadata.m_purpose.used_words(), metadata.m_objection.used_words());
+  return (words > 1) ? words - 1 : 0;
+}
+
+/* The size of the binary prefix of the metadata */
+auto inline encoded_metadata_size(const gdpr_metadata& metadata) -> size_t {
+  return sizeof(metadata_header) + 2 * extra_purpose_words(metadata) * sizeof(uint64_t) +
+         metadata.m_share_overflow.size() * sizeof(uint32_t) + metadata.m_origin.size();
+}
+
+/* Appends the binary prefix of the metadata to the output */
+auto inline append_metadata(std::string& output, const gdpr_metadata& metadata) -> void {
+  metadata_header header;
+  header.m_flags = static_cast<uint8_t>((metadata.m_encryption ? metadata_flag_encryption : 0U) |
+                                        (metadata.m_monitor ? metadata_flag_monitor : 0U));
+  const size_t purpose_words = extra_purpose_words(metadata);
+  header.m_purpose_words = static_cast<uint8_t>(purpose_words);
+  header.m_owner = metadata.m_owner;
+  header.m_origin_length = static_cast<uint32_t>(metadata.m_origin.size());
+  header.m_share_overflow_count = static_cast<uint32_t>(metadata.m_share_overflow.size());
+  header.m_purpose = metadata.m_purpose.word(0);
+  header.m_objection = metadata.m_objection.word(0);
+  header.m_expiration = metadata.m_expiration;
+  header.m_share = metadata.m_share.to_ullong();
+  // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+  output.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const purpose_bitmap* bitmap : {&metadata.m_purpose, &metadata.m_objection}) {
+    for (size_t i = 1; i <= purpose_words; i++) {
+      const uint64_t word = bitmap->word(i);
+      output.append(reinterpret_cast<const char*>(&word), sizeof(word));
+    }
+  }
+  output.append(reinterpret_cast<const char*>(metadata.m_share_overflow.data()),
+                metadata.m_share_overflow.size() * sizeof(uint32_t));
+  // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+  output.append(metadata.m_origin);
 }
 
 /**
- * Preserves only the GDPR metadata from the given string containing GDPR metadata.
+ * Returns the length of the GDPR metadata prefix of the value, i.e., the offset of the value
+ * itself, or 0 if the value does not start with a complete prefix.
+ */
+auto inline metadata_prefix_length(std::string_view value) -> size_t {
+  if (is_binary_metadata(value)) {
+    size_t length = 0;
+    if (value.size() >= sizeof(metadata_reference) && static_cast<uint8_t>(value[1]) == metadata_version_policy) {
+      length = sizeof(metadata_reference);
+    } else if (value.size() >= sizeof(metadata_header) && static_cast<uint8_t>(value[1]) == metadata_version_inline) {
+      metadata_header header;
+      std::memcpy(&header, value.data(), sizeof(header));
+      // the bitmaps of a prefix with more purposes than the capacity cannot be decoded
+      if (header.m_purpose_words >= num_purpose_words) {
+        return 0;
+      }
+      length = sizeof(header) + 2 * static_cast<size_t>(header.m_purpose_words) * sizeof(uint64_t) +
+               static_cast<size_t>(header.m_share_overflow_count) * sizeof(uint32_t) + header.m_origin_length;
+    } else if (value.size() >= sizeof(metadata_header_v1) &&
+               static_cast<uint8_t>(value[1]) == metadata_version_user_keys) {
+      metadata_header_v1 header;
+      std::memcpy(&header, value.data(), sizeof(header));
+      length = sizeof(header) + static_cast<size_t>(header.m_user_key_length) + header.m_origin_length +
+               header.m_share_length;
+    }
+    return length <= value.size() ? length : 0;
+  }
+  size_t end = 0;
+  for (int count = 0; count < metadata_prefix_fields; count++) {
+    end = value.find('|', end);
+    if (end == std::string_view::npos) {
+      return 0;
+    }
+    end++;
+  }
+  return end;
+}
+
+/**
+ * Decodes the inline binary prefix of the given length (see metadata_prefix_length): one copy of
+ * the fixed header, the extra purpose words, the share overflow and the origin follow it.
+ */
+auto inline decode_inline_metadata(std::string_view value, size_t prefix_length) -> gdpr_metadata {
+  gdpr_metadata metadata;
+  metadata.m_prefix_length = prefix_length;
+  metadata_header header;
+  std::memcpy(&header, value.data(), sizeof(header));
+  size_t offset = sizeof(header);
+  metadata.m_purpose = purpose_bitmap(header.m_purpose);
+  metadata.m_objection = purpose_bitmap(header.m_objection);
+  for (purpose_bitmap* bitmap : {&metadata.m_purpose, &metadata.m_objection}) {
+    for (size_t i = 1; i <= header.m_purpose_words; i++) {
+      uint64_t word = 0;
+      std::memcpy(&word, value.data() + offset, sizeof(word));
+      bitmap->set_word(i, word);
+      offset += sizeof(word);
+    }
+  }
+  metadata.m_share_overflow.resize(header.m_share_overflow_count);
+  if (!metadata.m_share_overflow.empty()) {
+    std::memcpy(metadata.m_share_overflow.data(), value.data() + offset,
+                metadata.m_share_overflow.size() * sizeof(uint32_t));
+  }
+  offset += metadata.m_share_overflow.size() * sizeof(uint32_t);
+  metadata.m_origin = value.substr(offset, header.m_origin_length);
+  metadata.m_owner = header.m_owner;
+  metadata.m_share = std::bitset<num_users>(header.m_share);
+  metadata.m_encryption = (header.m_flags & metadata_flag_encryption) != 0;
+  metadata.m_monitor = (header.m_flags & metadata_flag_monitor) != 0;
+  metadata.m_expiration = header.m_expiration;
+  return metadata;
+}
+
+/* Parses an integer field of the legacy text prefix, which must be a decimal number as a whole */
+template<typename T>
+auto inline parse_metadata_integer(std::string_view token, T& result) -> bool {
+  const auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), result);
+  return error == std::errc() && end == token.data() + token.size();
+}
+
+/*
+ * The text form of a purpose bitmap: the decimal number of the first 64 purposes, as in the legacy
+ * text prefix, or the hexadecimal number "0x..." if purposes beyond them are set.
+ */
+auto inline purpose_bitmap_to_text(const purpose_bitmap& bits) -> std::string {
+  const size_t words = bits.used_words();
+  if (words <= 1) {
+    return std::to_string(bits.word(0));
+  }
+  constexpr int hex_digits_per_word = purpose_word_bits / 4;
+  std::string text = "0x";
+  std::array<char, hex_digits_per_word> digits{};
+  for (size_t i = words; i-- > 0;) {
+    const auto [end, error] = std::to_chars(digits.data(), digits.data() + digits.size(), bits.word(i), 16);
+    const auto length = static_cast<size_t>(end - digits.data());
+    if (i + 1 < words) {
+      text.append(hex_digits_per_word - length, '0');
+    }
+    text.append(digits.data(), length);
+  }
+  return text;
+}
+
+/* Parses the text form of a purpose bitmap */
+auto inline parse_purpose_bitmap(std::string_view token, purpose_bitmap& bits) -> bool {
+  bits.reset();
+  if (!token.starts_with("0x")) {
+    uint64_t word = 0;
+    const bool parsed = parse_metadata_integer(token, word);
+    bits.set_word(0, word);
+    return parsed;
+  }
+  constexpr size_t hex_digits_per_word = purpose_word_bits / 4;
+  token.remove_prefix(2);
+  if (token.empty() || token.size() > num_purpose_words * hex_digits_per_word) {
+    return false;
+  }
+  // the words from the least significant one, i.e., from the end of the number
+  for (size_t i = 0; !token.empty(); i++) {
+    const size_t length = std::min(token.size(), hex_digits_per_word);
+    const std::string_view digits = token.substr(token.size() - length);
+    uint64_t word = 0;
+    const auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), word, 16);
+    if (error != std::errc() || end != digits.data() + digits.size()) {
+      return false;
+    }
+    bits.set_word(i, word);
+    token.remove_suffix(length);
+  }
+  return true;
+}
+
+/**
+ * Removes the metadata from the given string containing GDPR metadata and returns the actual value.
  * The input string is modified in-place.
  *
- * @param value The string containing the GDPR metadata and the value.
- * @return The GDPR metadata.
+ * @param value The string containing the GDPR metadata and actual value.
+ * @return The actual value after removing the metadata.
  */
-auto inline preserve_only_gdpr_metadata(std::string value) -> std::string {
-  size_t last_delimiter_idx = value.find_last_of('|');
-  if (last_delimiter_idx != std::string::npos && last_delimiter_idx + 1 < value.length())
-  {
-    // Erase the value and return only the GDPR metadata
-    value.erase(last_delimiter_idx + 1, value.length());
-  }  
+auto inline remove_gdpr_metadata(std::string value) -> std::string {
+  value.erase(0, metadata_prefix_length(value));
   return value;
 }
 
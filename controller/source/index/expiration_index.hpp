@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace controller {
+
+/**
+ * Singleton time-ordered index of the keys that have an expiration time.
+ *
+ * It is a min-heap of (expiration time, key) entries populated with the absolute
+ * expiration computed by the query_rewriter. Rescheduling or cancelling a key does
+ * not touch the heap; the latest expiration of every key is kept on the side and
+ * outdated heap entries are dropped lazily when they reach the top.
+ *
+ * Note: the index is kept in memory and reflects the writes performed through
+ * the running controller instance.
+ */
+class expiration_index
+{
+public:
+  static auto get_instance() -> expiration_index* {
+    static expiration_index index_inst;
+    return &index_inst;
+  }
+
+  /* Set (or replace) the absolute expiration time of the key; 0 means no expiration */
+  auto schedule(std::string_view key, int64_t expiration) -> void {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string key_str(key);
+    if (expiration == 0) {
+      m_latest.erase(key_str);
+      return;
+    }
+    auto [iter, inserted] = m_latest.try_emplace(key_str, expiration);
+    if (!inserted) {
+      if (iter->second == expiration) {
+        // already scheduled, avoid duplicate heap entries on plain value updates
+        return;
+      }
+      iter->second = expiration;
+    }
+    m_heap.emplace(expiration, std::move(key_str));
+  }
+
+  /* Forget the key, e.g., after it has been deleted */
+  auto cancel(std::string_view key) -> void {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_latest.erase(std::string(key));
+  }
+
+  /* Remove and return up to max_keys keys whose expiration time is before now */
+  auto pop_expired(int64_t now, std::size_t max_keys) -> std::vector<std::string> {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> expired;
+    while (!m_heap.empty() && expired.size() < max_keys && m_heap.top().first < now) {
+      auto [expiration, key] = m_heap.top();
+      m_heap.pop();
+      auto iter = m_latest.find(key);
+      // skip entries of keys that were cancelled or rescheduled meanwhile
+      if (iter == m_latest.end() || iter->second != expiration) {
+        continue;
+      }
+      m_latest.erase(iter);
+      expired.push_back(std::move(key));
+    }
+    return expired;
+  }
+
+  [[nodiscard]] auto size() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_latest.size();
+  }
+
+private:
+  expiration_index() = default;
+
+  using heap_entry = std::pair<int64_t, std::string>;
+
+  mutable std::mutex m_mutex;
+  std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<>> m_heap;
+  std::unordered_map<std::string, int64_t> m_latest;
+};
+
+} // namespace controller
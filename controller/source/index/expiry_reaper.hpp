@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../gdpr_filter.hpp"
+#include "../kv_client/kv_client.hpp"
+#include "../logging/logger.hpp"
+#include "expiration_index.hpp"
+#include "purpose_index.hpp"
+
+namespace controller {
+
+// User key recorded in the audit logs for the deletions performed by the reaper
+// NOLINTNEXTLINE(cert-err58-cpp)
+const std::string reaper_key = "__gdpr_reaper";
+
+/**
+ * Background thread that deletes the expired objects from the database.
+ *
+ * Every interval it takes at most batch_size keys that are due from the
+ * expiration_index, re-checks their stored metadata (the expiration may have been
+ * updated through putm), deletes the ones that are indeed expired and writes the
+ * corresponding audit log entry for the monitored ones.
+ * The deletion only happens if the key still holds the value that was checked, so a
+ * value put meanwhile is never deleted (its put has scheduled its own expiration).
+ */
+class expiry_reaper
+{
+public:
+  expiry_reaper(std::unique_ptr<kv_client> client, std::size_t batch_size,
+                std::chrono::milliseconds interval)
+      : m_client{std::move(client)},
+        m_batch_size{batch_size},
+        m_interval{interval}
+  {
+  }
+
+  ~expiry_reaper() { stop(); }
+
+  expiry_reaper(const expiry_reaper&) = delete;
+  auto operator=(const expiry_reaper&) -> expiry_reaper& = delete;
+  expiry_reaper(expiry_reaper&&) = delete;
+  auto operator=(expiry_reaper&&) -> expiry_reaper& = delete;
+
+  auto start() -> void {
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  auto stop() -> void {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+private:
+  std::unique_ptr<kv_client> m_client;
+  std::size_t m_batch_size;
+  std::chrono::milliseconds m_interval;
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop{false};
+
+  auto run() -> void {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cv.wait_for(lock, m_interval, [this]() { return m_stop; })) {
+      lock.unlock();
+      reap_batch();
+      lock.lock();
+    }
+  }
+
+  auto reap_batch() -> void {
+    const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::system_clock::now().time_since_epoch()
+                          ).count();
+    auto *exp_index = expiration_index::get_instance();
+
+    for (const auto& key : exp_index->pop_expired(now, m_batch_size)) {
+      // only the metadata are needed to check the expiration
+      auto stored = m_client->gdpr_get_stored(key);
+      auto res = stored ? m_client->gdpr_seal(key, stored.value()) : std::nullopt;
+      if (!res) {
+        // already deleted, or expired by the backend itself (Redis EXPIREAT, the RocksDB compaction filter):
+        // pop_expired has dropped the key from the expiration heap, drop it from the purpose index too
+        purpose_index::get_instance()->remove(key);
+        continue;
+      }
+      const gdpr_filter filter(sealed_metadata(res));
+      if (filter.validate_exp_time()) {
+        // the expiration was extended meanwhile, track the new one
+        exp_index->schedule(key, filter.expiration());
+        continue;
+      }
+      const auto is_deleted = m_client->gdpr_del_if(key, stored.value());
+      if (is_deleted.has_value() && !is_deleted.value()) {
+        // replaced since it was checked
+        continue;
+      }
+      const bool deleted = is_deleted.has_value();
+      if (deleted) {
+        purpose_index::get_instance()->remove(key);
+      }
+      if (filter.check_monitoring()) {
+        const query query_args(reaper_key, key, "delete");
+        logger::get_instance()->log_encoded_query(query_args, default_policy{}, deleted);
+      }
+    }
+  }
+};
+
+} // namespace controller
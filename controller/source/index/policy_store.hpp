@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "record_file.hpp"
+
+namespace controller {
+
+/* 64-bit FNV-1a hash, the content address of the policy records (stable across runs and platforms) */
+constexpr auto policy_hash(std::string_view policy) -> uint64_t {
+  constexpr uint64_t fnv_offset_basis = 0xcbf29ce484222325ULL;
+  constexpr uint64_t fnv_prime = 0x100000001b3ULL;
+  uint64_t hash = fnv_offset_basis;
+  for (const char byte : policy) {
+    hash ^= static_cast<uint8_t>(byte);
+    hash *= fnv_prime;
+  }
+  return hash;
+}
+
+/**
+ * Singleton content-addressed store of the policy records: the GDPR metadata shared by many
+ * values (mostly the default policy of a client), stored once under their hash.
+ *
+ * The values refer to their policy record by its id (see gdpr_metadata.hpp), so their prefix
+ * does not repeat the owner, purposes, share list etc., and the validation of a value reads
+ * the cached record. The records are opaque to the store and never removed, so the views
+ * returned by find() remain valid.
+ *
+ * The store is persisted in a record_file, one record per policy, loaded on init; a new record is
+ * synced to the disk before its id is returned, as the values written with the id refer to it.
+ * W/o init, the records are only kept in memory.
+ */
+class policy_store
+{
+public:
+  static auto get_instance() -> policy_store* {
+    static policy_store store_inst;
+    return &store_inst;
+  }
+
+  /* Load the store file (created if missing); the records added afterwards are appended to it */
+  auto init(const std::string& path) -> bool {
+    std::scoped_lock lock(m_append_mutex, m_mutex);
+    m_policies.clear();
+    m_generation.fetch_add(1, std::memory_order_release);
+    return m_file.open(path, [this](std::string_view policy) { m_policies.emplace(policy_hash(policy), policy); });
+  }
+
+  /*
+   * The id of the policy record, which is stored (and synced) on its first use.
+   * Returns std::nullopt if another record has the same hash or if the record cannot be persisted.
+   */
+  auto intern(std::string_view policy) -> std::optional<uint64_t> {
+    const uint64_t policy_id = policy_hash(policy);
+    auto stored = find(policy_id);
+    if (stored.has_value()) {
+      return (stored.value() == policy) ? std::optional<uint64_t>(policy_id) : std::nullopt;
+    }
+    // the appends are serialized, but the lookups are not blocked while the record is synced
+    std::lock_guard<std::mutex> append_lock(m_append_mutex);
+    // the record may have been stored meanwhile
+    stored = find(policy_id);
+    if (stored.has_value()) {
+      return (stored.value() == policy) ? std::optional<uint64_t>(policy_id) : std::nullopt;
+    }
+    if (m_file.is_open() && !m_file.append(policy)) {
+      std::cerr << "Error in writing the policy store: the policy record is not persisted" << std::endl;
+      return std::nullopt;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_policies.emplace(policy_id, policy);
+    return policy_id;
+  }
+
+  /*
+   * The policy record of the id; the returned view remains valid (until the next init).
+   * The last record found by the thread is cached, as consecutive values mostly share their policy.
+   */
+  [[nodiscard]] auto find(uint64_t policy_id) const -> std::optional<std::string_view> {
+    thread_local cached_policy last_found;
+    const uint64_t generation = m_generation.load(std::memory_order_acquire);
+    if (last_found.m_policy_id == policy_id && last_found.m_generation == generation && !last_found.m_policy.empty()) {
+      return last_found.m_policy;
+    }
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto iter = m_policies.find(policy_id);
+    if (iter == m_policies.end()) {
+      return std::nullopt;
+    }
+    last_found = {policy_id, generation, iter->second};
+    return std::string_view(iter->second);
+  }
+
+  [[nodiscard]] auto size() const -> size_t {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_policies.size();
+  }
+
+private:
+  policy_store() = default;
+
+  struct cached_policy
+  {
+    uint64_t m_policy_id {0};
+    uint64_t m_generation {0};
+    std::string_view m_policy;
+  };
+
+  // taken before m_mutex
+  std::mutex m_append_mutex;
+  mutable std::shared_mutex m_mutex;
+  // incremented by init, which drops the records (and invalidates the cached ones)
+  std::atomic<uint64_t> m_generation {0};
+  // node-based: the records stay in place as the map grows
+  std::unordered_map<uint64_t, std::string> m_policies;
+  record_file m_file;
+};
+
+} // namespace controller
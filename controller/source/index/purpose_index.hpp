@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../gdpr_metadata.hpp"
+#include "roaring_bitmap.hpp"
+
+namespace controller {
+
+/**
+ * Singleton index from every purpose bit (and every objection bit) to the keys
+ * whose GDPR metadata has that bit set.
+ *
+ * Keys are mapped to dense 32-bit ids so that the posting list of each bit can be
+ * kept in a compressed roaring_bitmap. The index is maintained by the controller
+ * on put/putm/delete and allows listing or counting the objects that are usable
+ * for a set of purposes without fetching and decrypting any value.
+ *
+ * Note: the index is kept in memory and reflects the writes performed through
+ * the running controller instance.
+ */
+class purpose_index
+{
+public:
+  static auto get_instance() -> purpose_index* {
+    static purpose_index index_inst;
+    return &index_inst;
+  }
+
+  /* Insert the key or replace its purpose/objection bits with the given ones */
+  auto update(std::string_view key,
+              const purpose_bitmap& purposes,
+              const purpose_bitmap& objections) -> void
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    const uint32_t key_id = get_or_assign_id(key);
+    auto& entry = m_entries[key_id];
+    // only touch the posting lists of the bits that changed
+    update_postings(m_purpose_postings, key_id, entry.m_purposes, purposes);
+    update_postings(m_objection_postings, key_id, entry.m_objections, objections);
+    entry.m_purposes = purposes;
+    entry.m_objections = objections;
+  }
+
+  /* Remove the key and all its postings from the index */
+  auto remove(std::string_view key) -> void {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto iter = m_key_ids.find(std::string(key));
+    if (iter == m_key_ids.end()) {
+      return;
+    }
+    const uint32_t key_id = iter->second;
+    auto& entry = m_entries[key_id];
+    update_postings(m_purpose_postings, key_id, entry.m_purposes, {});
+    update_postings(m_objection_postings, key_id, entry.m_objections, {});
+    entry = {};
+    m_key_ids.erase(iter);
+    m_free_ids.push_back(key_id);
+  }
+
+  /* Return the keys that allow all the given purposes and object to none of them */
+  [[nodiscard]] auto find_keys(const purpose_bitmap& purposes) const -> std::vector<std::string> {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    std::vector<std::string> keys;
+    usable_keys(purposes).for_each([this, &keys](uint32_t key_id) {
+      keys.push_back(m_entries[key_id].m_key);
+    });
+    return keys;
+  }
+
+  /* Return the number of keys that allow all the given purposes and object to none of them */
+  [[nodiscard]] auto count_keys(const purpose_bitmap& purposes) const -> uint64_t {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return usable_keys(purposes).cardinality();
+  }
+
+private:
+  purpose_index() = default;
+
+  struct key_entry
+  {
+    std::string m_key;
+    purpose_bitmap m_purposes;
+    purpose_bitmap m_objections;
+  };
+
+  mutable std::shared_mutex m_mutex;
+  std::unordered_map<std::string, uint32_t> m_key_ids;
+  // indexed by key id, keeps the current bits of each key to compute the deltas
+  std::vector<key_entry> m_entries;
+  // ids of removed keys, reused to keep the id space (and the bitmaps) dense
+  std::vector<uint32_t> m_free_ids;
+  std::array<roaring_bitmap, num_purposes> m_purpose_postings;
+  std::array<roaring_bitmap, num_purposes> m_objection_postings;
+
+  auto get_or_assign_id(std::string_view key) -> uint32_t {
+    std::string key_str(key);
+    auto iter = m_key_ids.find(key_str);
+    if (iter != m_key_ids.end()) {
+      return iter->second;
+    }
+    uint32_t key_id = 0;
+    if (!m_free_ids.empty()) {
+      key_id = m_free_ids.back();
+      m_free_ids.pop_back();
+    } else {
+      key_id = static_cast<uint32_t>(m_entries.size());
+      m_entries.emplace_back();
+    }
+    m_entries[key_id].m_key = key_str;
+    m_key_ids.emplace(std::move(key_str), key_id);
+    return key_id;
+  }
+
+  static auto update_postings(std::array<roaring_bitmap, num_purposes>& postings, uint32_t key_id,
+                              const purpose_bitmap& old_bits,
+                              const purpose_bitmap& new_bits) -> void
+  {
+    (old_bits ^ new_bits).for_each([&](std::size_t bit) {
+      if (new_bits.test(bit)) {
+        postings[bit].add(key_id);
+      } else {
+        postings[bit].remove(key_id);
+      }
+    });
+  }
+
+  /* AND of the purpose postings minus the OR of the objection postings; requires the lock */
+  [[nodiscard]] auto usable_keys(const purpose_bitmap& purposes) const -> roaring_bitmap {
+    roaring_bitmap result;
+    bool first = true;
+    purposes.for_each([&](std::size_t bit) {
+      if (first) {
+        result = m_purpose_postings[bit];
+        first = false;
+      } else if (!result.empty()) {
+        result &= m_purpose_postings[bit];
+      }
+    });
+    if (!result.empty()) {
+      purposes.for_each([&](std::size_t bit) { result.and_not(m_objection_postings[bit]); });
+    }
+    return result;
+  }
+};
+
+} // namespace controller
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../encryption/cipher_engine.hpp"
+
+namespace controller {
+
+/**
+ * Append-only file of length-prefixed records, which persists the dictionaries of the controller
+ * (see user_dictionary and policy_store). The records are encrypted with the db key when the
+ * encryption is enabled; the file is rewritten with the active key on open if some records use
+ * a previous key of the key ring.
+ * An append returns once the record is synced to the disk, as the stored values refer to it.
+ */
+class record_file
+{
+public:
+  record_file() = default;
+  record_file(const record_file&) = delete;
+  auto operator=(const record_file&) -> record_file& = delete;
+  ~record_file() { close(); }
+
+  /* Read the records of the file (created if missing) and open it for the appends */
+  auto open(const std::string& path, const std::function<void(std::string_view)>& on_record) -> bool {
+    close();
+    m_path = path;
+
+    std::vector<std::string> records;
+    bool rewrite = false;
+    if (std::filesystem::exists(m_path)) {
+      std::ifstream file(m_path, std::ios::binary);
+      size_t record_size = 0;
+      std::string record;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      while (file.read(reinterpret_cast<char*>(&record_size), sizeof(record_size))) {
+        record.resize(record_size);
+        if (!file.read(record.data(), static_cast<std::streamsize>(record_size))) {
+          std::cerr << "Error: Truncated record in " << m_path << std::endl;
+          return false;
+        }
+        #ifndef ENCRYPTION_ENABLED
+        records.push_back(record);
+        #else
+        auto decrypted_record = m_cipher->decrypt(record, cipher_key_type::db_key);
+        if (!decrypted_record.m_success) {
+          std::cerr << "Error: Failed to decrypt a record of " << m_path << std::endl;
+          return false;
+        }
+        rewrite |= !m_cipher->uses_active_key(record, cipher_key_type::db_key);
+        records.push_back(std::move(decrypted_record.m_plaintext));
+        #endif
+      }
+    }
+    if (rewrite && !rewrite_file(records)) {
+      return false;
+    }
+    for (const auto& record : records) {
+      on_record(record);
+    }
+
+    const bool created = !std::filesystem::exists(m_path);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    m_fd = ::open(m_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd < 0) {
+      std::cerr << "Error: Failed to open " << m_path << std::endl;
+      return false;
+    }
+    // the new file itself has to survive a crash, not only its records
+    if (created && !sync_directory()) {
+      std::cerr << "Error: Failed to sync the directory of " << m_path << std::endl;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  [[nodiscard]] auto is_open() const -> bool { return m_fd >= 0; }
+
+  /* Append the record and sync it to the disk */
+  auto append(std::string_view record) -> bool {
+    return write_record(m_fd, record) && ::fdatasync(m_fd) == 0;
+  }
+
+private:
+  std::string m_path;
+  int m_fd {-1};
+  #ifdef ENCRYPTION_ENABLED
+  cipher_engine* m_cipher{cipher_engine::get_instance()};
+  #endif
+
+  auto close() -> void {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+  /* Write the length-prefixed record in a single write, w/o syncing it */
+  auto write_record(int fd, std::string_view record) const -> bool {
+    #ifdef ENCRYPTION_ENABLED
+    auto encrypted_record = m_cipher->encrypt(record, cipher_key_type::db_key);
+    if (!encrypted_record.m_success) {
+      return false;
+    }
+    record = encrypted_record.m_ciphertext;
+    #endif
+    const size_t record_size = record.size();
+    std::string buffer;
+    buffer.reserve(sizeof(record_size) + record_size);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    buffer.append(reinterpret_cast<const char*>(&record_size), sizeof(record_size));
+    buffer.append(record);
+    std::string_view remaining(buffer);
+    while (!remaining.empty()) {
+      const ssize_t written = ::write(fd, remaining.data(), remaining.size());
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      remaining.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+  }
+
+  /* Sync the directory of the file, which persists its creation or its replacement */
+  [[nodiscard]] auto sync_directory() const -> bool {
+    const std::filesystem::path directory = std::filesystem::path(m_path).parent_path();
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    const int dir_fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+      return false;
+    }
+    const bool synced = ::fsync(dir_fd) == 0;
+    ::close(dir_fd);
+    return synced;
+  }
+
+  /* Rewrite the whole file with the active key; the synced copy replaces the file */
+  auto rewrite_file(const std::vector<std::string>& records) -> bool {
+    const std::string tmp_path = m_path + ".tmp";
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    const int tmp_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (tmp_fd < 0) {
+      std::cerr << "Error: Failed to create " << tmp_path << std::endl;
+      return false;
+    }
+    bool written = true;
+    for (const auto& record : records) {
+      written = written && write_record(tmp_fd, record);
+    }
+    written = written && ::fsync(tmp_fd) == 0;
+    ::close(tmp_fd);
+    if (!written) {
+      std::cerr << "Error: Failed to write " << tmp_path << std::endl;
+      return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp_path, m_path, error);
+    if (error) {
+      std::cerr << "Error: Failed to replace " << m_path << ": " << error.message() << std::endl;
+      return false;
+    }
+    if (!sync_directory()) {
+      std::cerr << "Error: Failed to sync the directory of " << m_path << std::endl;
+      return false;
+    }
+    return true;
+  }
+};
+
+} // namespace controller
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace controller {
+
+/**
+ * roaring_bitmap is a compressed bitmap of 32-bit integers (roaring-style).
+ *
+ * The 32-bit space is split in chunks of 2^16 values keyed by the upper 16 bits.
+ * Each non-empty chunk is stored in a container which is either:
+ *  - an array container: a sorted vector of the lower 16 bits (sparse chunks), or
+ *  - a bitset container: 1024 64-bit words (dense chunks).
+ * A container switches representation when its cardinality crosses array_max_size,
+ * so that both memory usage and the cost of set operations stay bounded.
+ */
+class roaring_bitmap
+{
+public:
+  roaring_bitmap() = default;
+
+  auto add(uint32_t value) -> void {
+    auto& cont = get_or_create_container(high_bits(value));
+    cont.add(low_bits(value));
+  }
+
+  auto remove(uint32_t value) -> void {
+    auto iter = find_container(high_bits(value));
+    if (iter == m_containers.end() || iter->m_high != high_bits(value)) {
+      return;
+    }
+    iter->remove(low_bits(value));
+    if (iter->m_cardinality == 0) {
+      m_containers.erase(iter);
+    }
+  }
+
+  [[nodiscard]] auto contains(uint32_t value) const -> bool {
+    auto iter = find_container(high_bits(value));
+    return iter != m_containers.end() && iter->m_high == high_bits(value) &&
+           iter->contains(low_bits(value));
+  }
+
+  [[nodiscard]] auto cardinality() const -> uint64_t {
+    uint64_t total = 0;
+    for (const auto& cont : m_containers) {
+      total += cont.m_cardinality;
+    }
+    return total;
+  }
+
+  [[nodiscard]] auto empty() const -> bool {
+    return m_containers.empty();
+  }
+
+  /* In-place intersection: keep only the values that are also present in other */
+  auto operator&=(const roaring_bitmap& other) -> roaring_bitmap& {
+    std::vector<container> result;
+    auto lhs = m_containers.begin();
+    auto rhs = other.m_containers.begin();
+    while (lhs != m_containers.end() && rhs != other.m_containers.end()) {
+      if (lhs->m_high < rhs->m_high) {
+        ++lhs;
+      } else if (rhs->m_high < lhs->m_high) {
+        ++rhs;
+      } else {
+        container cont = container::intersect(*lhs, *rhs);
+        if (cont.m_cardinality != 0) {
+          result.push_back(std::move(cont));
+        }
+        ++lhs;
+        ++rhs;
+      }
+    }
+    m_containers = std::move(result);
+    return *this;
+  }
+
+  /* In-place difference: remove the values that are present in other */
+  auto and_not(const roaring_bitmap& other) -> roaring_bitmap& {
+    auto rhs = other.m_containers.begin();
+    for (auto lhs = m_containers.begin(); lhs != m_containers.end();) {
+      while (rhs != other.m_containers.end() && rhs->m_high < lhs->m_high) {
+        ++rhs;
+      }
+      if (rhs != other.m_containers.end() && rhs->m_high == lhs->m_high) {
+        lhs->subtract(*rhs);
+        if (lhs->m_cardinality == 0) {
+          lhs = m_containers.erase(lhs);
+          continue;
+        }
+      }
+      ++lhs;
+    }
+    return *this;
+  }
+
+  /* Call func(value) for every value of the bitmap in increasing order */
+  template<typename Func>
+  auto for_each(Func&& func) const -> void {
+    for (const auto& cont : m_containers) {
+      const uint32_t base = static_cast<uint32_t>(cont.m_high) << 16U;
+      if (cont.is_bitset()) {
+        for (size_t word_idx = 0; word_idx < bitset_words; word_idx++) {
+          uint64_t word = cont.m_bitset[word_idx];
+          while (word != 0) {
+            auto bit = static_cast<uint32_t>(std::countr_zero(word));
+            func(base | static_cast<uint32_t>(word_idx * 64 + bit));
+            word &= word - 1;
+          }
+        }
+      } else {
+        for (uint16_t low : cont.m_array) {
+          func(base | low);
+        }
+      }
+    }
+  }
+
+private:
+  // containers above this cardinality are stored as bitsets
+  static constexpr uint32_t array_max_size = 4096;
+  static constexpr size_t bitset_words = (1U << 16U) / 64;
+
+  static auto high_bits(uint32_t value) -> uint16_t { return static_cast<uint16_t>(value >> 16U); }
+  static auto low_bits(uint32_t value) -> uint16_t { return static_cast<uint16_t>(value & 0xFFFFU); }
+
+  struct container
+  {
+    uint16_t m_high{0};
+    uint32_t m_cardinality{0};
+    // exactly one of the two representations is in use at a time
+    std::vector<uint16_t> m_array;
+    std::vector<uint64_t> m_bitset;
+
+    [[nodiscard]] auto is_bitset() const -> bool { return !m_bitset.empty(); }
+
+    [[nodiscard]] auto contains(uint16_t low) const -> bool {
+      if (is_bitset()) {
+        return ((m_bitset[low / 64U] >> (low % 64U)) & 1U) != 0;
+      }
+      return std::binary_search(m_array.begin(), m_array.end(), low);
+    }
+
+    auto add(uint16_t low) -> void {
+      if (is_bitset()) {
+        uint64_t& word = m_bitset[low / 64U];
+        const uint64_t mask = uint64_t{1} << (low % 64U);
+        if ((word & mask) == 0) {
+          word |= mask;
+          m_cardinality++;
+        }
+        return;
+      }
+      auto iter = std::lower_bound(m_array.begin(), m_array.end(), low);
+      if (iter != m_array.end() && *iter == low) {
+        return;
+      }
+      m_array.insert(iter, low);
+      m_cardinality++;
+      if (m_cardinality > array_max_size) {
+        to_bitset();
+      }
+    }
+
+    auto remove(uint16_t low) -> void {
+      if (is_bitset()) {
+        uint64_t& word = m_bitset[low / 64U];
+        const uint64_t mask = uint64_t{1} << (low % 64U);
+        if ((word & mask) != 0) {
+          word &= ~mask;
+          m_cardinality--;
+          if (m_cardinality <= array_max_size) {
+            to_array();
+          }
+        }
+        return;
+      }
+      auto iter = std::lower_bound(m_array.begin(), m_array.end(), low);
+      if (iter != m_array.end() && *iter == low) {
+        m_array.erase(iter);
+        m_cardinality--;
+      }
+    }
+
+    auto to_bitset() -> void {
+      m_bitset.assign(bitset_words, 0);
+      for (uint16_t low : m_array) {
+        m_bitset[low / 64U] |= uint64_t{1} << (low % 64U);
+      }
+      m_array.clear();
+      m_array.shrink_to_fit();
+    }
+
+    auto to_array() -> void {
+      std::vector<uint16_t> values;
+      values.reserve(m_cardinality);
+      for (size_t word_idx = 0; word_idx < bitset_words; word_idx++) {
+        uint64_t word = m_bitset[word_idx];
+        while (word != 0) {
+          values.push_back(static_cast<uint16_t>(word_idx * 64 + static_cast<size_t>(std::countr_zero(word))));
+          word &= word - 1;
+        }
+      }
+      m_array = std::move(values);
+      m_bitset.clear();
+      m_bitset.shrink_to_fit();
+    }
+
+    /* recount after a word-wise operation and pick the cheaper representation */
+    auto normalize_bitset() -> void {
+      m_cardinality = 0;
+      for (uint64_t word : m_bitset) {
+        m_cardinality += static_cast<uint32_t>(std::popcount(word));
+      }
+      if (m_cardinality <= array_max_size) {
+        to_array();
+      }
+    }
+
+    static auto intersect(const container& lhs, const container& rhs) -> container {
+      container result;
+      result.m_high = lhs.m_high;
+      if (lhs.is_bitset() && rhs.is_bitset()) {
+        result.m_bitset.resize(bitset_words);
+        for (size_t word_idx = 0; word_idx < bitset_words; word_idx++) {
+          result.m_bitset[word_idx] = lhs.m_bitset[word_idx] & rhs.m_bitset[word_idx];
+        }
+        result.normalize_bitset();
+        return result;
+      }
+      if (lhs.is_bitset() || rhs.is_bitset()) {
+        const container& array_cont = lhs.is_bitset() ? rhs : lhs;
+        const container& bitset_cont = lhs.is_bitset() ? lhs : rhs;
+        for (uint16_t low : array_cont.m_array) {
+          if (bitset_cont.contains(low)) {
+            result.m_array.push_back(low);
+          }
+        }
+      } else {
+        std::set_intersection(lhs.m_array.begin(), lhs.m_array.end(),
+                              rhs.m_array.begin(), rhs.m_array.end(),
+                              std::back_inserter(result.m_array));
+      }
+      result.m_cardinality = static_cast<uint32_t>(result.m_array.size());
+      return result;
+    }
+
+    auto subtract(const container& other) -> void {
+      if (is_bitset()) {
+        if (other.is_bitset()) {
+          for (size_t word_idx = 0; word_idx < bitset_words; word_idx++) {
+            m_bitset[word_idx] &= ~other.m_bitset[word_idx];
+          }
+        } else {
+          for (uint16_t low : other.m_array) {
+            m_bitset[low / 64U] &= ~(uint64_t{1} << (low % 64U));
+          }
+        }
+        normalize_bitset();
+        return;
+      }
+      std::erase_if(m_array, [&other](uint16_t low) { return other.contains(low); });
+      m_cardinality = static_cast<uint32_t>(m_array.size());
+    }
+  };
+
+  // containers sorted by their high bits
+  std::vector<container> m_containers;
+
+  [[nodiscard]] auto find_container(uint16_t high) const -> std::vector<container>::const_iterator {
+    return std::lower_bound(m_containers.begin(), m_containers.end(), high,
+                            [](const container& cont, uint16_t key) { return cont.m_high < key; });
+  }
+
+  auto find_container(uint16_t high) -> std::vector<container>::iterator {
+    return std::lower_bound(m_containers.begin(), m_containers.end(), high,
+                            [](const container& cont, uint16_t key) { return cont.m_high < key; });
+  }
+
+  auto get_or_create_container(uint16_t high) -> container& {
+    auto iter = find_container(high);
+    if (iter == m_containers.end() || iter->m_high != high) {
+      container cont;
+      cont.m_high = high;
+      iter = m_containers.insert(iter, std::move(cont));
+    }
+    return *iter;
+  }
+};
+
+} // namespace controller
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "record_file.hpp"
+
+namespace controller {
+
+/**
+ * Singleton dictionary that maps the user keys to compact 32-bit ids.
+ *
+ * The GDPR metadata of the values store the owner and the users they are shared with as ids
+ * (see gdpr_metadata.hpp), so the access checks are integer and bit tests. Ids are assigned
+ * in order of first use and never reused, as the stored values keep referring to them.
+ *
+ * The dictionary is persisted in a record_file, one user key per id, loaded on init.
+ * W/o init, the ids are only kept in memory.
+ */
+class user_dictionary
+{
+public:
+  static auto get_instance() -> user_dictionary* {
+    static user_dictionary dictionary_inst;
+    return &dictionary_inst;
+  }
+
+  /* Load the dictionary file (created if missing); the ids assigned afterwards are appended to it */
+  auto init(const std::string& path) -> bool {
+    std::scoped_lock lock(m_append_mutex, m_mutex);
+    m_user_ids.clear();
+    m_user_keys.clear();
+    return m_file.open(path, [this](std::string_view user_key) { add_user_key(user_key); });
+  }
+
+  /**
+   * The id of the user key, assigned on its first use and synced to the disk before it is returned.
+   * Returns std::nullopt if the new id cannot be persisted: after a restart, it would be assigned to
+   * another user, who would then pass the access checks of the values that refer to it.
+   */
+  auto get_or_assign_id(std::string_view user_key) -> std::optional<uint32_t> {
+    auto user_id = find_id(user_key);
+    if (user_id.has_value()) {
+      return user_id.value();
+    }
+    // the appends are serialized, but the lookups are not blocked while the record is synced
+    std::lock_guard<std::mutex> append_lock(m_append_mutex);
+    // the key may have been assigned meanwhile
+    user_id = find_id(user_key);
+    if (user_id.has_value()) {
+      return user_id.value();
+    }
+    if (m_file.is_open() && !m_file.append(user_key)) {
+      std::cerr << "Error in writing the user dictionary: the id of " << user_key << " is not persisted" << std::endl;
+      return std::nullopt;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    return add_user_key(user_key);
+  }
+
+  /* The id of the user key, if it has one */
+  [[nodiscard]] auto find_id(std::string_view user_key) const -> std::optional<uint32_t> {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto iter = m_user_ids.find(user_key);
+    if (iter == m_user_ids.end()) {
+      return std::nullopt;
+    }
+    return iter->second;
+  }
+
+  /* The user key of the id (empty for an unknown id); the returned view remains valid */
+  [[nodiscard]] auto user_key(uint32_t user_id) const -> std::string_view {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    if (user_id >= m_user_keys.size()) {
+      return {};
+    }
+    return m_user_keys[user_id];
+  }
+
+  [[nodiscard]] auto size() const -> size_t {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_user_keys.size();
+  }
+
+private:
+  user_dictionary() = default;
+
+  /* transparent hash, so that the lookups of a std::string_view do not construct a std::string */
+  struct user_key_hash
+  {
+    using is_transparent = void;
+    auto operator()(std::string_view user_key) const -> size_t {
+      return std::hash<std::string_view>{}(user_key);
+    }
+  };
+
+  // taken before m_mutex; the ids are assigned in the order of their records
+  std::mutex m_append_mutex;
+  mutable std::shared_mutex m_mutex;
+  std::unordered_map<std::string, uint32_t, user_key_hash, std::equal_to<>> m_user_ids;
+  // indexed by user id; a deque keeps the user keys in place as it grows
+  std::deque<std::string> m_user_keys;
+  record_file m_file;
+
+  /* requires the unique lock */
+  auto add_user_key(std::string_view user_key) -> uint32_t {
+    const auto user_id = static_cast<uint32_t>(m_user_keys.size());
+    m_user_keys.emplace_back(user_key);
+    m_user_ids.emplace(m_user_keys.back(), user_id);
+    return user_id;
+  }
+};
+
+} // namespace controller
@@ -3,8 +3,69 @@
 #include <iostream>
 #include <string>
 #include <optional>
+#include <span>
+#include <vector>
 
 #include "../encryption/cipher_engine.hpp"
+#include "../metadata_resolver.hpp"
+
+/* An entry of a batched put; expiration is the absolute expiration time in seconds (0: none) */
+struct kv_entry
+{
+  std::string_view m_key;
+  std::string_view m_value;
+  int64_t m_expiration {0};
+};
+
+/* A page of keys of a backend scan; the scan is complete when the cursor of the next page is empty */
+struct scan_page
+{
+  std::vector<std::string> m_keys;
+  std::string m_cursor;
+};
+
+/*
+ * A retrieved value whose gdpr metadata can be read before the value itself.
+ * With encryption, values stored in the split format (see cipher_engine::encrypt_split) only
+ * have their small metadata envelope decrypted on retrieval; the value stays encrypted until
+ * kv_client::gdpr_unseal is called, i.e., once the access has been granted.
+ */
+class sealed_value
+{
+public:
+  /* The gdpr metadata prefix "<usr>|...|<log>|" */
+  [[nodiscard]] auto metadata() const -> std::string_view {
+    return std::string_view(m_buffer).substr(m_metadata_offset, m_metadata_len);
+  }
+
+private:
+  friend class kv_client;
+
+  // the retrieved value: plaintext, or the split ciphertext with the envelope decrypted in place
+  std::string m_buffer;
+  size_t m_metadata_offset {0};
+  size_t m_metadata_len {0};
+  // size of the metadata envelope when the value part is still encrypted, 0 otherwise
+  size_t m_envelope_size {0};
+  // the value part is stored in plaintext, as the (authenticated) metadata mark the value as non-sensitive
+  bool m_non_sensitive {false};
+};
+
+/* Outcome of kv_client::gdpr_rekey */
+enum class rekey_result : uint8_t {
+  rewritten,
+  // the value already uses the active key, or it was deleted or replaced meanwhile
+  skipped,
+  failed
+};
+
+/* The metadata of the retrieved value, as checked by the gdpr_filter */
+inline auto sealed_metadata(const std::optional<sealed_value>& value) -> std::optional<std::string_view> {
+  if (!value.has_value()) {
+    return std::nullopt;
+  }
+  return value->metadata();
+}
 
 class kv_client
 {
@@ -15,31 +76,73 @@ public:
       // get the value directly w/o decryption
       return std::move(get(key));
     #else
-      // get the value after decryption
-      auto encrypted_value = get(key);
-      if (!encrypted_value.has_value()) {
+      // get the value after decryption of both its metadata and the value itself
+      auto value = gdpr_get_sealed(key);
+      if (!value.has_value()) {
         return std::nullopt;
       }
+      return gdpr_unseal(value.value());
+    #endif
+  }
 
-      auto decrypt_result = m_cipher->decrypt(encrypted_value.value(), cipher_key_type::db_key);
-      if (decrypt_result.m_success) {
-        return decrypt_result.m_plaintext;
-      }
-      std::cerr << "Error in get: Decryption failed for value: " << encrypted_value.value() << std::endl;
+  /* Get the value with only its gdpr metadata decrypted, so that the access can be checked first */
+  auto gdpr_get_sealed(std::string_view key) -> std::optional<sealed_value> {
+    auto value = get(key);
+    if (!value.has_value()) {
       return std::nullopt;
-    #endif
+    }
+    return gdpr_seal(key, std::move(value.value()));
+  }
+
+  /* Get the value as stored in the backend (encrypted), to be opened with gdpr_seal and compared by gdpr_del_if */
+  auto gdpr_get_stored(std::string_view key) -> std::optional<std::string> {
+    return get(key);
+  }
+
+  /* The stored value of the key with only its gdpr metadata decrypted, see gdpr_get_sealed */
+  auto gdpr_seal(std::string_view key, std::string stored_value) -> std::optional<sealed_value> {
+    auto sealed = open_metadata(std::move(stored_value));
+    if (!sealed.has_value()) {
+      std::cerr << "Error in get: Decryption failed for the metadata of key: " << key << std::endl;
+    }
+    return sealed;
+  }
+
+  /*
+   * Get the whole value "<metadata>|<value>" of a sealed value, decrypting the value part if needed.
+   * The sealed value is consumed: the views of its metadata are no longer valid afterwards.
+   */
+  auto gdpr_unseal(sealed_value& value) -> std::optional<std::string> {
+    if (value.m_envelope_size == 0) {
+      // the value is already in plaintext
+      return std::move(value.m_buffer);
+    }
+    std::string_view ciphertext = value.m_buffer;
+    std::string result(value.m_metadata_len + controller::cipher_engine::decrypted_size(
+                                                ciphertext.substr(value.m_envelope_size)), '\0');
+    std::memcpy(result.data(), value.metadata().data(), value.m_metadata_len);
+    auto value_len = m_cipher->decrypt_split_value(ciphertext, value.m_envelope_size, cipher_key_type::db_key,
+                                                   std::span<char>(result).subspan(value.m_metadata_len),
+                                                   value.m_non_sensitive);
+    if (!value_len.has_value()) {
+      std::cerr << "Error in get: Decryption failed for the value" << std::endl;
+      return std::nullopt;
+    }
+    result.resize(value.m_metadata_len + value_len.value());
+    return result;
   }
 
+  /* expiration: absolute expiration time of the value in seconds (0: none), enforced by the backend */
   // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-  inline auto gdpr_put(std::string_view key, std::string_view value) -> bool {
+  inline auto gdpr_put(std::string_view key, std::string_view value, int64_t expiration = 0) -> bool {
     #ifndef ENCRYPTION_ENABLED
       // put the pair directly w/o encryption
-      return put(key, value);
+      return put(key, value, expiration);
     #else
-      // put the pair after encryption
-      auto encrypt_result = m_cipher->encrypt(value, cipher_key_type::db_key);
-      if (encrypt_result.m_success) {
-        return put(key, encrypt_result.m_ciphertext);
+      // put the pair after encryption into the reusable buffer
+      auto ciphertext = encrypt_to_buffer(value);
+      if (ciphertext.has_value()) {
+        return put(key, ciphertext.value(), expiration);
       }
       std::cerr << "Error in put: Encryption failed for value: " << value << std::endl;
       return false;
@@ -56,38 +159,149 @@ public:
     #endif
   }
 
+  /*
+   * Delete the key only if it still holds the stored value (as returned by gdpr_get_stored), so a value
+   * written meanwhile is kept. Returns whether the key was deleted, or nullopt if the deletion failed.
+   */
+  auto gdpr_del_if(std::string_view key, std::string_view stored_value) -> std::optional<bool> {
+    // the stored value is compared as is, w/o decryption
+    return compare_and_del(key, stored_value);
+  }
+
+  /* Get only the gdpr metadata of the value; with encryption the value part is not decrypted */
   auto gdpr_getm(std::string_view key) -> std::optional<std::string> {
+    auto value = getm(key);
+    if (!value.has_value()) {
+      return std::nullopt;
+    }
+    auto sealed = open_metadata(std::move(value.value()));
+    if (!sealed.has_value()) {
+      std::cerr << "Error in getm: Decryption failed for the metadata of key: " << key << std::endl;
+      return std::nullopt;
+    }
+    return std::string(sealed->metadata());
+  }
+
+  auto gdpr_putm(std::string_view key, std::string_view value, int64_t expiration = 0) -> bool {
     #ifndef ENCRYPTION_ENABLED
-      // get the value directly w/o decryption
-      return getm(key);
+      // put the pair directly w/o encryption
+      return putm(key, value, expiration);
     #else
-      // get the value after decryption
-      auto encrypted_value = getm(key);
-      if (!encrypted_value.has_value()) {
-        return std::nullopt;
+      // put the pair after encryption into the reusable buffer
+      auto ciphertext = encrypt_to_buffer(value);
+      if (ciphertext.has_value()) {
+        return putm(key, ciphertext.value(), expiration);
       }
+      std::cerr << "Error in put: Encryption failed for value: " << value << std::endl;
+      return false;
+    #endif
+  }
 
-      auto decrypt_result = m_cipher->decrypt(encrypted_value.value(), cipher_key_type::db_key);
-      if (decrypt_result.m_success) {
-        return decrypt_result.m_plaintext;
+  /* Batched interface: the backends that support it serve the whole batch with one request */
+  auto gdpr_mget(std::span<const std::string_view> keys) -> std::vector<std::optional<std::string>> {
+    #ifndef ENCRYPTION_ENABLED
+      // get the values directly w/o decryption
+      return mget(keys);
+    #else
+      // get the values after decryption
+      auto values = mget(keys);
+      for (size_t i = 0; i < values.size(); i++) {
+        if (!values[i].has_value()) {
+          continue;
+        }
+        auto sealed = open_metadata(std::move(values[i].value()));
+        values[i] = sealed.has_value() ? gdpr_unseal(sealed.value()) : std::nullopt;
+        if (!values[i].has_value()) {
+          std::cerr << "Error in mget: Decryption failed for the value of key: " << keys[i] << std::endl;
+        }
       }
-      std::cerr << "Error in get: Decryption failed for value: " << encrypted_value.value() << std::endl;
-      return std::nullopt;
+      return values;
     #endif
   }
 
-  auto gdpr_putm(std::string_view key, std::string_view value) -> bool {
+  auto gdpr_mput(std::span<const kv_entry> entries) -> bool {
     #ifndef ENCRYPTION_ENABLED
-      // put the pair directly w/o encryption
-      return putm(key, value);
+      // put the pairs directly w/o encryption
+      return mput(entries);
     #else
-      // put the pair after encryption
-      auto encrypt_result = m_cipher->encrypt(value, cipher_key_type::db_key);
-      if (encrypt_result.m_success) {
-        return put(key, encrypt_result.m_ciphertext);
+      // put the pairs after encryption, all the ciphertexts are placed in the reusable buffer
+      size_t buffer_size = 0;
+      for (const auto& entry : entries) {
+        buffer_size += controller::cipher_engine::split_encrypted_size(0, entry.m_value.size());
       }
-      std::cerr << "Error in put: Encryption failed for value: " << value << std::endl;
-      return false;
+      m_crypto_buffer.resize(buffer_size);
+      std::vector<kv_entry> encrypted_entries;
+      encrypted_entries.reserve(entries.size());
+      size_t offset = 0;
+      for (const auto& entry : entries) {
+        auto output = std::span<char>(m_crypto_buffer).subspan(offset);
+        auto ciphertext_len = encrypt_split(entry.m_value, output);
+        if (!ciphertext_len.has_value()) {
+          std::cerr << "Error in mput: Encryption failed for value: " << entry.m_value << std::endl;
+          return false;
+        }
+        encrypted_entries.push_back({entry.m_key, std::string_view(output.data(), ciphertext_len.value()),
+                                     entry.m_expiration});
+        offset += ciphertext_len.value();
+      }
+      return mput(encrypted_entries);
+    #endif
+  }
+
+  auto gdpr_mdel(std::span<const std::string_view> keys) -> bool {
+    // delete the pairs directly w/o decryption
+    return mdel(keys);
+  }
+
+  /*
+   * Get the next page of (at most about count) keys of the database, starting after the cursor
+   * (empty for the first page). Keys written during the scan may be missed or returned twice.
+   */
+  auto gdpr_scan(std::string_view cursor, size_t count) -> std::optional<scan_page> {
+    // the keys are not encrypted
+    return scan(cursor, count);
+  }
+
+  /*
+   * Re-encrypt the stored value with the active db key if it was encrypted with an older key of the
+   * key ring (see cipher_engine::rotate_encryption_key).
+   *
+   * The re-encrypted value replaces the stored one with a compare-and-put, so a value written meanwhile
+   * (which uses the active key anyway) is never overwritten with the old one: the key is skipped instead.
+   */
+  auto gdpr_rekey(std::string_view key) -> rekey_result {
+    #ifndef ENCRYPTION_ENABLED
+      // the values are not encrypted
+      static_cast<void>(key);
+      return rekey_result::skipped;
+    #else
+      auto stored = get(key);
+      if (!stored.has_value() || m_cipher->uses_active_key(stored.value(), cipher_key_type::db_key)) {
+        return rekey_result::skipped;
+      }
+      std::string original = stored.value();
+      auto sealed = open_metadata(std::move(stored.value()));
+      if (!sealed.has_value()) {
+        std::cerr << "Error in rekey: Decryption failed for the metadata of key: " << key << std::endl;
+        return rekey_result::failed;
+      }
+      // keep the expiration of the value in the backend
+      const auto metadata = controller::decode_metadata(sealed->metadata());
+      const int64_t expiration = metadata.has_value() ? metadata->m_expiration : 0;
+      auto value = gdpr_unseal(sealed.value());
+      if (!value.has_value()) {
+        return rekey_result::failed;
+      }
+      auto ciphertext = encrypt_to_buffer(value.value());
+      if (!ciphertext.has_value()) {
+        std::cerr << "Error in rekey: Encryption failed for the value of key: " << key << std::endl;
+        return rekey_result::failed;
+      }
+      auto is_written = compare_and_put(key, original, ciphertext.value(), expiration);
+      if (!is_written.has_value()) {
+        return rekey_result::failed;
+      }
+      return is_written.value() ? rekey_result::rewritten : rekey_result::skipped;
     #endif
   }
 
@@ -102,12 +316,131 @@ public:
 protected:
   /* kv_client interface signatures */
   virtual auto get(std::string_view key) -> std::optional<std::string> = 0;
-  virtual auto put(std::string_view key, std::string_view value) -> bool = 0;
+  virtual auto put(std::string_view key, std::string_view value, int64_t expiration) -> bool = 0;
   virtual auto del(std::string_view key) -> bool = 0;
 
   virtual auto getm(std::string_view key) -> std::optional<std::string> = 0;
-  virtual auto putm(std::string_view key, std::string_view value) -> bool = 0;
+  virtual auto putm(std::string_view key, std::string_view value, int64_t expiration) -> bool = 0;
+
+  /* Batched operations, by default executed key by key */
+  virtual auto mget(std::span<const std::string_view> keys) -> std::vector<std::optional<std::string>> {
+    std::vector<std::optional<std::string>> values;
+    values.reserve(keys.size());
+    for (const auto& key : keys) {
+      values.push_back(get(key));
+    }
+    return values;
+  }
+
+  virtual auto mput(std::span<const kv_entry> entries) -> bool {
+    bool res = true;
+    for (const auto& entry : entries) {
+      res = put(entry.m_key, entry.m_value, entry.m_expiration) && res;
+    }
+    return res;
+  }
+
+  virtual auto mdel(std::span<const std::string_view> keys) -> bool {
+    bool res = true;
+    for (const auto& key : keys) {
+      res = del(key) && res;
+    }
+    return res;
+  }
+
+  /*
+   * Write the value only if the key holds the expected value, atomically with respect to the other writes.
+   * Returns whether the value was written, or nullopt if the operation failed (or is not supported).
+   */
+  virtual auto compare_and_put(std::string_view /*key*/, std::string_view /*expected*/, std::string_view /*value*/,
+                               int64_t /*expiration*/) -> std::optional<bool> {
+    std::cerr << "Compare-and-put is not supported by the backend" << std::endl;
+    return std::nullopt;
+  }
+
+  /* Delete the key only if it holds the expected value, see compare_and_put */
+  virtual auto compare_and_del(std::string_view /*key*/, std::string_view /*expected*/) -> std::optional<bool> {
+    std::cerr << "Compare-and-delete is not supported by the backend" << std::endl;
+    return std::nullopt;
+  }
+
+  /* Iteration over the keys, for the backends that support it */
+  virtual auto scan(std::string_view /*cursor*/, size_t /*count*/) -> std::optional<scan_page> {
+    std::cerr << "SCAN operation is not supported by the backend" << std::endl;
+    return std::nullopt;
+  }
 
 private:
   controller::cipher_engine* m_cipher = controller::cipher_engine::get_instance();
-};
\ No newline at end of file
+  // reusable buffer of the encrypted values, which keeps its capacity across the requests
+  std::string m_crypto_buffer;
+
+  /* Encrypt the value into m_crypto_buffer; the result is valid until the next encryption */
+  auto encrypt_to_buffer(std::string_view value) -> std::optional<std::string_view> {
+    m_crypto_buffer.resize(controller::cipher_engine::split_encrypted_size(0, value.size()));
+    auto ciphertext_len = encrypt_split(value, std::span<char>(m_crypto_buffer));
+    if (!ciphertext_len.has_value()) {
+      return std::nullopt;
+    }
+    return std::string_view(m_crypto_buffer.data(), ciphertext_len.value());
+  }
+
+  /*
+   * Encrypt the value in the split format, with its gdpr metadata prefix (if any) as the envelope.
+   * The values whose encryption metadata field is not set are non-sensitive: their value part is stored
+   * with the "none" cipher suite, so it skips the encryption here and the decryption on retrieval,
+   * while their metadata remain encrypted and authenticate it, i.e., the whole value is still hashed by GHASH.
+   */
+  auto encrypt_split(std::string_view value, std::span<char> output) -> std::optional<size_t> {
+    const auto metadata = controller::decode_metadata(value);
+    const size_t metadata_len = metadata.has_value() ? metadata->m_prefix_length : 0;
+    std::optional<cipher_suite> suite;
+    if (metadata.has_value() && !metadata->m_encryption) {
+      suite = cipher_suite::none;
+    }
+    return m_cipher->encrypt_split(value.substr(0, metadata_len), value.substr(metadata_len), cipher_key_type::db_key,
+                                   output, suite);
+  }
+
+  /*
+   * Make the metadata of the retrieved value readable: w/o encryption they are the prefix of the value,
+   * with encryption only the envelope of the split format is decrypted in place. The values stored
+   * as a single message (before the split format) are decrypted as a whole, and the ones stored
+   * before the format tag are read in the tagged format until the key rotator rewrites them.
+   */
+  auto open_metadata(std::string value) -> std::optional<sealed_value> {
+    sealed_value sealed;
+    #ifdef ENCRYPTION_ENABLED
+      controller::cipher_engine::upgrade_legacy_ciphertext(value);
+      auto envelope_size = controller::cipher_engine::message_size(value);
+      if (!envelope_size.has_value()) {
+        return std::nullopt;
+      }
+      if (envelope_size.value() < value.size()) {
+        auto metadata_len = m_cipher->decrypt_split_envelope(
+            value, envelope_size.value(), cipher_key_type::db_key,
+            std::span<char>(value).subspan(controller::ciphertext_header_len));
+        if (!metadata_len.has_value()) {
+          return std::nullopt;
+        }
+        sealed.m_buffer = std::move(value);
+        sealed.m_metadata_offset = controller::ciphertext_header_len;
+        sealed.m_metadata_len = metadata_len.value();
+        sealed.m_envelope_size = envelope_size.value();
+        // a value part in plaintext is only accepted for the values their metadata mark as non-sensitive
+        const std::string_view value_message = std::string_view(sealed.m_buffer).substr(sealed.m_envelope_size);
+        if (controller::cipher_engine::ciphertext_suite(value_message) == cipher_suite::none) {
+          const auto metadata = controller::decode_metadata(sealed.metadata());
+          sealed.m_non_sensitive = metadata.has_value() && !metadata->m_encryption;
+        }
+        return sealed;
+      }
+      if (!m_cipher->decrypt_in_place(value, cipher_key_type::db_key)) {
+        return std::nullopt;
+      }
+    #endif
+    sealed.m_metadata_len = controller::metadata_prefix_length(value);
+    sealed.m_buffer = std::move(value);
+    return sealed;
+  }
+};
@@ -1,4 +1,6 @@
+#include <charconv>
 #include <iostream>
+#include <iterator>
 #include <string>
 
 #include <sw/redis++/redis++.h>
@@ -31,13 +33,15 @@ public:
     return std::move(result);
   }
 
-  inline auto put(std::string_view key, std::string_view value) -> bool override
+  inline auto put(std::string_view key, std::string_view value, int64_t expiration) -> bool override
   {
     bool res = true;
     auto result = m_redis.set(key, value);
     if (result) {
       // std::cout << "PUT operation done with key: " << key
       //           << " and value: " << value << std::endl;
+      // SET discards any previous expiration, so it is set again on every put
+      set_expiration(key, expiration);
     } else {
       // std::cout << "PUT operation failed" << std::endl;
       res = false;
@@ -78,13 +82,14 @@ public:
     return result;
   }
 
-  auto putm(std::string_view key, std::string_view value) -> bool override
+  auto putm(std::string_view key, std::string_view value, int64_t expiration) -> bool override
   {
     bool res = true;
     auto result = m_redis.set(key, value);
     if (result) {
       // std::cout << "PUTM operation done with key: " << key
       //           << " and value: " << value << std::endl;
+      set_expiration(key, expiration);
     } else {
       // std::cout << "PUTM operation failed" << std::endl;
       res = false;
@@ -92,4 +97,61 @@ public:
     return res;
   }
 
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  auto compare_and_put(std::string_view key, std::string_view expected, std::string_view value,
+                       int64_t expiration) -> std::optional<bool> override
+  {
+    // redis runs the scripts atomically, so no other command runs between the GET and the SET
+    static constexpr std::string_view compare_and_put_script =
+      "if redis.call('GET', KEYS[1]) ~= ARGV[1] then return 0 end "
+      "redis.call('SET', KEYS[1], ARGV[2]) "
+      "if ARGV[3] ~= '0' then redis.call('EXPIREAT', KEYS[1], ARGV[3]) end "
+      "return 1";
+    const std::string expiration_arg = std::to_string(expiration);
+    try {
+      return m_redis.eval<long long>(compare_and_put_script, {key}, {expected, value, expiration_arg}) == 1;
+    } catch (const sw::redis::Error& error) {
+      std::cerr << "Compare-and-put operation failed: " << error.what() << std::endl;
+      return std::nullopt;
+    }
+  }
+
+  auto compare_and_del(std::string_view key, std::string_view expected) -> std::optional<bool> override
+  {
+    static constexpr std::string_view compare_and_del_script =
+      "if redis.call('GET', KEYS[1]) ~= ARGV[1] then return 0 end "
+      "return redis.call('DEL', KEYS[1])";
+    try {
+      return m_redis.eval<long long>(compare_and_del_script, {key}, {expected}) == 1;
+    } catch (const sw::redis::Error& error) {
+      std::cerr << "Compare-and-delete operation failed: " << error.what() << std::endl;
+      return std::nullopt;
+    }
+  }
+
+  auto scan(std::string_view cursor, size_t count) -> std::optional<scan_page> override
+  {
+    // the cursor of redis is an integer, 0 both for the first page and once the scan is complete
+    long long redis_cursor = 0;
+    if (!cursor.empty() && std::from_chars(cursor.data(), cursor.data() + cursor.size(), redis_cursor).ec != std::errc()) {
+      std::cerr << "SCAN operation failed -- invalid cursor " << cursor << std::endl;
+      return std::nullopt;
+    }
+    scan_page page;
+    redis_cursor = m_redis.scan(redis_cursor, static_cast<long long>(count), std::back_inserter(page.m_keys));
+    if (redis_cursor != 0) {
+      page.m_cursor = std::to_string(redis_cursor);
+    }
+    return page;
+  }
+
+private:
+  /* let redis evict the key at its absolute expiration time (in seconds) */
+  auto set_expiration(std::string_view key, int64_t expiration) -> void
+  {
+    if (expiration != 0) {
+      m_redis.expireat(key, expiration);
+    }
+  }
+
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <vector>
 
 #include <boost/algorithm/string.hpp>
@@ -29,9 +31,8 @@ public:
   auto get(std::string_view key) -> std::optional<std::string> override
   {
     query_message query;
-    query.set_command("get");
+    query.set_opcode(message_opcode::get);
     query.set_key(key);
-    query.set_is_valid(/*is_valid*/true);
 
     response_message response = execute(query);
     if (response.op_is_successful()) {
@@ -44,13 +45,13 @@ public:
 
   // To suppress bugprone-easily-swappable-parameters warning from clang-tidy
   // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-  auto put(std::string_view key, std::string_view value) -> bool override
+  auto put(std::string_view key, std::string_view value, int64_t expiration) -> bool override
   {
     query_message query;
-    query.set_command("put");
+    query.set_opcode(message_opcode::put);
     query.set_key(key);
+    query.set_expiration(expiration);
     query.set_value(value);
-    query.set_is_valid(/*is_valid*/true);
 
     response_message response = execute(query);
     // std::cout << "PUT operation request Key: " << key << std::endl;
@@ -65,9 +66,8 @@ public:
   auto del(std::string_view key) -> bool override
   {
     query_message query;
-    query.set_command("del");
+    query.set_opcode(message_opcode::del);
     query.set_key(key);
-    query.set_is_valid(/*is_valid*/true);
 
     response_message response = execute(query);
     // if (response.op_is_successful()) {
@@ -81,9 +81,8 @@ public:
   auto getm(std::string_view key) -> std::optional<std::string> override
   {
     query_message query;
-    query.set_command("getm");
+    query.set_opcode(message_opcode::getm);
     query.set_key(key);
-    query.set_is_valid(/*is_valid*/true);
 
     response_message response = execute(query);
     if (response.op_is_successful()) {
@@ -94,42 +93,174 @@ public:
     return std::nullopt;
   }
 
-  auto putm(std::string_view key, std::string_view value) -> bool override
+  auto putm(std::string_view key, std::string_view value, int64_t expiration) -> bool override
   {
     query_message query;
-    query.set_command("putm");
+    query.set_opcode(message_opcode::putm);
     query.set_key(key);
+    query.set_expiration(expiration);
     query.set_value(value);
-    query.set_is_valid(/*is_valid*/true);
 
     response_message response = execute(query);
     return response.op_is_successful();
   }
 
-private:
-  boost::asio::io_context m_io_context;
-  boost::asio::ip::tcp::socket m_socket;
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  auto compare_and_put(std::string_view key, std::string_view expected, std::string_view value,
+                       int64_t expiration) -> std::optional<bool> override
+  {
+    m_batch_buffer.clear();
+    append_compare_and_put_value(m_batch_buffer, expected, value);
+    query_message query;
+    query.set_opcode(message_opcode::cput);
+    query.set_key(key);
+    query.set_expiration(expiration);
+    query.set_value(m_batch_buffer);
+
+    response_message response = execute(query);
+    if (!response.op_is_successful()) {
+      return std::nullopt;
+    }
+    return response.get_data() == "\x01";
+  }
+
+  auto compare_and_del(std::string_view key, std::string_view expected) -> std::optional<bool> override
+  {
+    query_message query;
+    query.set_opcode(message_opcode::cdel);
+    query.set_key(key);
+    query.set_value(expected);
+
+    response_message response = execute(query);
+    if (!response.op_is_successful()) {
+      return std::nullopt;
+    }
+    return response.get_data() == "\x01";
+  }
 
-  auto execute(query_message query) -> response_message
+  auto mget(std::span<const std::string_view> keys) -> std::vector<std::optional<std::string>> override
   {
-    std::string raw_query = query.serialize();
+    m_batch_buffer.clear();
+    for (const auto& key : keys) {
+      append_batch_entry(m_batch_buffer, key);
+    }
+    query_message query;
+    query.set_opcode(message_opcode::mget);
+    query.set_value(m_batch_buffer);
+
+    response_message response = execute(query);
+    if (response.op_is_successful()) {
+      auto values = parse_batch_results(response.get_data(), keys.size());
+      if (values.has_value()) {
+        return std::move(values.value());
+      }
+      std::cerr << "MGET operation returned malformed results" << std::endl;
+    }
+    return std::vector<std::optional<std::string>>(keys.size());
+  }
+
+  auto mput(std::span<const kv_entry> entries) -> bool override
+  {
+    m_batch_buffer.clear();
+    for (const auto& entry : entries) {
+      append_batch_entry(m_batch_buffer, entry.m_key, entry.m_value, entry.m_expiration);
+    }
+    query_message query;
+    query.set_opcode(message_opcode::mput);
+    query.set_value(m_batch_buffer);
+
+    response_message response = execute(query);
+    return response.op_is_successful();
+  }
 
-    // Prepend message size to query
-    int message_size = static_cast<int>(raw_query.size());
+  auto mdel(std::span<const std::string_view> keys) -> bool override
+  {
+    m_batch_buffer.clear();
+    for (const auto& key : keys) {
+      append_batch_entry(m_batch_buffer, key);
+    }
+    query_message query;
+    query.set_opcode(message_opcode::mdel);
+    query.set_value(m_batch_buffer);
+
+    response_message response = execute(query);
+    return response.op_is_successful();
+  }
+
+  auto scan(std::string_view cursor, size_t count) -> std::optional<scan_page> override
+  {
+    const auto page_size = static_cast<uint32_t>(std::min<size_t>(count, UINT32_MAX));
     // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    raw_query.insert(0, reinterpret_cast<const char*>(&message_size), sizeof(int));
+    m_batch_buffer.assign(reinterpret_cast<const char*>(&page_size), sizeof(page_size));
+    query_message query;
+    query.set_opcode(message_opcode::scan);
+    query.set_key(cursor);
+    query.set_value(m_batch_buffer);
+
+    response_message response = execute(query);
+    if (!response.op_is_successful()) {
+      return std::nullopt;
+    }
+    const std::string raw_keys = response.get_data();
+    std::vector<batch_entry> entries;
+    if (!parse_batch_entries(raw_keys, entries)) {
+      std::cerr << "SCAN operation returned malformed keys" << std::endl;
+      return std::nullopt;
+    }
+    scan_page page;
+    page.m_keys.reserve(entries.size());
+    for (const auto& entry : entries) {
+      page.m_keys.emplace_back(entry.m_key);
+    }
+    // a partial page is the last one
+    if (entries.size() == page_size && !entries.empty()) {
+      page.m_cursor = page.m_keys.back();
+    }
+    return page;
+  }
 
-    // Send query
-    boost::asio::write(m_socket, boost::asio::buffer(raw_query));
+  /* Statistics of the rocksdb_server as text (latency histograms and rocksdb statistics) */
+  auto stats() -> std::optional<std::string>
+  {
+    query_message query;
+    query.set_opcode(message_opcode::stats);
+
+    response_message response = execute(query);
+    if (response.op_is_successful()) {
+      return response.get_data();
+    }
+    return std::nullopt;
+  }
+
+private:
+  boost::asio::io_context m_io_context;
+  boost::asio::ip::tcp::socket m_socket;
+
+  // reusable buffer for the received responses
+  std::vector<char> m_response_buffer;
+  // reusable buffer for the entries of the multi-key requests
+  std::string m_batch_buffer;
+
+  auto execute(const query_message& query) -> response_message
+  {
+    // Send the length, the header, the key and the value as one gathered write (no query copy)
+    const request_header header = query.serialize_header();
+    auto message_size = static_cast<uint32_t>(sizeof(header) + query.get_key().size() + query.get_value().size());
+    const std::array<boost::asio::const_buffer, 4> query_buffers {
+      boost::asio::buffer(&message_size, message_length_size),
+      boost::asio::buffer(&header, sizeof(header)),
+      boost::asio::buffer(query.get_key().data(), query.get_key().size()),
+      boost::asio::buffer(query.get_value().data(), query.get_value().size())
+    };
+    boost::asio::write(m_socket, query_buffers);
 
     // Receive response size
-    int response_size = 0;
-    boost::asio::read(m_socket, boost::asio::buffer(&response_size, sizeof(int)));
+    uint32_t response_size = 0;
+    boost::asio::read(m_socket, boost::asio::buffer(&response_size, message_length_size));
 
     // Receive response
-    std::vector<char> response_buffer(static_cast<size_t>(response_size));
-    boost::asio::read(m_socket, boost::asio::buffer(response_buffer));
-    std::string raw_response(response_buffer.begin(), response_buffer.end());
-    return response_message::deserialize(raw_response);
+    m_response_buffer.resize(response_size);
+    boost::asio::read(m_socket, boost::asio::buffer(m_response_buffer));
+    return response_message::deserialize(m_response_buffer);
   }
 };
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
 #include <filesystem>
+#include <string_view>
 #include <cstring>
+#include <iostream>
 #include <sys/resource.h>
 
 #include "../common.hpp"
@@ -16,7 +19,9 @@ const unsigned int operation_mask = 0x07U;
 constexpr double fd_load_factor = 0.8;
 
 /**
- * Query operations enum.
+ * Query operations enum, i.e., the opcodes that the query parser produces and
+ * that the controllers and the logger share.
+ * The logs encode the operation in 3 bits, so the logged operations stay below 8.
 */
 enum operation : uint8_t {
   invalid = 0U,
@@ -25,59 +30,56 @@ enum operation : uint8_t {
   del = 3U,
   getm = 4U,
   putm = 5U,
-  get_logs = 6U
+  get_logs = 6U,
+  get_keys = 7U,
+  count_keys = 8U,
+  quit = 9U,
+  prepare = 10U,
+  execute = 11U
+};
+constexpr size_t num_operations = 12;
+static_assert(operation::get_logs <= operation_mask, "the logged operations must fit in the operation bits");
+
+/* The command names of the query predicate, indexed by operation (lowercase, matched case-insensitively) */
+constexpr std::array<std::string_view, num_operations> operation_names = {
+  "invalid",
+  "get",
+  "put",
+  "delete",
+  "getm",
+  "putm",
+  "getlogs",
+  "getkeys",
+  "countkeys",
+  "exit",
+  "prepare",
+  "exec"
 };
 
 /**
  * Converts operation string to respective enum.
 */
-inline auto convert_operation_to_enum(std::string_view oper) -> operation {
-  if (oper == "get") {
-    return operation::get;
-  }
-  if (oper == "put") {
-    return operation::put;
-  }
-  if (oper == "delete") {
-    return operation::del;
-  }
-  if (oper == "getm") {
-    return operation::getm;
-  }
-  if (oper == "putm") {
-    return operation::putm;
-  }
-  if (oper == "getLogs") {
-    return operation::get_logs;
+constexpr auto convert_operation_to_enum(std::string_view oper) -> operation {
+  for (size_t oper_id = 1; oper_id < num_operations; oper_id++) {
+    if (equals_ignore_case(oper, operation_names[oper_id])) {
+      return static_cast<operation>(oper_id);
+    }
   }
   // Invalid case
   return operation::invalid;
 }
 
 /**
- * Converts the enum to its respective operation string.
+ * Converts the enum to its respective operation string, as printed in the logs.
 */
-inline auto convert_enum_to_operation(const operation oper) -> std::string  {
-  if (oper == operation::get) {
-    return "get";
-  }
-  if (oper == operation::put) {
-    return "put";
-  }
-  if (oper == operation::del) {
-    return "delete";
-  }
-  if (oper == operation::getm) {
-    return "getm";
-  }
-  if (oper == operation::putm) {
-    return "putm";
-  }
+constexpr auto convert_enum_to_operation(const operation oper) -> std::string_view {
   if (oper == operation::get_logs) {
     return "getLogs";
   }
-  // Invalid case
-  return "invalid_op";
+  if (oper == operation::invalid || oper >= num_operations) {
+    return "invalid_op";
+  }
+  return operation_names[oper];
 }
 
 /*
@@ -97,72 +99,6 @@ inline auto timestamp_to_datetime(int64_t timestamp) -> std::string {
   return time_stream.str();
 }
 
-/*
- * Convert encoded gdpr metadata to human readable string for regulator output
- */
-inline auto gdpr_metadata_fmt(std::string_view value_str) -> std::string {
-  std::string res;
-  res.reserve(value_str.length());  // Reserve space to avoid reallocations
-
-  size_t start = 0;
-  size_t end = 0;
-  int count = 0;
-
-  while (count < max_gdpr_field_guard && (end = value_str.find('|', start)) != std::string_view::npos) {
-    std::string_view token = value_str.substr(start, end - start);
-
-    switch (count) {
-      case usr: 
-        res.append("User/Owner: ").append(token).append(", ");
-        break;
-      case encr:
-        res.append("Encryption enabled: ").append(token == "1" ? "true" : "false").append(", ");
-        break;
-      case pur:
-        {
-          auto purposes = std::bitset<num_purposes>(std::stoull(std::string(token)));
-          res.append("Purposes: ").append(get_purposes_string(purposes));
-          break;
-        }
-      case obj:
-        {
-          auto objections = std::bitset<num_purposes>(std::stoull(std::string(token)));
-          res.append("Objections: ").append(get_purposes_string(objections));
-          break;
-        }
-      case org:
-        res.append("Data origin: ").append(token).append(", ");
-        break;
-      case exp:
-        {
-          std::string_view expire_time = (token == "0") ?
-              "none" : timestamp_to_datetime(std::stoi(std::string(token)));
-          res.append("Expiration time: ").append(expire_time).append(", ");
-          break;
-        }
-      case shr:
-        res.append("Shared with: ").append(token).append(", ");
-        break;
-      case log:
-        res.append("Log enabled: ").append(token == "1" ? "true" : "false").append(", ");
-        break;
-      case val:
-        res.append("Value: ").append(token);
-        break;
-      default:
-        break;
-    }
-    start = end + 1;
-    count++;
-  }
-
-  if (count != max_gdpr_field_guard) {
-    throw std::invalid_argument("Invalid GDPR metadata format in the logs");
-  }
-
-  return std::move(res);
-}
-
 /*
  * Get the maximum number of file descriptors allowed for the current process
  */
@@ -10,16 +10,48 @@
 #include <vector>
 #include <cassert>
 #include <cmath>
+#include <span>
 #include <string_view>
+#include <optional>
 
 #include "log_common.hpp"
 #include "../gdpr_filter.hpp"
+#include "../metadata_resolver.hpp"
+#include "../purpose_registry.hpp"
 #include "../query.hpp"
 
 #include "../encryption/cipher_engine.hpp"
 
 namespace controller {
 
+/*
+ * Convert encoded gdpr metadata to human readable string for regulator output
+ */
+inline auto gdpr_metadata_fmt(std::string_view value_str) -> std::string {
+  // the logged values carry their metadata in the binary or in the legacy text format
+  auto metadata = decode_metadata(value_str);
+  if (!metadata) {
+    throw std::invalid_argument("Invalid GDPR metadata format in the logs");
+  }
+
+  std::string res;
+  res.reserve(value_str.length());  // Reserve space to avoid reallocations
+
+  res.append("User/Owner: ").append(user_dictionary::get_instance()->user_key(metadata->m_owner)).append(", ");
+  res.append("Encryption enabled: ").append(metadata->m_encryption ? "true" : "false").append(", ");
+  res.append("Purposes: ").append(get_purposes_string(metadata->m_purpose));
+  res.append("Objections: ").append(get_purposes_string(metadata->m_objection));
+  res.append("Data origin: ").append(metadata->m_origin).append(", ");
+  const std::string expire_time = (metadata->m_expiration == 0) ?
+      "none" : timestamp_to_datetime(metadata->m_expiration);
+  res.append("Expiration time: ").append(expire_time).append(", ");
+  res.append("Shared with: ").append(get_share_list(metadata.value())).append(", ");
+  res.append("Log enabled: ").append(metadata->m_monitor ? "true" : "false").append(", ");
+  res.append("Value: ").append(value_str.substr(metadata->m_prefix_length));
+
+  return std::move(res);
+}
+
 /**
  * Singleton logger class to store the history of each pair in a different file.
 */
@@ -59,7 +91,7 @@ public:
     // timestamp,user_key,operation,operation_result,new_value(if applicable)
     *log_file << std::chrono::system_clock::now().time_since_epoch().count() << ","
               << query_args.user_key().value_or(def_policy.user_key()) << ","
-              << convert_operation_to_enum(query_args.cmd()) << ","
+              << query_args.opcode() << ","
               << result << ","
               << new_val << std::endl;
   }
@@ -86,7 +118,7 @@ public:
     // Encode the user key as a string
     std::string_view user_key = query_args.user_key().value_or(def_policy.user_key());
     // Encode the operation type (3bits) and the operation result (1 bit) as a single byte
-    const uint8_t operation = static_cast<uint8_t>((convert_operation_to_enum(query_args.cmd()) & operation_mask) << 1U);
+    const uint8_t operation = static_cast<uint8_t>((query_args.opcode() & operation_mask) << 1U);
     const uint8_t valid_bit = (valid ? 0x01U : 0x00U);
     const uint8_t operation_result = operation | valid_bit;
     // Calculate the total size of the entry
@@ -95,15 +127,22 @@ public:
                         sizeof(operation_result) + new_val.length() + 
                         3 * sizeof(log_delimiter);
 
-    // Allocate an array buffer to hold the encoded entry
-    std::vector<char> buffer(entry_size);
+    // Reusable (per thread) buffer to hold the encoded entry. With encryption, the entry is encoded
+    // after the room for the ciphertext header and then encrypted in place
+    thread_local std::vector<char> buffer;
+    #ifndef ENCRYPTION_ENABLED
+    const size_t entry_offset = 0;
+    #else
+    const size_t entry_offset = ciphertext_header_len;
+    #endif
+    buffer.resize(entry_offset + entry_size);
 
     // Check if buffer is null
     if (buffer.data() == nullptr) [[unlikely]] {
       return;
     }
     
-    size_t offset = 0;
+    size_t offset = entry_offset;
     // Encode the timestamp entry
     memcpy(&buffer[offset], &timestamp, sizeof(timestamp));
     offset += sizeof(timestamp);
@@ -134,17 +173,16 @@ public:
     // Write the encoded entry to the log file
     log_file->write(buffer.data(), static_cast<std::streamsize>(entry_size));
     #else
-    // important: pass buffer.begin() and buffer.end() as encrypt will look for 
+    // important: pass the entry with its size as encrypt will look for
     // null termination character otherwise
-    auto encrypt_result = m_cipher->encrypt(std::string_view(buffer.data(), buffer.size()),
-                                            cipher_key_type::log_key);
-    if (encrypt_result.m_success) {
+    auto ciphertext_len = m_cipher->encrypt(std::string_view(buffer.data() + entry_offset, entry_size),
+                                            cipher_key_type::log_key, std::span<char>(buffer));
+    if (ciphertext_len.has_value()) {
       // Write the encrypted entry size to the log file
-      entry_size = encrypt_result.m_ciphertext.size();
+      entry_size = ciphertext_len.value();
       // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
       log_file->write(reinterpret_cast<const char*>(&entry_size), sizeof(entry_size));
-      log_file->write(encrypt_result.m_ciphertext.data(),
-                      static_cast<std::streamsize>(encrypt_result.m_ciphertext.size()));
+      log_file->write(buffer.data(), static_cast<std::streamsize>(entry_size));
     }
     else {
       std::cerr << "Error in writing log entry: Encryption failed" << std::endl;
@@ -194,6 +232,95 @@ public:
     return entries;
   }
 
+  /*
+   * Re-encrypts the entries of the log file that use an older key than the active log key.
+   * The file is rewritten into a temporary file that replaces it, under the mutex of its key,
+   * so the concurrent appends wait for the rewrite and then go to the new file.
+   * Returns the number of re-encrypted entries, or nullopt if the file could not be re-encrypted.
+   */
+  auto reencrypt_log(std::string_view log_name) -> std::optional<size_t> {
+    #ifndef ENCRYPTION_ENABLED
+    // the entries are not encrypted
+    static_cast<void>(log_name);
+    return 0;
+    #else
+    const std::filesystem::path log_path(log_name);
+    if (!std::filesystem::is_regular_file(log_path)) {
+      return 0;
+    }
+    std::string key = extract_key_from_filename(log_name);
+    auto log_file = get_or_open_log_stream(key);
+
+    // lock the mutex corresponding to the key
+    std::lock_guard<std::mutex> lock(m_keys_to_mutexes[key]);
+    if (!log_file->is_open()) {
+      log_file = get_or_open_log_stream(key);
+    }
+    log_file->flush();
+    log_file->seekg(0, std::ios::beg);
+
+    std::string rewritten;
+    size_t reencrypted = 0;
+    bool complete = true;
+    size_t entry_size = 0;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    while (log_file->read(reinterpret_cast<char*>(&entry_size), sizeof(entry_size))) {
+      std::vector<char> entry = read_log_entry(log_file, entry_size);
+      if (!*log_file) {
+        complete = false;
+        break;
+      }
+      std::string_view ciphertext(entry.data(), entry.size());
+      encrypt_result reencrypted_entry {{}, /*success*/ true};
+      if (!m_cipher->uses_active_key(ciphertext, cipher_key_type::log_key)) {
+        auto decrypted_entry = m_cipher->decrypt(ciphertext, cipher_key_type::log_key);
+        if (decrypted_entry.m_success) {
+          reencrypted_entry = m_cipher->encrypt(decrypted_entry.m_plaintext, cipher_key_type::log_key);
+        }
+        if (!decrypted_entry.m_success || !reencrypted_entry.m_success) {
+          complete = false;
+          break;
+        }
+        ciphertext = reencrypted_entry.m_ciphertext;
+        reencrypted++;
+      }
+      entry_size = ciphertext.size();
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      rewritten.append(reinterpret_cast<const char*>(&entry_size), sizeof(entry_size));
+      rewritten.append(ciphertext);
+    }
+    log_file->clear();
+    log_file->seekp(0, std::ios::end);
+    if (!complete) {
+      std::cerr << "Error: Failed to re-encrypt " << log_name << ", it is left unchanged." << std::endl;
+      return std::nullopt;
+    }
+    if (reencrypted == 0) {
+      return 0;
+    }
+
+    // replace the file and reopen the same stream, which the appends of the key hold on to
+    const std::filesystem::path tmp_path = log_path.string() + ".tmp";
+    {
+      std::ofstream tmp_file(tmp_path, std::ios::binary | std::ios::trunc);
+      tmp_file.write(rewritten.data(), static_cast<std::streamsize>(rewritten.size()));
+      if (!tmp_file.flush()) {
+        std::cerr << "Error: Failed to write " << tmp_path << std::endl;
+        return std::nullopt;
+      }
+    }
+    log_file->close();
+    std::error_code error;
+    std::filesystem::rename(tmp_path, log_path, error);
+    log_file->open(log_path, std::ios::in | std::ios::out | std::ios::app);
+    if (error) {
+      std::cerr << "Error: Failed to replace " << log_name << ": " << error.message() << std::endl;
+      return std::nullopt;
+    }
+    return reencrypted;
+    #endif
+  }
+
   auto get_logs_dir() -> std::string_view {
     return std::string_view(this->m_logs_dir);
   }
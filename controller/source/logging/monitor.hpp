@@ -16,9 +16,9 @@ public:
    * Generic constructor when a value is retrieved
    * Action: Check the current gdpr metadata
    */ 
-  gdpr_monitor(std::shared_ptr<gdpr_filter> filter, const query& query_args, const default_policy& def_policy): 
-    m_filter{std::move(filter)}, m_query_args{query_args}, m_def_policy{def_policy}, 
-    m_history_logger{logger::get_instance()}, m_monitor_needed{m_filter->check_monitoring()} 
+  gdpr_monitor(const gdpr_filter& filter, const query& query_args, const default_policy& def_policy): 
+    m_query_args{query_args}, m_def_policy{def_policy}, 
+    m_history_logger{logger::get_instance()}, m_monitor_needed{filter.check_monitoring()} 
   {
   }
   /* 
@@ -27,7 +27,7 @@ public:
    * Action: Check the query args & then the default policy
    */ 
   gdpr_monitor(const query& query_args, const default_policy& def_policy): 
-    m_filter{nullptr}, m_query_args{query_args}, m_def_policy{def_policy}, 
+    m_query_args{query_args}, m_def_policy{def_policy}, 
     m_history_logger{logger::get_instance()}
   {
     m_monitor_needed = m_query_args.monitor().value_or(m_def_policy.monitor());
@@ -38,13 +38,14 @@ public:
    * Action: It's current gdpr metadata except from the transition from false to true based on query args
    * callable as: gdpr_monitor(filter, query_args, def_policy, controller::gdpr_monitor::putm_monitor_t{});
    */ 
-  gdpr_monitor(std::shared_ptr<gdpr_filter> filter, const query& query_args,
+  gdpr_monitor(const gdpr_filter& filter, const query& query_args,
               const default_policy& def_policy, putm_monitor_t /*unused*/): 
-    m_filter{std::move(filter)}, m_query_args{query_args}, 
+    m_query_args{query_args}, 
     m_def_policy{def_policy}, m_history_logger{logger::get_instance()} 
   {
-    m_monitor_needed = (!m_filter->check_monitoring() && m_query_args.monitor().value_or(false)) ?
-                        m_query_args.monitor().value() : m_filter->check_monitoring();      
+    const bool monitored = filter.check_monitoring();
+    m_monitor_needed = (!monitored && m_query_args.monitor().value_or(false)) ?
+                        m_query_args.monitor().value() : monitored;
   }
 
   void monitor_query(const bool& valid, std::string_view new_val = {}) {
@@ -54,8 +55,6 @@ public:
   }
 
 private:
-  std::shared_ptr<gdpr_filter> m_filter;
-
   const query& m_query_args;
 
   const default_policy& m_def_policy;
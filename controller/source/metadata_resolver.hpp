@@ -0,0 +1,411 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "gdpr_metadata.hpp"
+#include "index/policy_store.hpp"
+#include "index/user_dictionary.hpp"
+
+namespace controller {
+
+/*
+ * The GDPR metadata of the stored values, resolved against the stores of the controller: the user
+ * ids of the user_dictionary and the policy records of the policy_store. The encoding itself is in
+ * gdpr_metadata.hpp, which does not depend on the stores.
+ */
+
+/*
+ * How the user keys of the legacy formats and of the share lists are mapped to ids: the reads
+ * only look them up, the writes assign the ids of the new users (see user_dictionary).
+ */
+enum class user_lookup {
+  find,
+  assign
+};
+
+/*
+ * The id of the user key, or unknown_user if the lookup does not assign it.
+ * Returns std::nullopt if the id of a new user cannot be persisted, see user_dictionary.
+ */
+auto inline resolve_user(std::string_view user_key, user_lookup lookup) -> std::optional<uint32_t> {
+  auto *dictionary = user_dictionary::get_instance();
+  if (lookup == user_lookup::assign) {
+    return dictionary->get_or_assign_id(user_key);
+  }
+  return dictionary->find_id(user_key).value_or(unknown_user);
+}
+
+/*
+ * Replace the share list of the metadata with the users of the comma-separated list.
+ * W/o assignment, the users that have no id are left out, as the value cannot be shared with them.
+ * Returns false if the id of a user cannot be persisted: the metadata must not be stored then.
+ */
+auto inline set_share_list(gdpr_metadata& metadata, std::string_view share_list,
+                           user_lookup lookup = user_lookup::assign) -> bool {
+  metadata.m_share.reset();
+  metadata.m_share_overflow.clear();
+  size_t start = 0;
+  while (start <= share_list.size()) {
+    size_t end = share_list.find(',', start);
+    if (end == std::string_view::npos) {
+      end = share_list.size();
+    }
+    const std::string_view user_key = share_list.substr(start, end - start);
+    if (!user_key.empty()) {
+      const auto resolved = resolve_user(user_key, lookup);
+      if (!resolved.has_value()) {
+        return false;
+      }
+      const uint32_t user_id = resolved.value();
+      if (user_id < num_users) {
+        metadata.m_share.set(user_id);
+      } else if (user_id != unknown_user &&
+                 std::find(metadata.m_share_overflow.begin(), metadata.m_share_overflow.end(), user_id) ==
+                 metadata.m_share_overflow.end()) {
+        metadata.m_share_overflow.push_back(user_id);
+      }
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+/* The comma-separated user keys of the share list of the metadata */
+auto inline get_share_list(const gdpr_metadata& metadata) -> std::string {
+  auto *dictionary = user_dictionary::get_instance();
+  std::string share_list;
+  const auto append_user = [&](uint32_t user_id) {
+    if (!share_list.empty()) {
+      share_list.append(1, ',');
+    }
+    share_list.append(dictionary->user_key(user_id));
+  };
+  for (uint32_t user_id = 0; user_id < num_users; user_id++) {
+    if (metadata.m_share.test(user_id)) {
+      append_user(user_id);
+    }
+  }
+  for (const uint32_t user_id : metadata.m_share_overflow) {
+    append_user(user_id);
+  }
+  return share_list;
+}
+
+/**
+ * Appends the metadata as a reference to their policy record (the metadata w/o the expiration
+ * time), which is stored on its first use; or inline, if the record cannot be stored.
+ */
+auto inline append_metadata_reference(std::string& output, const gdpr_metadata& metadata) -> void {
+  thread_local std::string policy;
+  policy.clear();
+  append_metadata(policy, metadata);
+  const int64_t no_expiration = 0;
+  std::memcpy(policy.data() + offsetof(metadata_header, m_expiration), &no_expiration, sizeof(no_expiration));
+  auto policy_id = policy_store::get_instance()->intern(policy);
+  if (!policy_id.has_value()) {
+    append_metadata(output, metadata);
+    return;
+  }
+  metadata_reference reference;
+  reference.m_policy_id = policy_id.value();
+  reference.m_expiration = metadata.m_expiration;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  output.append(reinterpret_cast<const char*>(&reference), sizeof(reference));
+}
+
+/* Decodes the binary prefix: a reference to a policy record, the inline metadata or version 1 */
+auto inline decode_binary_metadata(std::string_view value, user_lookup lookup = user_lookup::find)
+    -> std::optional<gdpr_metadata> {
+  const size_t prefix_length = metadata_prefix_length(value);
+  if (prefix_length == 0) {
+    return std::nullopt;
+  }
+  if (static_cast<uint8_t>(value[1]) == metadata_version_policy) {
+    metadata_reference reference;
+    std::memcpy(&reference, value.data(), sizeof(reference));
+    auto policy = policy_store::get_instance()->find(reference.m_policy_id);
+    if (!policy.has_value() || !is_inline_metadata(policy.value())) {
+      return std::nullopt;
+    }
+    // the strings of the metadata are views into the policy record, which remains in place
+    auto metadata = decode_binary_metadata(policy.value());
+    if (metadata.has_value()) {
+      metadata->m_expiration = reference.m_expiration;
+      metadata->m_prefix_length = prefix_length;
+    }
+    return metadata;
+  }
+  if (static_cast<uint8_t>(value[1]) == metadata_version_user_keys) {
+    gdpr_metadata metadata;
+    metadata.m_prefix_length = prefix_length;
+    metadata_header_v1 header;
+    std::memcpy(&header, value.data(), sizeof(header));
+    size_t offset = sizeof(header);
+    const auto owner = resolve_user(value.substr(offset, header.m_user_key_length), lookup);
+    offset += header.m_user_key_length;
+    metadata.m_origin = value.substr(offset, header.m_origin_length);
+    offset += header.m_origin_length;
+    if (!owner.has_value() || !set_share_list(metadata, value.substr(offset, header.m_share_length), lookup)) {
+      return std::nullopt;
+    }
+    metadata.m_owner = owner.value();
+    metadata.m_encryption = (header.m_flags & metadata_flag_encryption) != 0;
+    metadata.m_monitor = (header.m_flags & metadata_flag_monitor) != 0;
+    metadata.m_purpose = purpose_bitmap(header.m_purpose);
+    metadata.m_objection = purpose_bitmap(header.m_objection);
+    metadata.m_expiration = header.m_expiration;
+    return metadata;
+  }
+  return decode_inline_metadata(value, prefix_length);
+}
+
+/* Decodes the legacy text prefix "<usr>|<encr>|<pur>|<obj>|<org>|<exp>|<shr>|<log>|" */
+auto inline decode_text_metadata(std::string_view value, user_lookup lookup = user_lookup::find)
+    -> std::optional<gdpr_metadata> {
+  gdpr_metadata metadata;
+  // the user keys are mapped to ids once the whole prefix is parsed
+  std::string_view user_key;
+  std::string_view share_list;
+  size_t start = 0;
+  for (int field = 0; field < metadata_prefix_fields; field++) {
+    const size_t end = value.find('|', start);
+    if (end == std::string_view::npos) {
+      return std::nullopt;
+    }
+    const std::string_view token = value.substr(start, end - start);
+    bool parsed = true;
+    switch (field) {
+      case usr:
+        user_key = token;
+        break;
+      case encr:
+        metadata.m_encryption = (token == "1");
+        break;
+      case pur:
+        parsed = parse_purpose_bitmap(token, metadata.m_purpose);
+        break;
+      case obj:
+        parsed = parse_purpose_bitmap(token, metadata.m_objection);
+        break;
+      case org:
+        metadata.m_origin = token;
+        break;
+      case exp:
+        parsed = parse_metadata_integer(token, metadata.m_expiration);
+        break;
+      case shr:
+        share_list = token;
+        break;
+      case log:
+        metadata.m_monitor = (token == "1");
+        break;
+      default:
+        break;
+    }
+    if (!parsed) {
+      return std::nullopt;
+    }
+    start = end + 1;
+  }
+  const auto owner = resolve_user(user_key, lookup);
+  if (!owner.has_value() || !set_share_list(metadata, share_list, lookup)) {
+    return std::nullopt;
+  }
+  metadata.m_owner = owner.value();
+  metadata.m_prefix_length = start;
+  return metadata;
+}
+
+/**
+ * Decodes the GDPR metadata prefix of the value, in the binary or in the legacy text format.
+ * The user keys of the legacy formats are mapped to their ids: the reads leave the users w/o id
+ * unknown, the writes that convert the value to the current format assign their ids.
+ * Returns std::nullopt if the value does not start with a valid prefix, or if an assigned id
+ * cannot be persisted.
+ */
+auto inline decode_metadata(std::string_view value, user_lookup lookup = user_lookup::find)
+    -> std::optional<gdpr_metadata> {
+  if (is_binary_metadata(value)) {
+    return decode_binary_metadata(value, lookup);
+  }
+  return decode_text_metadata(value, lookup);
+}
+
+/* The legacy text form of the metadata, as returned to the clients */
+auto inline metadata_to_text(const gdpr_metadata& metadata) -> std::string {
+  std::string text;
+  text.append(user_dictionary::get_instance()->user_key(metadata.m_owner)).append(1, '|');
+  text.append(metadata.m_encryption ? "1|" : "0|");
+  text.append(purpose_bitmap_to_text(metadata.m_purpose)).append(1, '|');
+  text.append(purpose_bitmap_to_text(metadata.m_objection)).append(1, '|');
+  text.append(metadata.m_origin).append(1, '|');
+  text.append(std::to_string(metadata.m_expiration)).append(1, '|');
+  text.append(get_share_list(metadata)).append(1, '|');
+  text.append(metadata.m_monitor ? "1|" : "0|");
+  return text;
+}
+
+/**
+ * Non-owning view of the GDPR metadata prefix of a value, which decodes a field only when it is
+ * accessed. The binary prefix is checked on construction; the fields are then loaded on every
+ * access, w/o allocations, from the inline metadata or from the cached policy record of the value.
+ * The legacy formats (text, binary version 1) are decoded on construction, as their user keys
+ * have to be mapped to ids anyway.
+ * The viewed value must outlive the view.
+ */
+class metadata_view
+{
+public:
+  metadata_view() = default;
+
+  explicit metadata_view(std::string_view value)
+  {
+    if (is_current_metadata(value)) {
+      m_prefix_length = metadata_prefix_length(value);
+      if (m_prefix_length == 0) {
+        return;
+      }
+      if (static_cast<uint8_t>(value[1]) == metadata_version_inline) {
+        m_metadata = value.substr(0, m_prefix_length);
+        std::memcpy(&m_expiration, value.data() + offsetof(metadata_header, m_expiration), sizeof(m_expiration));
+      } else {
+        metadata_reference reference;
+        std::memcpy(&reference, value.data(), sizeof(reference));
+        auto policy = policy_store::get_instance()->find(reference.m_policy_id);
+        if (!policy.has_value() || !is_inline_metadata(policy.value()) ||
+            metadata_prefix_length(policy.value()) != policy->size()) {
+          return;
+        }
+        m_metadata = policy.value();
+        m_expiration = reference.m_expiration;
+      }
+      m_lazy = true;
+      m_valid = true;
+      return;
+    }
+    auto decoded = decode_metadata(value);
+    if (decoded.has_value()) {
+      m_decoded = std::move(decoded.value());
+      m_prefix_length = m_decoded.m_prefix_length;
+      m_valid = true;
+    }
+  }
+
+  [[nodiscard]] auto is_valid() const -> bool { return m_valid; }
+  [[nodiscard]] auto prefix_length() const -> size_t { return m_prefix_length; }
+
+  [[nodiscard]] auto owner() const -> uint32_t {
+    return m_lazy ? header_field<uint32_t>(offsetof(metadata_header, m_owner)) : m_decoded.m_owner;
+  }
+
+  /* Whether the value is shared with the user: a bit test, or a scan of the ids beyond num_users */
+  [[nodiscard]] auto is_shared_with(uint32_t user_id) const -> bool {
+    if (!m_lazy) {
+      return (user_id < num_users) ? m_decoded.m_share.test(user_id) :
+             std::find(m_decoded.m_share_overflow.begin(), m_decoded.m_share_overflow.end(), user_id) !=
+             m_decoded.m_share_overflow.end();
+    }
+    if (user_id < num_users) {
+      return ((header_field<uint64_t>(offsetof(metadata_header, m_share)) >> user_id) & 1U) != 0;
+    }
+    const uint32_t overflow_count = header_field<uint32_t>(offsetof(metadata_header, m_share_overflow_count));
+    const size_t overflow_offset = sizeof(metadata_header) + 2 * purpose_words() * sizeof(uint64_t);
+    for (uint32_t i = 0; i < overflow_count; i++) {
+      if (header_field<uint32_t>(overflow_offset + i * sizeof(uint32_t)) == user_id) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* The bits of the users below num_users that the value is shared with */
+  [[nodiscard]] auto share_bitmap() const -> uint64_t {
+    return m_lazy ? header_field<uint64_t>(offsetof(metadata_header, m_share)) : m_decoded.m_share.to_ullong();
+  }
+
+  [[nodiscard]] auto encryption() const -> bool {
+    return m_lazy ? (header_field<uint8_t>(offsetof(metadata_header, m_flags)) & metadata_flag_encryption) != 0 :
+                    m_decoded.m_encryption;
+  }
+
+  [[nodiscard]] auto purpose() const -> purpose_bitmap {
+    return m_lazy ? load_purpose_bitmap(offsetof(metadata_header, m_purpose), 0) : m_decoded.m_purpose;
+  }
+
+  [[nodiscard]] auto objection() const -> purpose_bitmap {
+    return m_lazy ? load_purpose_bitmap(offsetof(metadata_header, m_objection), purpose_words()) :
+                    m_decoded.m_objection;
+  }
+
+  [[nodiscard]] auto origin() const -> std::string_view {
+    if (!m_lazy) {
+      return m_decoded.m_origin;
+    }
+    const size_t origin_length = header_field<uint32_t>(offsetof(metadata_header, m_origin_length));
+    return m_metadata.substr(m_metadata.size() - origin_length, origin_length);
+  }
+
+  [[nodiscard]] auto expiration() const -> int64_t {
+    return m_lazy ? m_expiration : m_decoded.m_expiration;
+  }
+
+  [[nodiscard]] auto monitor() const -> bool {
+    return m_lazy ? (header_field<uint8_t>(offsetof(metadata_header, m_flags)) & metadata_flag_monitor) != 0 :
+                    m_decoded.m_monitor;
+  }
+
+private:
+  // the inline metadata: the prefix of the value or its policy record
+  std::string_view m_metadata;
+  // the expiration time of the value, which is not part of its policy record
+  int64_t m_expiration{0};
+  bool m_lazy{false};
+  bool m_valid{false};
+  size_t m_prefix_length{0};
+  // the metadata of the legacy formats, decoded on construction
+  gdpr_metadata m_decoded;
+
+  template<typename T>
+  [[nodiscard]] auto header_field(size_t offset) const -> T {
+    T field;
+    std::memcpy(&field, m_metadata.data() + offset, sizeof(field));
+    return field;
+  }
+
+  [[nodiscard]] auto purpose_words() const -> size_t {
+    return header_field<uint8_t>(offsetof(metadata_header, m_purpose_words));
+  }
+
+  /* The bitmap of the first word in the header and of the words from the given one after the header */
+  [[nodiscard]] auto load_purpose_bitmap(size_t first_word_offset, size_t extra_words_index) const -> purpose_bitmap {
+    purpose_bitmap bits(header_field<uint64_t>(first_word_offset));
+    const size_t words = purpose_words();
+    for (size_t i = 0; i < words; i++) {
+      bits.set_word(i + 1, header_field<uint64_t>(sizeof(metadata_header) + (extra_words_index + i) * sizeof(uint64_t)));
+    }
+    return bits;
+  }
+};
+
+/**
+ * Preserves only the GDPR metadata from the given string containing GDPR metadata,
+ * in the text format returned to the clients.
+ *
+ * @param value The string containing the GDPR metadata and the value.
+ * @return The GDPR metadata.
+ */
+auto inline preserve_only_gdpr_metadata(std::string value) -> std::string {
+  auto metadata = decode_metadata(value);
+  if (!metadata) {
+    return value;
+  }
+  return metadata_to_text(metadata.value());
+}
+
+} // namespace controller
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <array>
 #include <string>
 #include <chrono>
 #include <thread>
@@ -10,6 +11,7 @@
 // #include "argh.hpp"
 
 using controller::query;
+using controller::prepared_queries;
 
 inline auto handle_get(const query &query_args, std::unique_ptr<kv_client> &client) -> std::string
 {
@@ -42,6 +44,17 @@ inline auto handle_delete(const query &query_args, std::unique_ptr<kv_client> &c
   return DELETE_FAILED; // DELETE_FAILED: Failed to delete key
 }
 
+using query_handler = auto (*)(const query &query_args, std::unique_ptr<kv_client> &client) -> std::string;
+
+/* The handler of every operation, indexed by the opcode of the query (nullptr: INVALID_COMMAND) */
+constexpr auto query_handlers = [] {
+  std::array<query_handler, controller::num_operations> handlers {};
+  handlers[controller::operation::get] = handle_get;
+  handlers[controller::operation::put] = handle_put;
+  handlers[controller::operation::del] = handle_delete;
+  return handlers;
+}();
+
 auto handle_connection(int socket, const std::string& db_type, const std::string& db_address) -> void
 {
   // Allocate a large buffer using mmap to hold the message and its size
@@ -53,6 +66,8 @@ auto handle_connection(int socket, const std::string& db_type, const std::string
 
   // create the connection with the database instance
   std::unique_ptr<kv_client> client = kv_factory::create(db_type, db_address);
+  // the query templates that the client prepares on this connection
+  prepared_queries prepared;
 
   while (true) {
     // Read the message size from the socket
@@ -70,26 +85,25 @@ auto handle_connection(int socket, const std::string& db_type, const std::string
     query query_args(static_cast<char*>(buffer));
     std::string response;
 
-    if (query_args.cmd() == "exit") [[unlikely]] {
+    if (query_args.opcode() == controller::operation::quit) [[unlikely]] {
       std::cout << "Client exiting..." << std::endl;
       break;
     }
-    else if (query_args.cmd() == "invalid") [[unlikely]] {
-      response = INVALID_COMMAND;
+    // the execution of a prepared query runs the command of its template
+    if (query_args.opcode() == controller::operation::execute) {
+      query_args = prepared.bind(query_args).value_or(query());
     }
-    else [[likely]] {
-      if (query_args.cmd() == "get") {
-        response = handle_get(query_args, client);
-      }
-      else if (query_args.cmd() == "put") {
-        response = handle_put(query_args, client);
-      }
-      else if (query_args.cmd() == "delete") {
-        response = handle_delete(query_args, client);
-      }
-      else {
-        response = INVALID_COMMAND;
-      }
+    if (query_args.opcode() == controller::operation::prepare) {
+      auto handle = prepared.prepare(static_cast<char*>(buffer));
+      // the handles are answered as "#<handle>", unlike the numeric response codes
+      response = handle.has_value() ? "#" + std::to_string(handle.value()) : INVALID_COMMAND;
+    }
+    // dispatch on the opcode, the invalid queries have no handler
+    else if (const query_handler handler = query_handlers[query_args.opcode()]; handler != nullptr) [[likely]] {
+      response = handler(query_args, client);
+    }
+    else {
+      response = INVALID_COMMAND;
     }
 
     // Check the message size
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace controller {
+
+/* capacity of the purpose bitmaps: the purpose registry names at most this many purposes */
+constexpr int num_purposes = 256;
+constexpr int purpose_word_bits = 64;
+constexpr int num_purpose_words = num_purposes / purpose_word_bits;
+static_assert(num_purposes % purpose_word_bits == 0, "the purpose bitmaps consist of whole 64-bit words");
+
+/*
+ * Fixed-capacity bitmap of purposes (the allowed purposes or the objections of a value), as an
+ * array of 64-bit words. The set operations are branch-free loops over the words, which the
+ * compiler vectorizes; the bitmap is trivially copyable and lives on the stack w/o allocations.
+ */
+class purpose_bitmap
+{
+public:
+  constexpr purpose_bitmap() = default;
+
+  /* the bitmap of the first 64 purposes, as stored by the legacy formats */
+  constexpr explicit purpose_bitmap(uint64_t first_word) : m_words{first_word} {}
+
+  [[nodiscard]] constexpr auto test(size_t purpose) const -> bool {
+    return ((m_words[purpose / purpose_word_bits] >> (purpose % purpose_word_bits)) & 1U) != 0;
+  }
+
+  constexpr auto set(size_t purpose) -> purpose_bitmap& {
+    m_words[purpose / purpose_word_bits] |= uint64_t{1} << (purpose % purpose_word_bits);
+    return *this;
+  }
+
+  constexpr auto reset() -> purpose_bitmap& {
+    m_words.fill(0);
+    return *this;
+  }
+
+  [[nodiscard]] constexpr auto any() const -> bool {
+    uint64_t bits = 0;
+    for (const uint64_t word : m_words) {
+      bits |= word;
+    }
+    return bits != 0;
+  }
+
+  [[nodiscard]] constexpr auto none() const -> bool { return !any(); }
+
+  [[nodiscard]] constexpr auto count() const -> size_t {
+    size_t bits = 0;
+    for (const uint64_t word : m_words) {
+      bits += static_cast<size_t>(std::popcount(word));
+    }
+    return bits;
+  }
+
+  [[nodiscard]] static constexpr auto size() -> size_t { return num_purposes; }
+
+  /* Whether all the purposes of the other bitmap are in this one */
+  [[nodiscard]] constexpr auto contains_all(const purpose_bitmap& other) const -> bool {
+    uint64_t missing = 0;
+    for (size_t i = 0; i < m_words.size(); i++) {
+      missing |= other.m_words[i] & ~m_words[i];
+    }
+    return missing == 0;
+  }
+
+  /* Whether some purpose of the other bitmap is in this one */
+  [[nodiscard]] constexpr auto intersects(const purpose_bitmap& other) const -> bool {
+    uint64_t common = 0;
+    for (size_t i = 0; i < m_words.size(); i++) {
+      common |= other.m_words[i] & m_words[i];
+    }
+    return common != 0;
+  }
+
+  [[nodiscard]] constexpr auto word(size_t index) const -> uint64_t { return m_words[index]; }
+  constexpr auto set_word(size_t index, uint64_t word) -> void { m_words[index] = word; }
+
+  /* The number of words up to the last non-zero one, i.e., the words that have to be stored */
+  [[nodiscard]] constexpr auto used_words() const -> size_t {
+    size_t used = m_words.size();
+    while (used > 0 && m_words[used - 1] == 0) {
+      used--;
+    }
+    return used;
+  }
+
+  /* Calls the function with every purpose of the bitmap, in increasing order */
+  template<typename Function>
+  constexpr auto for_each(Function&& function) const -> void {
+    for (size_t i = 0; i < m_words.size(); i++) {
+      for (uint64_t word = m_words[i]; word != 0; word &= word - 1) {
+        function(i * purpose_word_bits + static_cast<size_t>(std::countr_zero(word)));
+      }
+    }
+  }
+
+  constexpr auto operator&=(const purpose_bitmap& other) -> purpose_bitmap& {
+    for (size_t i = 0; i < m_words.size(); i++) {
+      m_words[i] &= other.m_words[i];
+    }
+    return *this;
+  }
+
+  constexpr auto operator|=(const purpose_bitmap& other) -> purpose_bitmap& {
+    for (size_t i = 0; i < m_words.size(); i++) {
+      m_words[i] |= other.m_words[i];
+    }
+    return *this;
+  }
+
+  constexpr auto operator^=(const purpose_bitmap& other) -> purpose_bitmap& {
+    for (size_t i = 0; i < m_words.size(); i++) {
+      m_words[i] ^= other.m_words[i];
+    }
+    return *this;
+  }
+
+  friend constexpr auto operator&(purpose_bitmap lhs, const purpose_bitmap& rhs) -> purpose_bitmap {
+    return lhs &= rhs;
+  }
+
+  friend constexpr auto operator|(purpose_bitmap lhs, const purpose_bitmap& rhs) -> purpose_bitmap {
+    return lhs |= rhs;
+  }
+
+  friend constexpr auto operator^(purpose_bitmap lhs, const purpose_bitmap& rhs) -> purpose_bitmap {
+    return lhs ^= rhs;
+  }
+
+  friend constexpr auto operator==(const purpose_bitmap& lhs, const purpose_bitmap& rhs) -> bool = default;
+
+private:
+  std::array<uint64_t, num_purpose_words> m_words{};
+};
+
+} // namespace controller
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "purpose_bitmap.hpp"
+
+namespace controller {
+
+/**
+ * Singleton registry of the purpose names, which maps every name to its bit in the purpose bitmaps.
+ *
+ * W/o init, the purposes are the legacy purpose0 .. purpose63. init loads the names from a
+ * configuration file, one purpose per line in the order of their bits (empty lines and lines
+ * starting with '#' are skipped), up to num_purposes of them.
+ *
+ * The bit of a name is found with a perfect hash built on load (hash and displace): the hash of
+ * the name selects a bucket, whose seed remixes the hash into a slot that no other name occupies,
+ * so a lookup hashes the name once and compares it with a single name.
+ *
+ * The registry is loaded on startup, before the requests are served, and is then read w/o locks.
+ */
+class purpose_registry
+{
+public:
+  static auto get_instance() -> purpose_registry* {
+    static purpose_registry registry_inst;
+    return &registry_inst;
+  }
+
+  /* Load the purpose names of the configuration file; the registry is unchanged on failure */
+  auto init(const std::string& path) -> bool {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+      std::cerr << "Error: Failed to open " << path << std::endl;
+      return false;
+    }
+    std::vector<std::string> names;
+    std::string line;
+    while (std::getline(file, line)) {
+      const size_t start = line.find_first_not_of(" \t\r");
+      if (start == std::string::npos || line[start] == '#') {
+        continue;
+      }
+      const size_t end = line.find_last_not_of(" \t\r");
+      names.emplace_back(line.substr(start, end - start + 1));
+    }
+    return load(std::move(names));
+  }
+
+  /* Replace the registry with the purpose names, whose bits follow their order */
+  auto load(std::vector<std::string> names) -> bool {
+    if (names.size() > static_cast<size_t>(num_purposes)) {
+      std::cerr << "Error: " << names.size() << " purposes exceed the capacity of " << num_purposes << std::endl;
+      return false;
+    }
+    for (const auto& name : names) {
+      if (name.empty() || name.find_first_of(",\"()&| \t") != std::string::npos) {
+        std::cerr << "Error: Invalid purpose name \"" << name << "\"" << std::endl;
+        return false;
+      }
+    }
+    std::vector<std::string_view> sorted_names(names.begin(), names.end());
+    std::sort(sorted_names.begin(), sorted_names.end());
+    auto duplicate = std::adjacent_find(sorted_names.begin(), sorted_names.end());
+    if (duplicate != sorted_names.end()) {
+      std::cerr << "Error: Duplicate purpose name \"" << *duplicate << "\"" << std::endl;
+      return false;
+    }
+    const size_t num_slots = std::bit_ceil(std::max<size_t>(names.size(), 1));
+    const size_t num_buckets = std::max<size_t>(num_slots / 2, 1);
+
+    // place the largest buckets first, while most slots are free
+    std::vector<std::vector<uint32_t>> buckets(num_buckets);
+    for (size_t purpose = 0; purpose < names.size(); purpose++) {
+      buckets[name_hash(names[purpose]) & (num_buckets - 1)].push_back(static_cast<uint32_t>(purpose));
+    }
+    std::vector<uint32_t> bucket_order(num_buckets);
+    for (size_t bucket = 0; bucket < num_buckets; bucket++) {
+      bucket_order[bucket] = static_cast<uint32_t>(bucket);
+    }
+    std::stable_sort(bucket_order.begin(), bucket_order.end(),
+                     [&](uint32_t lhs, uint32_t rhs) { return buckets[lhs].size() > buckets[rhs].size(); });
+
+    std::vector<uint32_t> seeds(num_buckets, 0);
+    std::vector<uint32_t> slots(num_slots, no_purpose);
+    std::vector<size_t> bucket_slots;
+    // whether the seed maps the names of the bucket to distinct free slots, which are collected
+    const auto fits = [&](const std::vector<uint32_t>& bucket, uint32_t seed) {
+      bucket_slots.clear();
+      for (const uint32_t purpose : bucket) {
+        const size_t slot = slot_of(name_hash(names[purpose]), seed, num_slots - 1);
+        if (slots[slot] != no_purpose || std::find(bucket_slots.begin(), bucket_slots.end(), slot) != bucket_slots.end()) {
+          return false;
+        }
+        bucket_slots.push_back(slot);
+      }
+      return true;
+    };
+    for (const uint32_t bucket : bucket_order) {
+      if (buckets[bucket].empty()) {
+        break;
+      }
+      uint32_t seed = 0;
+      while (seed < max_seed && !fits(buckets[bucket], seed)) {
+        seed++;
+      }
+      if (seed == max_seed) {
+        // only distinct names with the same 64-bit hash cannot be separated
+        std::cerr << "Error: Failed to build the perfect hash of the purpose names" << std::endl;
+        return false;
+      }
+      seeds[bucket] = seed;
+      for (size_t i = 0; i < bucket_slots.size(); i++) {
+        slots[bucket_slots[i]] = buckets[bucket][i];
+      }
+    }
+
+    m_names = std::move(names);
+    m_seeds = std::move(seeds);
+    m_slots = std::move(slots);
+    return true;
+  }
+
+  /* The bit of the purpose name, if it is registered */
+  [[nodiscard]] auto find(std::string_view name) const -> std::optional<size_t> {
+    const uint64_t hash = name_hash(name);
+    const uint32_t purpose = m_slots[slot_of(hash, m_seeds[hash & (m_seeds.size() - 1)], m_slots.size() - 1)];
+    if (purpose == no_purpose || m_names[purpose] != name) {
+      return std::nullopt;
+    }
+    return purpose;
+  }
+
+  /* The name of the purpose bit (empty for an unnamed bit) */
+  [[nodiscard]] auto name(size_t purpose) const -> std::string_view {
+    return (purpose < m_names.size()) ? std::string_view(m_names[purpose]) : std::string_view();
+  }
+
+  [[nodiscard]] auto size() const -> size_t { return m_names.size(); }
+
+private:
+  static constexpr uint32_t no_purpose = UINT32_MAX;
+  static constexpr uint32_t max_seed = 1U << 20U;
+  static constexpr int legacy_purposes = 64;
+
+  // the purpose names, indexed by bit
+  std::vector<std::string> m_names;
+  // the seed of every bucket, and the purpose of every slot of the perfect hash
+  std::vector<uint32_t> m_seeds;
+  std::vector<uint32_t> m_slots;
+
+  purpose_registry() {
+    std::vector<std::string> names;
+    for (int purpose = 0; purpose < legacy_purposes; purpose++) {
+      names.push_back("purpose" + std::to_string(purpose));
+    }
+    load(std::move(names));
+  }
+
+  /* 64-bit FNV-1a hash of the name */
+  static auto name_hash(std::string_view name) -> uint64_t {
+    constexpr uint64_t fnv_offset_basis = 0xcbf29ce484222325ULL;
+    constexpr uint64_t fnv_prime = 0x100000001b3ULL;
+    uint64_t hash = fnv_offset_basis;
+    for (const char byte : name) {
+      hash ^= static_cast<uint8_t>(byte);
+      hash *= fnv_prime;
+    }
+    return hash;
+  }
+
+  /* The slot of the hash for the seed of its bucket: the splitmix64 finalizer of the seeded hash */
+  static auto slot_of(uint64_t hash, uint32_t seed, size_t slot_mask) -> size_t {
+    hash ^= seed * 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ (hash >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27U)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31U;
+    return static_cast<size_t>(hash) & slot_mask;
+  }
+};
+
+/*
+ *  takes as arguments a bitmap and a comma-separated list of purpose names
+ *  identifies the respective bit for each name based on the purpose registry
+ *  and sets the appropriate bits; returns false if a name is not registered
+ */
+auto inline set_bitmap(purpose_bitmap &bits, std::string_view purpose_names) -> bool {
+  const auto *registry = purpose_registry::get_instance();
+  size_t start = 0;
+  while (start <= purpose_names.size()) {
+    size_t end = purpose_names.find(',', start);
+    if (end == std::string_view::npos) {
+      end = purpose_names.size();
+    }
+    const std::string_view name = purpose_names.substr(start, end - start);
+    if (!name.empty()) {
+      auto purpose = registry->find(name);
+      if (!purpose.has_value()) {
+        return false;
+      }
+      bits.set(purpose.value());
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+/* 
+ *  takes as argument a bitmap and
+ *  identifies the respective set bits and, based on the purpose registry,
+ *  returns a comma separated string with the appropriate set of purposes
+ */
+auto inline get_purposes_string(const purpose_bitmap &bits) -> std::string {
+  const auto *registry = purpose_registry::get_instance();
+  std::string res;
+  bits.for_each([&](size_t purpose) {
+    const std::string_view name = registry->name(purpose);
+    if (name.empty()) {
+      res.append("purpose").append(std::to_string(purpose));
+    } else {
+      res.append(name);
+    }
+    res.append(1, ',');
+  });
+  return res;
+}
+
+} // namespace controller
@@ -1,4 +1,5 @@
 #include "query.hpp"
+#include "purpose_registry.hpp"
 
 #include <iostream>
 
@@ -16,7 +17,7 @@ query::query()
 query::query(std::string_view user_key,
              std::string_view key,
              std::string_view cmd)
-    : m_cmd{cmd},
+    : m_opcode{convert_operation_to_enum(cmd)},
       m_key{key},
       m_user_key{user_key},
       m_cond_purpose{0},
@@ -26,134 +27,194 @@ query::query(std::string_view user_key,
 {
 }
 
+/**
+ * Cursor over the query input, which reads every character once, from left to right.
+ * The tokens are views into the input; the whitespace between them is skipped.
+ */
+class query_tokenizer
+{
+public:
+  explicit query_tokenizer(std::string_view input) : m_input{input} {}
+
+  [[nodiscard]] auto at_end() -> bool {
+    skip_spaces();
+    return m_pos == m_input.size();
+  }
+
+  /* Consume the next character if it is the expected one */
+  auto consume(char expected) -> bool {
+    skip_spaces();
+    if (m_pos < m_input.size() && m_input[m_pos] == expected) {
+      m_pos++;
+      return true;
+    }
+    return false;
+  }
+
+  /* The name of a predicate or command (letters, digits and underscores), empty if there is none */
+  auto name() -> std::string_view {
+    skip_spaces();
+    const std::size_t start = m_pos;
+    while (m_pos < m_input.size() && is_name_char(m_input[m_pos])) {
+      m_pos++;
+    }
+    return m_input.substr(start, m_pos - start);
+  }
+
+  /* The contents of the next double-quoted string */
+  auto quoted() -> std::optional<std::string_view> {
+    if (!consume('"')) {
+      return std::nullopt;
+    }
+    const std::size_t start = m_pos;
+    m_pos = m_input.find('"', start);
+    if (m_pos == std::string_view::npos) {
+      m_pos = m_input.size();
+      return std::nullopt;
+    }
+    return m_input.substr(start, m_pos++ - start);
+  }
+
+private:
+  std::string_view m_input;
+  std::size_t m_pos{0};
+
+  // ASCII classes, w/o the locale lookups of <cctype>
+  static constexpr auto is_name_char(char chr) -> bool {
+    return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9') || chr == '_';
+  }
+  static constexpr auto is_space(char chr) -> bool {
+    return chr == ' ' || (chr >= '\t' && chr <= '\r');
+  }
+
+  auto skip_spaces() -> void {
+    while (m_pos < m_input.size() && is_space(m_input[m_pos])) {
+      m_pos++;
+    }
+  }
+};
+
 query::query(std::string_view input)
     : m_cond_purpose{0},
       m_cond_objection{0},
       m_cond_expiration{0},
       m_cond_monitor{false}
 {
-  std::size_t start = 0;
-  std::size_t pos = input.find('&');
-
-  while (pos != std::string_view::npos) {
-    // std::string predicate = input.substr(start, pos - start);
-    process_predicate(input.substr(start, pos - start));
-    start = pos + 1;
-    pos = input.find('&', start);
+  m_error = parse(input);
+  if (m_error != query_error::none) {
+    #ifndef NDEBUG
+    std::cout << "Invalid query (error " << static_cast<int>(m_error) << "): " << input << std::endl;
+    #endif
+    m_opcode = operation::invalid;
   }
-
-  // std::string last_predicate = input.substr(start);
-  process_predicate(input.substr(start));
 }
 
-
 /**
- * Processes a predicate string by extracting the attribute and value.
- * 
- * @param predicate The predicate string in the format attribute("value").
- *
- * @note The function assumes that the predicate string is properly formatted and follows the expected pattern.
- *       If the predicate string is not in the expected format or if the attribute is not supported,
- *       the function will print an error message and exit.
+ * Parses the predicates of the query: predicate("value")&...&query(cmd("key"[,"value"])),
+ * in any order, in a single pass. Stops at the first error.
  */
-auto query::process_predicate(std::string_view predicate) -> void
+auto query::parse(std::string_view input) -> query_error
 {
-  std::size_t pred_attr_start = 0;
-  std::size_t pred_attr_end = predicate.find('(');
-  std::string_view pred_attr = predicate.substr(pred_attr_start, pred_attr_end - pred_attr_start);
-
-  std::size_t pred_val_start = pred_attr_end + 1;
-  std::size_t pred_val_end = predicate.rfind(')');
-  std::string_view pred_val = predicate.substr(pred_val_start, pred_val_end - pred_val_start);
-
-  // Parse the options
-  if (pred_attr == "query") {
-    // extract command
-    std::size_t query_cmd_end = pred_val.find('(');
-    this->m_cmd = std::string(pred_val.substr(0, query_cmd_end));
-    // Convert this->m_cmd to lowercase
-    std::transform(this->m_cmd.begin(), this->m_cmd.end(), this->m_cmd.begin(), [](unsigned char cmd_char) {
-      return std::tolower(cmd_char);
-    });
-
-    if (this->m_cmd == "exit") [[unlikely]] {
-      // Do nothing
-    } else [[likely]] {
-      parse_query(pred_val);
+  query_tokenizer tokens(input);
+  do {
+    const std::string_view predicate = tokens.name();
+    if (predicate.empty() || !tokens.consume('(')) {
+      return query_error::syntax;
     }
-  } else {
-    // indexed to remove the quotation marks from the "options" 
-    pred_val = pred_val.substr(1, pred_val.length() - 2);
-    parse_option(pred_attr, pred_val);
-  }
+    query_error error = query_error::none;
+    if (predicate == "query") {
+      error = parse_query(tokens);
+    } else {
+      auto value = tokens.quoted();
+      error = value.has_value() ? parse_option(predicate, value.value()) : query_error::syntax;
+    }
+    if (error != query_error::none) {
+      return error;
+    }
+    if (!tokens.consume(')')) {
+      return query_error::syntax;
+    }
+  } while (tokens.consume('&'));
+  return tokens.at_end() ? query_error::none : query_error::syntax;
 }
 
 /**
- * Extracts the key from a query string in the format "(command("key","value"))".
- * 
- * @param query The query string containing the command and key.
- * @return The extracted key from the query.
- *
- * @note The function assumes that the query string is properly formatted and follows the expected pattern.
- *       If the query string is not in the expected format, the function will print an error message and exit.
+ * Parses the command of the query predicate and its arguments: cmd("key"[,"value"]).
+ * The command is matched case-insensitively to its operation.
  */
-static auto extract_key(std::string_view query) -> std::string_view
+auto query::parse_query(query_tokenizer &tokens) -> query_error
 {
-  std::size_t open_quote = query.find('"');
-  std::size_t close_quote = query.find('"', open_quote + 1);
-  
-  if (open_quote == std::string_view::npos || close_quote == std::string_view::npos || close_quote <= open_quote) {
-    std::cout << "Invalid query format: " << query << std::endl;
-    return "";
+  this->m_opcode = convert_operation_to_enum(tokens.name());
+  if (this->m_opcode == operation::invalid) {
+    return query_error::unknown_command;
   }
-  
-  return query.substr(open_quote + 1, close_quote - open_quote - 1);
-}
 
-/**
- * Extracts the value from a query string in the format "(command("key","value"))".
- * 
- * @param query The query string containing the command and key.
- * @return The extracted value from the query.
- *
- * @note The function assumes that the query string is properly formatted and follows the expected pattern.
- *       If the query string is not in the expected format, the function will print an error message and exit.
- */
-static auto extract_value(std::string_view query) -> std::string_view
-{
-  std::size_t first_quote = query.find('"');
-  std::size_t second_quote = query.find('"', first_quote + 1);
-  std::size_t third_quote = query.find('"', second_quote + 1);
-  std::size_t fourth_quote = query.find('"', third_quote + 1);
-  
-  if (first_quote == std::string_view::npos || second_quote == std::string_view::npos || 
-      third_quote == std::string_view::npos || fourth_quote == std::string_view::npos || 
-      fourth_quote <= third_quote) {
-    std::cout << "Invalid query format: " << query << std::endl;
-    return "";
+  // the exit command has no arguments
+  if (!tokens.consume('(')) {
+    return (this->m_opcode == operation::quit) ? query_error::none : query_error::syntax;
+  }
+  auto key = tokens.quoted();
+  if (!key.has_value()) {
+    return query_error::syntax;
+  }
+  // the execution of a prepared query passes its handle, then the key and the value of the command
+  if (this->m_opcode == operation::execute) {
+    if (!parse_metadata_integer(key.value(), this->m_handle)) {
+      return query_error::invalid_number;
+    }
+    key = tokens.consume(',') ? tokens.quoted() : std::nullopt;
+    if (!key.has_value()) {
+      return query_error::syntax;
+    }
+    if (tokens.consume(',')) {
+      auto value = tokens.quoted();
+      if (!value.has_value()) {
+        return query_error::syntax;
+      }
+      this->m_value = value.value();
+    }
+  }
+  // if the query is put, extract the value
+  else if (this->m_opcode == operation::put) {
+    auto value = tokens.consume(',') ? tokens.quoted() : std::nullopt;
+    if (!value.has_value()) {
+      return query_error::syntax;
+    }
+    this->m_value = value.value();
+  }
+  if (!tokens.consume(')')) {
+    return query_error::syntax;
   }
-  
-  return query.substr(third_quote + 1, fourth_quote - third_quote - 1);
-}
 
-auto query::parse_query(std::string_view reg_query_args) -> void
-{
   // if the query is getLogs, just set the log key
-  if (this->m_cmd == "getlogs") {
-    this->m_log_key = extract_key(reg_query_args);
-    return;
+  if (this->m_opcode == operation::get_logs) {
+    this->m_log_key = key.value();
   }
-  // if the query is put, extract the value
-  else if (this->m_cmd == "put") {
-    this->m_value = extract_value(reg_query_args);
+  // if the query looks up the purpose index, the argument is the list of purposes
+  else if (this->m_opcode == operation::get_keys || this->m_opcode == operation::count_keys) {
+    if (!set_bitmap(this->m_cond_purpose, key.value())) {
+      return query_error::unknown_purpose;
+    }
+  }
+  // a prepared query names the command of its executions, which take a key (and a value)
+  else if (this->m_opcode == operation::prepare) {
+    const operation prepared_opcode = convert_operation_to_enum(key.value());
+    if (prepared_opcode == operation::invalid || prepared_opcode > operation::putm) {
+      return query_error::unknown_command;
+    }
+    this->m_key = key.value();
   }
-  // in the end set the operation key 
-  this->m_key = extract_key(reg_query_args);  
+  // in the end set the operation key
+  else {
+    this->m_key = key.value();
+  }
+  return query_error::none;
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-auto query::parse_option(std::string_view option, std::string_view value) -> void
+auto query::parse_option(std::string_view option, std::string_view value) -> query_error
 {
+  bool parsed = true;
   if (option == "sessionKey") {
     this->m_user_key = value;
   } 
@@ -164,19 +225,25 @@ auto query::parse_option(std::string_view option, std::string_view value) -> voi
     this->m_share = value;
   } 
   else if (option == "objExp") {
-    this->m_expiration = stoi(std::string(value));
-    // this->m_expiration = from_chars()
+    int64_t expiration = 0;
+    if (!parse_metadata_integer(value, expiration)) {
+      return query_error::invalid_number;
+    }
+    this->m_expiration = expiration;
   } 
   else if (option == "objPur") {
     this->m_purpose.emplace();
-    set_bitmap(this->m_purpose.value(), split_comma_string(value));
+    parsed = set_bitmap(this->m_purpose.value(), value);
   } 
   else if (option == "objObjections") {
     this->m_objection.emplace();
-    set_bitmap(this->m_objection.value(), split_comma_string(value));
+    parsed = set_bitmap(this->m_objection.value(), value);
   } 
   else if (option == "monitor") {
-    this->m_monitor = str_to_bool(value);
+    this->m_monitor = parse_bool(value);
+    if (!this->m_monitor.has_value()) {
+      return query_error::invalid_bool;
+    }
   } 
   else if (option == "objOrigIs") {
     this->m_cond_origin = value;
@@ -185,22 +252,28 @@ auto query::parse_option(std::string_view option, std::string_view value) -> voi
     this->m_cond_share = value;
   } 
   else if (option == "objExpIs") {
-    this->m_cond_expiration = stoi(std::string(value));
+    if (!parse_metadata_integer(value, this->m_cond_expiration)) {
+      return query_error::invalid_number;
+    }
   } 
   else if (option == "objPurIs") {
-    set_bitmap(this->m_cond_purpose, split_comma_string(value));
+    parsed = set_bitmap(this->m_cond_purpose, value);
   } 
   else if (option == "objObjectionsIs") {
-    set_bitmap(this->m_cond_objection, split_comma_string(value));
+    parsed = set_bitmap(this->m_cond_objection, value);
   } 
   else if (option == "monitorIs") {
-    this->m_cond_monitor = str_to_bool(value);
+    auto monitor = parse_bool(value);
+    if (!monitor.has_value()) {
+      return query_error::invalid_bool;
+    }
+    this->m_cond_monitor = monitor.value();
   } 
   else {
-    std::string error_message = "Error: predicate " + std::string(option) + " not supported.";
-    throw std::invalid_argument(error_message);
-    this->m_cmd = "invalid";
+    return query_error::unsupported_predicate;
   }
+  // only the purpose lists remain to be checked
+  return parsed ? query_error::none : query_error::unknown_purpose;
 }
 
 // query::~query()
@@ -209,12 +282,22 @@ auto query::parse_option(std::string_view option, std::string_view value) -> voi
 
 auto query::print() -> void
 {
-  std::cout << this->m_cmd << " " << this->m_key << " " << this->m_value << "\n";
+  std::cout << this->cmd() << " " << this->m_key << " " << this->m_value << "\n";
+}
+
+auto query::opcode() const -> operation
+{
+  return this->m_opcode;
 }
 
-auto query::cmd() const -> std::string
+auto query::cmd() const -> std::string_view
 {
-  return this->m_cmd;
+  return operation_names[this->m_opcode];
+}
+
+auto query::error() const -> query_error
+{
+  return this->m_error;
 }
 
 auto query::key() const -> std::string_view
@@ -232,12 +315,12 @@ auto query::user_key() const -> std::optional<std::string_view>
   return this->m_user_key ? std::optional<std::string_view>(*this->m_user_key) : std::nullopt;
 }
 
-auto query::purpose() const -> std::optional<std::bitset<num_purposes>>
+auto query::purpose() const -> std::optional<purpose_bitmap>
 {
   return this->m_purpose;
 }
 
-auto query::objection() const -> std::optional<std::bitset<num_purposes>>
+auto query::objection() const -> std::optional<purpose_bitmap>
 {
   return this->m_objection;
 }
@@ -262,12 +345,12 @@ auto query::monitor() const -> std::optional<bool>
   return this->m_monitor;
 }
 
-auto query::cond_purpose() const -> std::bitset<num_purposes>
+auto query::cond_purpose() const -> purpose_bitmap
 {
   return this->m_cond_purpose;
 }
 
-auto query::cond_objection() const -> std::bitset<num_purposes>
+auto query::cond_objection() const -> purpose_bitmap
 {
   return this->m_cond_objection;
 }
@@ -297,4 +380,48 @@ auto query::log_key() const -> std::string_view
   return this->m_log_key;
 }
 
+auto query::handle() const -> uint32_t
+{
+  return this->m_handle;
+}
+
+auto query::bind(operation opcode, std::string_view key, std::string_view value) const -> query
+{
+  query bound_query(*this);
+  bound_query.m_opcode = opcode;
+  bound_query.m_key = key;
+  bound_query.m_value = value;
+  bound_query.m_handle = 0;
+  return bound_query;
+}
+
+auto prepared_queries::prepare(std::string_view input) -> std::optional<uint32_t>
+{
+  if (m_templates.size() >= max_prepared_queries) {
+    return std::nullopt;
+  }
+  auto template_input = std::make_unique<std::string>(input);
+  const query prepare_query(*template_input);
+  if (prepare_query.opcode() != operation::prepare) {
+    return std::nullopt;
+  }
+  // the template is the prepare query for the named command, w/o a key
+  query template_query = prepare_query.bind(convert_operation_to_enum(prepare_query.key()), {}, {});
+  m_templates.push_back({std::move(template_input), template_query});
+  return static_cast<uint32_t>(m_templates.size() - 1);
+}
+
+auto prepared_queries::bind(const query &exec_query) const -> std::optional<query>
+{
+  if (exec_query.opcode() != operation::execute || exec_query.handle() >= m_templates.size()) {
+    return std::nullopt;
+  }
+  const query &template_query = m_templates[exec_query.handle()].m_template;
+  // only the executions of a put pass a value (the parser leaves the view null w/o one)
+  if ((template_query.opcode() == operation::put) != (exec_query.value().data() != nullptr)) {
+    return std::nullopt;
+  }
+  return template_query.bind(template_query.opcode(), exec_query.key(), exec_query.value());
+}
+
 } // namespace controller
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <optional>
 #include <sstream>
 #include <unordered_map>
+#include <vector>
 
 #include "gdpr_metadata.hpp"
+#include "logging/log_common.hpp"
 
 namespace controller {
 
@@ -35,17 +39,26 @@ const std::vector<std::string> policy_predicates = {
   "monitor",
   "query"
 };
-const std::vector<std::string> query_types = {
-  "put",
-  "get",
-  "delete",
-  "putm",
-  "getm",
-  "getlogs"
-};
 // NOLINTEND(cert-err58-cpp)
 
-/* class for storing query info */
+/* Reasons to reject a query, whose operation is then invalid */
+enum class query_error : uint8_t {
+  none,
+  syntax,                 // the query does not follow predicate("value")&...&query(cmd("key"[,"value"]))
+  unknown_command,
+  unsupported_predicate,
+  invalid_number,
+  invalid_bool,
+  unknown_purpose
+};
+
+class query_tokenizer;
+
+/*
+ * class for storing query info
+ * The query is parsed in a single pass over the input and its fields are views into it,
+ * so the input must outlive the query.
+ */
 class query
 {
 public:
@@ -56,49 +69,56 @@ public:
   // ~query();
 
   /* private members getters */
-  [[nodiscard]] auto cmd() const -> std::string;
+  [[nodiscard]] auto opcode() const -> operation;
+  [[nodiscard]] auto cmd() const -> std::string_view;
+  [[nodiscard]] auto error() const -> query_error;
   [[nodiscard]] auto key() const -> std::string_view;
   [[nodiscard]] auto value() const -> std::string_view;
   [[nodiscard]] auto user_key() const -> std::optional<std::string_view>;
-  [[nodiscard]] auto purpose() const -> std::optional<std::bitset<num_purposes>>;
-  [[nodiscard]] auto objection() const -> std::optional<std::bitset<num_purposes>>;
+  [[nodiscard]] auto purpose() const -> std::optional<purpose_bitmap>;
+  [[nodiscard]] auto objection() const -> std::optional<purpose_bitmap>;
   [[nodiscard]] auto origin() const -> std::optional<std::string_view>;
   [[nodiscard]] auto expiration() const -> std::optional<int64_t>;
   [[nodiscard]] auto share() const -> std::optional<std::string_view>;
   [[nodiscard]] auto monitor() const -> std::optional<bool>;
-  [[nodiscard]] auto cond_purpose() const -> std::bitset<num_purposes>;
-  [[nodiscard]] auto cond_objection() const -> std::bitset<num_purposes>;
+  [[nodiscard]] auto cond_purpose() const -> purpose_bitmap;
+  [[nodiscard]] auto cond_objection() const -> purpose_bitmap;
   [[nodiscard]] auto cond_origin() const -> std::string_view;
   [[nodiscard]] auto cond_expiration() const -> int64_t;
   [[nodiscard]] auto cond_share() const -> std::string_view;
   [[nodiscard]] auto cond_monitor() const -> bool;
   [[nodiscard]] auto log_key() const -> std::string_view;
+  [[nodiscard]] auto handle() const -> uint32_t;
+
+  /* A copy of the (prepared) query for the operation, with the key and the value of an execution */
+  [[nodiscard]] auto bind(operation opcode, std::string_view key, std::string_view value) const -> query;
 
   auto print() -> void;
 
 private:
   
-  auto process_predicate(std::string_view predicate) -> void;
-  auto parse_query(std::string_view reg_query_args) -> void;
-  auto parse_option(std::string_view option, std::string_view value) -> void;
+  auto parse(std::string_view input) -> query_error;
+  auto parse_query(query_tokenizer &tokens) -> query_error;
+  auto parse_option(std::string_view option, std::string_view value) -> query_error;
 
   // query data
-  std::string m_cmd;
+  operation m_opcode{operation::invalid};
+  query_error m_error{query_error::none};
   std::string_view m_key;
   std::string_view m_value;
 
   // metadata to set
   std::optional<std::string_view> m_user_key;
-  std::optional<std::bitset<num_purposes>> m_purpose;
-  std::optional<std::bitset<num_purposes>> m_objection;
-  std::optional<std::string> m_origin;
+  std::optional<purpose_bitmap> m_purpose;
+  std::optional<purpose_bitmap> m_objection;
+  std::optional<std::string_view> m_origin;
   std::optional<int64_t> m_expiration;
   std::optional<std::string_view> m_share;
   std::optional<bool> m_monitor;
 
   // conditional metadata
-  std::bitset<num_purposes> m_cond_purpose;
-  std::bitset<num_purposes> m_cond_objection;
+  purpose_bitmap m_cond_purpose;
+  purpose_bitmap m_cond_objection;
   std::string_view m_cond_origin;
   int64_t m_cond_expiration;
   std::string_view m_cond_share;
@@ -106,6 +126,37 @@ private:
 
   // log metadata
   std::string_view m_log_key;
+
+  // the prepared query of an execution
+  uint32_t m_handle{0};
+};
+
+// the templates that a connection may prepare
+constexpr size_t max_prepared_queries = 1024;
+
+/*
+ * The prepared queries of a connection.
+ * query(prepare("cmd"))&predicate("value")&... registers the predicates as the template of the command
+ * and returns its handle; query(exec("handle","key"[,"value"])) then runs the command with them,
+ * w/o parsing the predicates and decoding their purpose bitmaps and numbers again.
+ */
+class prepared_queries
+{
+public:
+  /* Registers the template of the prepare query, returns its handle (std::nullopt if invalid or full) */
+  auto prepare(std::string_view input) -> std::optional<uint32_t>;
+  /* The query of the template of an execution, bound to its key and value (std::nullopt if invalid) */
+  [[nodiscard]] auto bind(const query &exec_query) const -> std::optional<query>;
+
+  [[nodiscard]] auto size() const -> size_t { return m_templates.size(); }
+
+private:
+  struct prepared_query {
+    // the template input is owned, so that the views of the parsed template remain valid
+    std::unique_ptr<std::string> m_input;
+    query m_template;
+  };
+  std::vector<prepared_query> m_templates;
 };
 
 } // namespace controller
\ No newline at end of file
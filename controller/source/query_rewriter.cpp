@@ -1,4 +1,5 @@
 #include "query_rewriter.hpp"
+#include "metadata_resolver.hpp"
 
 namespace controller {
 
@@ -15,35 +16,40 @@ query_rewriter::query_rewriter(const query &query_args,
   /* note: string_view data type is okay as query outlives the query_rewriter */
   std::string_view user_key = query_args.user_key().value_or(def_policy.user_key());
   bool encryption = def_policy.encryption();
-  std::bitset<num_purposes> purpose = query_args.purpose().value_or(def_policy.purpose());
-  std::bitset<num_purposes> objection = query_args.objection().value_or(def_policy.objection());
+  purpose_bitmap purpose = query_args.purpose().value_or(def_policy.purpose());
+  purpose_bitmap objection = query_args.objection().value_or(def_policy.objection());
   std::string_view origin = query_args.origin().value_or(def_policy.origin());
   int64_t expiration = query_args.expiration().value_or(def_policy.expiration());
   std::string_view share = query_args.share().value_or(def_policy.share());
   bool monitor = query_args.monitor().value_or(def_policy.monitor());
   
-  // Pre-calculate the size of the final string
-  size_t delimiters = (max_gdpr_field_guard - 1) * sizeof(char);
-
-  size_t prefix_size = /* user key */   user_key.size()            + /* encryption */  sizeof(char)               +
-                       /* purpose */    sizeof(unsigned long long) + /* objection */   sizeof(unsigned long long) +
-                       /* origin */     origin.size()              + /* expiration */  sizeof(int64_t)            +
-                       /* share */      share.size()               + /* monitor */     sizeof(char)               +
-                       /* delimiters */ delimiters;
-
-  // Reserve space for the entire string
-  m_new_value.reserve(prefix_size + new_query_value.size());
-
-  // Construct the string directly
-  m_new_value.append(user_key).append(1, '|');
-  m_new_value.append(encryption ? "1|" : "0|");
-  m_new_value.append(std::to_string(purpose.to_ullong())).append(1, '|');
-  m_new_value.append(std::to_string(objection.to_ullong())).append(1, '|');
-  m_new_value.append(origin).append(1, '|');
-  m_new_value.append(std::to_string(get_expiration_time(expiration))).append(1, '|');
-  m_new_value.append(share).append(1, '|');
-  m_new_value.append(monitor ? "1|" : "0|");
+  gdpr_metadata metadata;
+  auto owner = user_dictionary::get_instance()->get_or_assign_id(user_key);
+  if (!owner.has_value()) {
+    m_is_valid = false;
+    return;
+  }
+  metadata.m_owner = owner.value();
+  metadata.m_encryption = encryption;
+  metadata.m_purpose = purpose;
+  metadata.m_objection = objection;
+  metadata.m_origin = origin;
+  m_expiration = get_expiration_time(expiration);
+  metadata.m_expiration = m_expiration;
+  if (!set_share_list(metadata, share)) {
+    m_is_valid = false;
+    return;
+  }
+  metadata.m_monitor = monitor;
+
+  // Reserve space for the entire value and construct it directly,
+  // the metadata are stored once in their policy record and referred to by the value
+  m_new_value.reserve(encoded_metadata_size(metadata) + new_query_value.size());
+  append_metadata_reference(m_new_value, metadata);
   m_new_value.append(new_query_value);
+
+  m_purpose = purpose;
+  m_objection = objection;
 }
 
 /* Constructor for put query operation rewriter in case of an UPDATE of a value */
@@ -52,13 +58,26 @@ query_rewriter::query_rewriter(const query &query_args,
 query_rewriter::query_rewriter(std::string_view res, std::string_view new_query_value)
 {
   /* create the new value based on the current prefix and the new provided value */
-  // Find the position of the last "|" character in the string
-  size_t last_delimiter_pos = res.find_last_of('|');
-
-  // Extract the substring up to the position of the last '|' character
-  auto metadata = res.substr(0, last_delimiter_pos);
-
-  m_new_value = std::string(metadata) + "|" + std::string(new_query_value);
+  if (is_current_metadata(res)) {
+    // keep the binary prefix as is
+    const size_t prefix_length = metadata_prefix_length(res);
+    if (prefix_length == 0) {
+      m_is_valid = false;
+      return;
+    }
+    m_new_value.reserve(prefix_length + new_query_value.size());
+    m_new_value.append(res.substr(0, prefix_length));
+  } else {
+    // a value in a legacy format is converted to the current format
+    auto metadata = decode_metadata(res, user_lookup::assign);
+    if (!metadata) {
+      m_is_valid = false;
+      return;
+    }
+    m_new_value.reserve(encoded_metadata_size(metadata.value()) + new_query_value.size());
+    append_metadata_reference(m_new_value, metadata.value());
+  }
+  m_new_value.append(new_query_value);
 }
 
 /* Constructor for PUTM query operation rewriter */
@@ -66,92 +85,70 @@ query_rewriter::query_rewriter(std::string_view res,
                                const query &query_args)
 {
   /* create the new metadata fields based on the query arguments - the rest are left intact */
-  // Split the current value string into metadata fields + the value in the end
-  std::string new_value;
-  new_value.reserve(res.length());  // Pre-allocate space
-
-  size_t start = 0;
-  size_t end = 0;
-  int count = 0;
-
-  while (count < max_gdpr_field_guard && (end = res.find('|', start)) != std::string_view::npos) {
-    std::string_view token = res.substr(start, end - start);
-
-    switch (count) {
-      case usr:
-        new_value.append(query_args.user_key().value_or(token));
-        break;
-      case encr:
-        new_value.append(token);
-        break;
-      case pur:
-        if (query_args.purpose().has_value()) {
-          new_value.append(std::to_string(query_args.purpose().value().to_ullong()));
-        } else {
-          new_value.append(token);
-        }
-        break;
-      case obj:
-        if (query_args.objection().has_value()) {
-          new_value.append(std::to_string(query_args.objection().value().to_ullong()));
-        } else {
-          new_value.append(token);
-        }
-        break;
-      case org:
-        new_value.append(query_args.origin().value_or(token));
-        break;
-      case exp:
-        if (query_args.expiration().has_value()) {
-          new_value.append(std::to_string(get_expiration_time(query_args.expiration().value())));
-        } else {
-          new_value.append(token);
-        }
-        break;
-      case shr:
-        new_value.append(query_args.share().value_or(token));
-        break;
-      case log:
-        if (query_args.monitor().has_value()) {
-          new_value.append(query_args.monitor().value() ? "1" : "0");
-        } else {
-          new_value.append(token);
-        }
-        break;
-      case val:
-        new_value.append(token);
-        break;
-      default:
-        break;
-    }
-    if (count != val) {
-      new_value.append(1, '|');
-    }
-    start = end + 1;
-    count++;
+  auto metadata = decode_metadata(res, user_lookup::assign);
+  if (!metadata) {
+    m_is_valid = false;
+    return;
   }
+  const std::string_view value = res.substr(metadata->m_prefix_length);
 
-  // Append the last token (value)
-  if (start < res.length()) {
-    new_value.append(res.substr(start));
+  if (query_args.user_key().has_value()) {
+    auto owner = user_dictionary::get_instance()->get_or_assign_id(query_args.user_key().value());
+    if (!owner.has_value()) {
+      m_is_valid = false;
+      return;
+    }
+    metadata->m_owner = owner.value();
   }
-
-#ifdef DEBUG
-  if (count != metadata_prefix_fields) {
-    throw std::invalid_argument("Invalid GDPR metadata format");
+  metadata->m_purpose = query_args.purpose().value_or(metadata->m_purpose);
+  metadata->m_objection = query_args.objection().value_or(metadata->m_objection);
+  metadata->m_origin = query_args.origin().value_or(metadata->m_origin);
+  if (query_args.expiration().has_value()) {
+    metadata->m_expiration = get_expiration_time(query_args.expiration().value());
   }
-#endif
+  if (query_args.share().has_value() && !set_share_list(metadata.value(), query_args.share().value())) {
+    m_is_valid = false;
+    return;
+  }
+  metadata->m_monitor = query_args.monitor().value_or(metadata->m_monitor);
+
+  m_purpose = metadata->m_purpose;
+  m_objection = metadata->m_objection;
+  m_expiration = metadata->m_expiration;
 
-  m_new_value = std::move(new_value);
+  // the updated metadata refer to their own policy record, a value in a legacy format is converted as well
+  m_new_value.reserve(encoded_metadata_size(metadata.value()) + value.size());
+  append_metadata_reference(m_new_value, metadata.value());
+  m_new_value.append(value);
 }
 
 // query_rewriter::~query_rewriter()
 // {
 // }
 
+auto query_rewriter::is_valid() const -> bool
+{
+  return this->m_is_valid;
+}
+
 auto query_rewriter::new_value() const -> std::string
 {
   return this->m_new_value;
 }
 
+auto query_rewriter::purpose() const -> purpose_bitmap
+{
+  return this->m_purpose;
+}
+
+auto query_rewriter::objection() const -> purpose_bitmap
+{
+  return this->m_objection;
+}
+
+auto query_rewriter::expiration() const -> int64_t
+{
+  return this->m_expiration;
+}
+
 } // namespace controller
\ No newline at end of file
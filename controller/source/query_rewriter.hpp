@@ -1,7 +1,6 @@
 #pragma once
 
 #include <string>
-#include <bitset>
 #include <sstream>
 #include <unordered_map>
 
@@ -27,10 +26,24 @@ public:
                           const query &query_args);
   // ~query_rewriter();
 
+  /*
+   * false if the metadata of the new value cannot be built: the id of a new user cannot be
+   * persisted (see user_dictionary), or the current value has no valid metadata. Nothing is to be stored then.
+   */
+  [[nodiscard]] auto is_valid() const -> bool;
   [[nodiscard]] auto new_value() const -> std::string;
+  /* purposes/objections of the rewritten value -- set by the INSERTION and PUTM constructors */
+  [[nodiscard]] auto purpose() const -> purpose_bitmap;
+  [[nodiscard]] auto objection() const -> purpose_bitmap;
+  /* absolute expiration time of the rewritten value (0: none) -- set by the INSERTION and PUTM constructors */
+  [[nodiscard]] auto expiration() const -> int64_t;
 
 private:
   std::string m_new_value;
+  purpose_bitmap m_purpose;
+  purpose_bitmap m_objection;
+  int64_t m_expiration{0};
+  bool m_is_valid{true};
 };
 
 } // namespace controller
\ No newline at end of file
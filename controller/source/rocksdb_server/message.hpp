@@ -1,94 +1,164 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <span>
 #include <string>
-#include <unordered_set>
+#include <string_view>
 #include <vector>
-#include <boost/algorithm/string.hpp>
 
+/**
+ * Version of the binary message format, checked on every request.
+*/
+constexpr uint8_t protocol_version = 1;
+
+/**
+ * Every message (request or response) is preceded by its length as a 4-byte integer.
+*/
+constexpr size_t message_length_size = sizeof(uint32_t);
+
+/**
+ * Largest request the server accepts, i.e., the header with the key and the value (or the batch entries).
+ * The length prefix comes from the client: above it, the session is closed instead of allocating the buffer.
+*/
+constexpr uint32_t max_message_size = uint32_t{64} << 20U;
+
+/**
+ * Operation codes of the requests.
+*/
+enum class message_opcode : uint8_t {
+  invalid = 0,
+  get = 1,
+  put = 2,
+  del = 3,
+  getm = 4,
+  putm = 5,
+  mget = 6,
+  mput = 7,
+  mdel = 8,
+  stats = 9,
+  scan = 10,
+  cput = 11,
+  cdel = 12
+};
+
+inline auto opcode_name(message_opcode opcode) -> std::string_view {
+  switch (opcode) {
+    case message_opcode::get: return "get";
+    case message_opcode::put: return "put";
+    case message_opcode::del: return "del";
+    case message_opcode::getm: return "getm";
+    case message_opcode::putm: return "putm";
+    case message_opcode::mget: return "mget";
+    case message_opcode::mput: return "mput";
+    case message_opcode::mdel: return "mdel";
+    case message_opcode::stats: return "stats";
+    case message_opcode::scan: return "scan";
+    case message_opcode::cput: return "cput";
+    case message_opcode::cdel: return "cdel";
+    default: return "invalid";
+  }
+}
+
+/* Multi-key requests carry a list of batch entries instead of a single key and value */
+inline auto is_batch_opcode(message_opcode opcode) -> bool {
+  return opcode == message_opcode::mget || opcode == message_opcode::mput || opcode == message_opcode::mdel;
+}
+
+/**
+ * Fixed-size header of a request. Integers are encoded in host byte order.
+*/
+struct request_header
+{
+  uint8_t m_version {protocol_version};
+  message_opcode m_opcode {message_opcode::invalid};
+  uint16_t m_reserved {0};
+  uint32_t m_key_length {0};
+  uint32_t m_value_length {0};
+  uint32_t m_padding {0};
+  int64_t m_expiration {0};
+};
+static_assert(sizeof(request_header) == 24, "request_header must not contain implicit padding");
 
 /**
  * query_message is the expected message protocol sent from clients to the server.
- * 
- * The raw message contains three fields: command, key, and value.
+ *
+ * The raw message contains a fixed-size request_header followed by the key and the value bytes:
+ *   "<version:1><opcode:1><reserved:2><key length:4><value length:4><padding:4><expiration:8><key><value>"
+ * The expiration (absolute time in seconds, 0 for none) and the value are only used by put/putm.
+ * Keys and values are length-prefixed, so they can contain any byte (including spaces).
+ * For the multi-key requests (mget/mput/mdel) the key is empty and the value holds the batch entries.
+ * For scan the key is the cursor, i.e., the last key of the previous page (empty for the first page),
+ * and the value holds the maximum number of keys of the page as a 4-byte integer (see scan_page_size).
+ * For cput (compare-and-put) the value holds the value the key is expected to hold followed by the new value
+ * (see append_compare_and_put_value), and for cdel (compare-and-delete) the value is the expected value.
+ *
+ * A deserialized query_message does not own any data: key and value are views
+ * over the receive buffer, which must outlive the message.
  * is_valid field is populated after receiving and parsing the raw message.
- * 
- * Expected message protocol: "<command> <key> <value>"
- * 
- * Example query_messages         || Their meanings
- *  "del key_to_delete"           -> delete the entry with key "key_to_delete"
- *  "get key_to_get"              -> get the entry with key "key_to_get"
- *  "put key_to_put value_to_put" -> put entry with {"key_to_put": "value_to_put"}
 */
 class query_message
 {
 public:
   query_message() = default;
 
-  auto serialize() -> std::string
+  /* Fill the header for the current fields, to be sent along with the key and the value buffers */
+  auto serialize_header() const -> request_header
   {
-    std::string result;
-    result.append(m_command).append(" ").append(m_key);
-    if (!m_value.empty()) {
-      result.append(" ").append(m_value);
-    }
-    return result;
+    request_header header;
+    header.m_opcode = m_opcode;
+    header.m_key_length = static_cast<uint32_t>(m_key.size());
+    header.m_value_length = static_cast<uint32_t>(m_value.size());
+    header.m_expiration = m_expiration;
+    return header;
   }
 
-  static auto deserialize(std::string_view raw_query) -> query_message
+  static auto deserialize(std::span<const char> raw_query) -> query_message
   {
-    static const std::unordered_set<std::string_view> valid_query_types {
-      "get", "put", "del", "getm", "putm"
-    };
-
     query_message request;
 
-    // Find command (first token)
-    const size_t first_space = raw_query.find(' ');
-    if (first_space == std::string_view::npos) [[unlikely]] {
-      std::cerr << "Invalid query: missing command\n";
+    if (raw_query.size() < sizeof(request_header)) [[unlikely]] {
+      std::cerr << "Invalid query: truncated header\n";
       return request; // invalid
     }
-    request.m_command = raw_query.substr(0, first_space);
+    request_header header;
+    std::memcpy(&header, raw_query.data(), sizeof(request_header));
 
-    // Command validation
-    if (!valid_query_types.count(request.m_command)) [[unlikely]] {
-      std::cerr << "Invalid command: " << request.m_command << '\n';
-      return request;
+    if (header.m_version != protocol_version) [[unlikely]] {
+      std::cerr << "Invalid query: unsupported protocol version " << static_cast<int>(header.m_version) << '\n';
+      return request; // invalid
     }
-
-    // Find key (second token)
-    size_t key_start = first_space + 1;
-    if (key_start >= raw_query.size()) [[unlikely]] {
-      std::cerr << "Invalid query: missing key\n";
+    if (header.m_opcode == message_opcode::invalid || header.m_opcode > message_opcode::cdel) [[unlikely]] {
+      std::cerr << "Invalid command: " << static_cast<int>(header.m_opcode) << '\n';
       return request; // invalid
     }
-    size_t key_end = raw_query.find(' ', key_start);
-    request.m_key = raw_query.substr(key_start, key_end - key_start);
-
-    // Handle value (remaining string)
-    if (request.m_command == "put") {
-      size_t value_start = key_end + 1;
-      if (value_start >= raw_query.size()) [[unlikely]] {
-        std::cerr << "Invalid put query: missing value\n";
-        return request; // invalid
-      }
-      request.m_value = raw_query.substr(value_start);
+    const size_t payload_size = raw_query.size() - sizeof(request_header);
+    if (static_cast<size_t>(header.m_key_length) + header.m_value_length != payload_size) [[unlikely]] {
+      std::cerr << "Invalid query: key and value lengths do not match the message size\n";
+      return request; // invalid
     }
 
+    const char* payload = raw_query.data() + sizeof(request_header);
+    request.m_opcode = header.m_opcode;
+    request.m_key = std::string_view(payload, header.m_key_length);
+    request.m_value = std::string_view(payload + header.m_key_length, header.m_value_length);
+    request.m_expiration = header.m_expiration;
     request.m_is_valid = true;
     return request;
   }
 
-  auto get_command() -> std::string_view {
-    return m_command;
+  auto get_opcode() const -> message_opcode {
+    return m_opcode;
   }
 
-  void set_command(std::string_view command) {
-    m_command = command;
+  void set_opcode(message_opcode opcode) {
+    m_opcode = opcode;
   }
 
-  auto get_key() -> std::string_view {
+  auto get_key() const -> std::string_view {
     return m_key;
   }
 
@@ -96,7 +166,7 @@ public:
     m_key = key;
   }
 
-  auto get_value() -> std::string_view {
+  auto get_value() const -> std::string_view {
     return m_value;
   }
 
@@ -104,6 +174,14 @@ public:
     m_value = value;
   }
 
+  auto get_expiration() const -> int64_t {
+    return m_expiration;
+  }
+
+  void set_expiration(int64_t expiration) {
+    m_expiration = expiration;
+  }
+
   auto get_is_valid() const -> bool {
     return m_is_valid;
   }
@@ -111,29 +189,186 @@ public:
   void set_is_valid(bool is_valid) {
     m_is_valid = is_valid;
   }
-  
+
 private:
-  std::string_view m_command;
+  message_opcode m_opcode {message_opcode::invalid};
   std::string_view m_key;
   std::string_view m_value;
+  int64_t m_expiration {0};
   bool m_is_valid {false};
 };
 
 
+/**
+ * Fixed-size header of an entry of a multi-key request.
+*/
+struct batch_entry_header
+{
+  uint32_t m_key_length {0};
+  uint32_t m_value_length {0};
+  int64_t m_expiration {0};
+};
+static_assert(sizeof(batch_entry_header) == 16, "batch_entry_header must not contain implicit padding");
+
+/**
+ * An entry of a multi-key request. Like the query_message, it does not own its data.
+ *
+ * Raw batch: "(<key length:4><value length:4><expiration:8><key><value>)*"
+ * mget and mdel entries have an empty value and no expiration.
+*/
+struct batch_entry
+{
+  std::string_view m_key;
+  std::string_view m_value;
+  int64_t m_expiration {0};
+};
+
+inline auto append_batch_entry(std::string& raw_batch, std::string_view key,
+                               std::string_view value = {}, int64_t expiration = 0) -> void
+{
+  batch_entry_header header;
+  header.m_key_length = static_cast<uint32_t>(key.size());
+  header.m_value_length = static_cast<uint32_t>(value.size());
+  header.m_expiration = expiration;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  raw_batch.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  raw_batch.append(key);
+  raw_batch.append(value);
+}
+
+/* Parse the raw batch into entries (views over it); returns false if it is malformed */
+inline auto parse_batch_entries(std::string_view raw_batch, std::vector<batch_entry>& entries) -> bool
+{
+  entries.clear();
+  while (!raw_batch.empty()) {
+    if (raw_batch.size() < sizeof(batch_entry_header)) [[unlikely]] {
+      return false;
+    }
+    batch_entry_header header;
+    std::memcpy(&header, raw_batch.data(), sizeof(header));
+    raw_batch.remove_prefix(sizeof(header));
+    if (static_cast<size_t>(header.m_key_length) + header.m_value_length > raw_batch.size()) [[unlikely]] {
+      return false;
+    }
+    entries.push_back({raw_batch.substr(0, header.m_key_length),
+                       raw_batch.substr(header.m_key_length, header.m_value_length),
+                       header.m_expiration});
+    raw_batch.remove_prefix(static_cast<size_t>(header.m_key_length) + header.m_value_length);
+  }
+  return true;
+}
+
+/**
+ * The data of a successful mget response holds one result per requested key, in the request order:
+ *   "(<found:1><value length:4><value>)*"
+*/
+inline auto append_batch_result(std::string& raw_results, bool found, std::string_view value = {}) -> void
+{
+  raw_results.push_back(found ? '\x01' : '\x00');
+  const auto value_length = static_cast<uint32_t>(value.size());
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  raw_results.append(reinterpret_cast<const char*>(&value_length), sizeof(value_length));
+  raw_results.append(value);
+}
+
+inline auto parse_batch_results(std::string_view raw_results, size_t num_keys)
+    -> std::optional<std::vector<std::optional<std::string>>>
+{
+  std::vector<std::optional<std::string>> results;
+  results.reserve(num_keys);
+  while (!raw_results.empty()) {
+    uint32_t value_length = 0;
+    if (raw_results.size() < 1 + sizeof(value_length)) [[unlikely]] {
+      return std::nullopt;
+    }
+    const bool found = raw_results[0] == '\x01';
+    std::memcpy(&value_length, raw_results.data() + 1, sizeof(value_length));
+    raw_results.remove_prefix(1 + sizeof(value_length));
+    if (value_length > raw_results.size()) [[unlikely]] {
+      return std::nullopt;
+    }
+    if (found) {
+      results.emplace_back(raw_results.substr(0, value_length));
+    } else {
+      results.emplace_back(std::nullopt);
+    }
+    raw_results.remove_prefix(value_length);
+  }
+  if (results.size() != num_keys) [[unlikely]] {
+    return std::nullopt;
+  }
+  return results;
+}
+
+/* The maximum number of keys of a scan page, encoded in the value of the scan request */
+inline auto scan_page_size(std::string_view raw_count) -> std::optional<uint32_t>
+{
+  uint32_t count = 0;
+  if (raw_count.size() != sizeof(count)) [[unlikely]] {
+    return std::nullopt;
+  }
+  std::memcpy(&count, raw_count.data(), sizeof(count));
+  return count;
+}
+
+/**
+ * The value of a cput request: the key is only written if it holds the expected value (not expired),
+ *  which the server checks and applies atomically with respect to all the other writes.
+ *
+ * Raw value: "<expected length:4><expected><value>"
+*/
+struct compare_and_put_value
+{
+  std::string_view m_expected;
+  std::string_view m_value;
+};
+
+inline auto append_compare_and_put_value(std::string& raw_value, std::string_view expected,
+                                         std::string_view value) -> void
+{
+  const auto expected_length = static_cast<uint32_t>(expected.size());
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  raw_value.append(reinterpret_cast<const char*>(&expected_length), sizeof(expected_length));
+  raw_value.append(expected);
+  raw_value.append(value);
+}
+
+inline auto parse_compare_and_put_value(std::string_view raw_value) -> std::optional<compare_and_put_value>
+{
+  uint32_t expected_length = 0;
+  if (raw_value.size() < sizeof(expected_length)) [[unlikely]] {
+    return std::nullopt;
+  }
+  std::memcpy(&expected_length, raw_value.data(), sizeof(expected_length));
+  raw_value.remove_prefix(sizeof(expected_length));
+  if (expected_length > raw_value.size()) [[unlikely]] {
+    return std::nullopt;
+  }
+  return compare_and_put_value{raw_value.substr(0, expected_length), raw_value.substr(expected_length)};
+}
+
 /**
  * response_message is the expected message protocol sent from server to clients.
- * 
+ *
  * The raw message contains two fields: is_success, data.
  * is_success represents the result of an operation.
- * data represents the value retrieved in case of a successful get operation, 
+ * data represents the value retrieved in case of a successful get operation,
  *  or the response message otherwise.
- * 
- * Expected message protocol: "<status:{1 for success, 0 for failure}>: <data>"
- * 
- * Example query_messages         || Their meanings
- *  "1"                           -> put/get/del the entry
- *  "0"                           -> operation failed
- *  "1 value_retrieved"           -> get operation succeded and value corresponding to key is "value_retrieved"
+ *
+ * Expected message protocol: "<status:1 byte, 1 for success, 0 for failure><data>"
+ * The server writes the status and the data as separate buffers (scatter-gather),
+ *  so the data is sent directly from the memory rocksdb returns.
+ *
+ * Example response_messages      || Their meanings
+ *  "\x01"                        -> put/get/del the entry
+ *  "\x00"                        -> operation failed
+ *  "\x01value_retrieved"         -> get operation succeded and value corresponding to key is "value_retrieved"
+ *  "\x01<batch results>"         -> mget operation succeeded, see append_batch_result
+ *  "\x01<statistics>"            -> stats operation returns the statistics of the server as text
+ *  "\x01\x01" / "\x01\x00"       -> cput/cdel wrote the value or deleted the key / the key did not hold the
+ *                                    expected value
+ *  "\x01<batch entries>"         -> scan operation returns the next keys in order, as batch entries without value;
+ *                                    the scan is complete when the page holds fewer keys than requested
 */
 class response_message
 {
@@ -146,30 +381,18 @@ public:
   {
   }
 
-  auto serialize() -> std::string
-  {
-    std::string result;
-    result.append(m_is_success ? "1" : "0")
-          .append(m_data);
-    return result;
+  static auto status_byte(bool is_success) -> char {
+    return is_success ? '\x01' : '\x00';
   }
 
-  static auto deserialize(const std::string& raw_response) -> response_message
+  static auto deserialize(std::span<const char> raw_response) -> response_message
   {
-    static response_message invalid_response {/*is_success=*/false, ""};
-    static std::unordered_set<char> valid_response_types {'0', '1'};
-    
-    if (raw_response.empty()) {
-      return invalid_response;
-    }
-
-    char valid = raw_response[0];
-    if (!valid_response_types.contains(valid)) {
-      return invalid_response;
+    if (raw_response.empty() || (raw_response[0] != status_byte(true) && raw_response[0] != status_byte(false))) {
+      return response_message {/*is_success=*/false, ""};
     }
 
-    std::string response_data = raw_response.substr(sizeof(valid));
-    return response_message {valid == '1', response_data};
+    return response_message {raw_response[0] == status_byte(true),
+                             std::string(raw_response.data() + 1, raw_response.size() - 1)};
   }
 
   auto op_is_successful() const -> bool {
@@ -177,7 +400,7 @@ public:
   }
 
   auto get_data() -> std::string {
-    return m_data;
+    return std::move(m_data);
   }
 
 private:
@@ -1,12 +1,120 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <vector>
 
+#include <rocksdb/compaction_filter.h>
 #include <rocksdb/db.h>
+#include <rocksdb/iterator.h>
 #include <rocksdb/options.h>
+#include <rocksdb/statistics.h>
 
 #include "message.hpp"
+#include "server_stats.hpp"
+#include "tuning_profile.hpp"
+#include "write_coalescer.hpp"
+
+/**
+ * Stored values are prefixed with a format marker and their absolute expiration time in seconds (0 for none),
+ * so that the server can drop expired values without understanding the (encrypted) GDPR metadata.
+ *
+ * Stored value layout: "<4-byte marker><int64 expiration><value>"
+ *
+ * Values written before the expiration header have no marker: they are returned as is and never expire
+ * (their expiration, if any, is still enforced by the controller from the GDPR metadata).
+*/
+constexpr std::array<char, 4> value_header_marker = {'\0', 'G', 'X', '1'};
+constexpr size_t value_header_size = value_header_marker.size() + sizeof(int64_t);
+
+inline auto now_in_seconds() -> int64_t {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+           std::chrono::system_clock::now().time_since_epoch()
+         ).count();
+}
+
+inline auto has_value_header(const rocksdb::Slice& stored_value) -> bool {
+  return stored_value.size() >= value_header_size &&
+         std::memcmp(stored_value.data(), value_header_marker.data(), value_header_marker.size()) == 0;
+}
+
+inline auto stored_expiration(const rocksdb::Slice& stored_value) -> int64_t {
+  int64_t expiration = 0;
+  if (has_value_header(stored_value)) {
+    std::memcpy(&expiration, stored_value.data() + value_header_marker.size(), sizeof(int64_t));
+  }
+  return expiration;
+}
+
+/* The value without its header, or the whole legacy value */
+inline auto stored_data(const rocksdb::Slice& stored_value) -> rocksdb::Slice {
+  if (!has_value_header(stored_value)) {
+    return stored_value;
+  }
+  return {stored_value.data() + value_header_size, stored_value.size() - value_header_size};
+}
+
+inline auto is_expired(int64_t expiration, int64_t now) -> bool {
+  return expiration != 0 && expiration < now;
+}
+
+/**
+ * expiration_compaction_filter drops the expired values when their sst files are compacted.
+*/
+class expiration_compaction_filter : public rocksdb::CompactionFilter
+{
+public:
+  auto Filter(int /*level*/, const rocksdb::Slice& /*key*/, const rocksdb::Slice& existing_value,
+              std::string* /*new_value*/, bool* /*value_changed*/) const -> bool override
+  {
+    return is_expired(stored_expiration(existing_value), now_in_seconds());
+  }
+
+  auto Name() const -> const char* override {
+    return "expiration_compaction_filter";
+  }
+};
+
+/**
+ * proxy_result holds the outcome of a request executed by the rocksdb_proxy.
+ *
+ * For get requests, m_value pins the value inside rocksdb (block cache or memtable)
+ * and m_data points to the actual data after the stored value header (see stored_data),
+ * so the response can be sent without copying the value.
+ * For multi-key requests, m_data points to m_batch_data, which holds the encoded batch results
+ *  (for cput and cdel, whether the key held the expected value, i.e., whether it was written).
+ * It is reused across requests: reset() releases the pinned memory and keeps the buffers' capacity.
+*/
+class proxy_result
+{
+public:
+  auto reset() -> void {
+    m_is_success = false;
+    m_value.Reset();
+    m_data = rocksdb::Slice();
+    for (auto& value : m_batch_values) {
+      value.Reset();
+    }
+    m_batch_data.clear();
+  }
+
+  bool m_is_success {false};
+  rocksdb::PinnableSlice m_value;
+  rocksdb::Slice m_data;
+
+  // scratch space of the multi-key requests
+  std::vector<batch_entry> m_batch_entries;
+  std::vector<rocksdb::Slice> m_batch_keys;
+  std::vector<rocksdb::PinnableSlice> m_batch_values;
+  std::vector<rocksdb::Status> m_batch_statuses;
+  std::vector<std::string> m_batch_stored_values;
+  std::vector<write_op> m_batch_ops;
+  std::string m_batch_data;
+};
 
 /**
  * rocksdb_proxy is a wrapper to interact with the rocksdb.
@@ -14,70 +122,324 @@
 class rocksdb_proxy
 {
 public:
-  explicit rocksdb_proxy(const std::string& db_path)
+  explicit rocksdb_proxy(const std::string& db_path,
+                         const write_coalescer_options& write_options = write_coalescer_options(),
+                         const tuning_profile& profile = tuning_profile())
   {
     rocksdb::Options options;
+    profile.apply(options);
     options.create_if_missing = true;
+    options.compaction_filter = &m_compaction_filter;
+    // rocksdb internal tickers and histograms, also dumped to its LOG every stats_dump_period_sec
+    m_statistics = rocksdb::CreateDBStatistics();
+    options.statistics = m_statistics;
     rocksdb::Status status = rocksdb::DB::Open(options, db_path, &m_rocksdb);
     if (!status.ok()) {
       std::cerr << "Failed to open database: " << status.ToString()
                 << std::endl;
+      return;
     }
+    m_write_coalescer = std::make_unique<write_coalescer>(m_rocksdb, write_options, m_stats.write_queueing());
   }
 
-  auto execute(query_message query) -> response_message 
+  /**
+   * Execute the request into the result.
+   * Reads complete in place and return true. Writes are committed asynchronously by the write_coalescer:
+   *  execute returns false, and on_written() is called from the commit thread once the result is set.
+   * The query and the result must stay valid until then.
+  */
+  template <typename on_written_t>
+  auto execute(const query_message& query, proxy_result& result, on_written_t&& on_written) -> bool
   {
+    result.reset();
     if (!query.get_is_valid()) {
-      return response_message{/*is_success*/false, ""};
+      return true;
     }
 
-    if (query.get_command() == "get" || query.get_command() == "getm" ) {
-      return get(query.get_key());
+    const auto start = server_stats::clock::now();
+    const message_opcode opcode = query.get_opcode();
+    if (is_write(opcode)) {
+      execute_write(query, result,
+        [this, &result, opcode, start, on_written = std::forward<on_written_t>(on_written)](bool is_success) {
+          result.m_is_success = is_success;
+          m_stats.operation(opcode).record(elapsed_since(start));
+          on_written();
+        });
+      return false;
+    }
+    execute_read(query, result);
+    m_stats.operation(opcode).record(elapsed_since(start));
+    return true;
+  }
+
+  auto stats() -> server_stats& {
+    return m_stats;
+  }
+
+  /* Server latency histograms followed by the rocksdb statistics */
+  auto stats_to_string() const -> std::string
+  {
+    std::string stats = m_stats.to_string();
+    if (m_statistics) {
+      stats += "rocksdb statistics:\n";
+      stats += m_statistics->ToString();
     }
-    if (query.get_command() == "put" || query.get_command() == "putm") {
-      return put(query.get_key(), query.get_value());
+    return stats;
+  }
+
+  auto print_stats() const -> void
+  {
+    if (m_write_coalescer) {
+      m_write_coalescer->print_stats();
     }
-    return del(query.get_key());
   }
 
-  ~rocksdb_proxy() { delete m_rocksdb; }
+  ~rocksdb_proxy()
+  {
+    m_write_coalescer.reset();
+    delete m_rocksdb;
+  }
 
   rocksdb_proxy() = default;
-  rocksdb_proxy(const rocksdb_proxy&) = default;
-  auto operator=(rocksdb_proxy const&) -> rocksdb_proxy& = default;
-  rocksdb_proxy(rocksdb_proxy&&) = default;
-  auto operator=(rocksdb_proxy&&) -> rocksdb_proxy& = default;
+  rocksdb_proxy(const rocksdb_proxy&) = delete;
+  auto operator=(rocksdb_proxy const&) -> rocksdb_proxy& = delete;
+  // not movable: the options of the db keep the address of m_compaction_filter
+  rocksdb_proxy(rocksdb_proxy&&) = delete;
+  auto operator=(rocksdb_proxy&&) -> rocksdb_proxy& = delete;
 
 private:
+  static auto is_write(message_opcode opcode) -> bool
+  {
+    return opcode == message_opcode::put || opcode == message_opcode::putm || opcode == message_opcode::del ||
+           opcode == message_opcode::mput || opcode == message_opcode::mdel || opcode == message_opcode::cput ||
+           opcode == message_opcode::cdel;
+  }
+
+  auto execute_write(const query_message& query, proxy_result& result, write_completion completion) -> void
+  {
+    write_condition condition;
+    switch (query.get_opcode()) {
+      case message_opcode::put:
+      case message_opcode::putm:
+        put(query.get_key(), query.get_value(), query.get_expiration(), result);
+        break;
+      case message_opcode::del:
+        del(query.get_key(), result);
+        break;
+      case message_opcode::cput: {
+        auto cput_value = parse_compare_and_put_value(query.get_value());
+        if (!cput_value.has_value()) {
+          std::cerr << "Invalid query: malformed compare-and-put value" << std::endl;
+          completion(false);
+          return;
+        }
+        put(query.get_key(), cput_value->m_value, query.get_expiration(), result);
+        condition = expected_value_condition(query.get_key(), cput_value->m_expected, result);
+        break;
+      }
+      case message_opcode::cdel:
+        del(query.get_key(), result);
+        condition = expected_value_condition(query.get_key(), query.get_value(), result);
+        break;
+      case message_opcode::mput:
+      case message_opcode::mdel:
+        if (!parse_batch_entries(query.get_value(), result.m_batch_entries)) {
+          std::cerr << "Invalid query: malformed batch entries" << std::endl;
+          completion(false);
+          return;
+        }
+        if (query.get_opcode() == message_opcode::mput) {
+          multi_put(result);
+        } else {
+          multi_del(result);
+        }
+        break;
+      default:
+        completion(false);
+        return;
+    }
+    m_write_coalescer->write(result.m_batch_ops, std::move(completion), std::move(condition));
+  }
+
+  auto execute_read(const query_message& query, proxy_result& result) -> void
+  {
+    switch (query.get_opcode()) {
+      case message_opcode::get:
+      case message_opcode::getm:
+        get(query.get_key(), result);
+        break;
+      case message_opcode::mget:
+        if (!parse_batch_entries(query.get_value(), result.m_batch_entries)) {
+          std::cerr << "Invalid query: malformed batch entries" << std::endl;
+          return;
+        }
+        multi_get(result);
+        break;
+      case message_opcode::stats:
+        result.m_batch_data = stats_to_string();
+        result.m_data = rocksdb::Slice(result.m_batch_data);
+        result.m_is_success = true;
+        break;
+      case message_opcode::scan:
+        scan(query, result);
+        break;
+      default:
+        break;
+    }
+  }
+
+  std::shared_ptr<rocksdb::Statistics> m_statistics;
+  // latency histograms of the server, shared by all the sessions
+  server_stats m_stats;
+  // must outlive m_rocksdb, as it is referenced by the options the db is opened with
+  expiration_compaction_filter m_compaction_filter;
   rocksdb::DB* m_rocksdb {nullptr};
+  // groups the concurrent writes of the sessions into batches
+  std::unique_ptr<write_coalescer> m_write_coalescer;
 
-  auto get(std::string_view key) -> response_message
+  auto get(std::string_view key, proxy_result& result) -> void
   {
-    std::string value;
     rocksdb::Status status =
-        m_rocksdb->Get(rocksdb::ReadOptions(), key, &value);
-    if (status.ok()) {
-      return response_message{/*is_success*/true, value};
+        m_rocksdb->Get(rocksdb::ReadOptions(), m_rocksdb->DefaultColumnFamily(), key, &result.m_value);
+    // expired values that are not compacted yet are never returned
+    if (status.ok() && !is_expired(stored_expiration(result.m_value), now_in_seconds())) {
+      result.m_is_success = true;
+      result.m_data = stored_data(result.m_value);
     }
-    return response_message{/*is_success*/false, ""};
   }
 
-  auto put(std::string_view key, std::string_view value) -> response_message
+  /* The writes are prepared into the scratch space of the result, which the session keeps until they complete */
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  static auto put(std::string_view key, std::string_view value, int64_t expiration, proxy_result& result) -> void
   {
-    rocksdb::Status status =
-        m_rocksdb->Put(rocksdb::WriteOptions(), key, value);
-    if (status.ok()) {
-      return response_message{/*is_success*/true, ""};
-    } 
-    return response_message{/*is_success*/false, ""};
+    if (result.m_batch_stored_values.empty()) {
+      result.m_batch_stored_values.resize(1);
+    }
+    make_stored_value(result.m_batch_stored_values[0], value, expiration);
+    result.m_batch_ops.clear();
+    result.m_batch_ops.push_back({/*m_is_put=*/true, key, result.m_batch_stored_values[0]});
   }
 
-  auto del(std::string_view key) -> response_message
+  static auto del(std::string_view key, proxy_result& result) -> void
   {
-    rocksdb::Status status = m_rocksdb->Delete(rocksdb::WriteOptions(), key);
-    if (status.ok()) {
-      return response_message{/*is_success*/true, ""};
-    } 
-    return response_message{/*is_success*/false, ""};
+    result.m_batch_ops.clear();
+    result.m_batch_ops.push_back({/*m_is_put=*/false, key, {}});
+  }
+
+  /* The key must hold the expected (unexpired) value; the result data tells whether it did */
+  static auto expected_value_condition(std::string_view key, std::string_view expected, proxy_result& result)
+      -> write_condition
+  {
+    result.m_batch_data.assign(1, '\x00');
+    result.m_data = rocksdb::Slice(result.m_batch_data);
+    return {key, [expected, &result](const rocksdb::Slice* stored_value) {
+      if (stored_value == nullptr || is_expired(stored_expiration(*stored_value), now_in_seconds())) {
+        return false;
+      }
+      const rocksdb::Slice data = stored_data(*stored_value);
+      const bool holds = std::string_view(data.data(), data.size()) == expected;
+      result.m_batch_data[0] = holds ? '\x01' : '\x00';
+      return holds;
+    }};
+  }
+
+  static auto make_stored_value(std::string& stored_value, std::string_view value, int64_t expiration) -> void
+  {
+    stored_value.clear();
+    stored_value.reserve(value_header_size + value.size());
+    stored_value.append(value_header_marker.data(), value_header_marker.size());
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    stored_value.append(reinterpret_cast<const char*>(&expiration), sizeof(int64_t));
+    stored_value.append(value);
+  }
+
+  /* Look up all the keys with a single MultiGet, which batches the block reads of the keys */
+  auto multi_get(proxy_result& result) -> void
+  {
+    const auto& entries = result.m_batch_entries;
+    const size_t num_keys = entries.size();
+    result.m_batch_keys.clear();
+    for (const auto& entry : entries) {
+      result.m_batch_keys.emplace_back(entry.m_key);
+    }
+    if (result.m_batch_values.size() < num_keys) {
+      result.m_batch_values.resize(num_keys);
+    }
+    result.m_batch_statuses.resize(num_keys);
+
+    m_rocksdb->MultiGet(rocksdb::ReadOptions(), m_rocksdb->DefaultColumnFamily(), num_keys,
+                        result.m_batch_keys.data(), result.m_batch_values.data(), result.m_batch_statuses.data());
+
+    const int64_t now = now_in_seconds();
+    for (size_t i = 0; i < num_keys; i++) {
+      const auto& value = result.m_batch_values[i];
+      if (result.m_batch_statuses[i].ok() && !is_expired(stored_expiration(value), now)) {
+        const rocksdb::Slice data = stored_data(value);
+        append_batch_result(result.m_batch_data, /*found=*/true, std::string_view(data.data(), data.size()));
+      } else {
+        append_batch_result(result.m_batch_data, /*found=*/false);
+      }
+    }
+    result.m_is_success = true;
+    result.m_data = rocksdb::Slice(result.m_batch_data);
+  }
+
+  /* All the puts of the request are committed atomically with the same WriteBatch */
+  static auto multi_put(proxy_result& result) -> void
+  {
+    const auto& entries = result.m_batch_entries;
+    // size the stored values first, the write ops keep views to them
+    if (result.m_batch_stored_values.size() < entries.size()) {
+      result.m_batch_stored_values.resize(entries.size());
+    }
+    result.m_batch_ops.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+      make_stored_value(result.m_batch_stored_values[i], entries[i].m_value, entries[i].m_expiration);
+      result.m_batch_ops.push_back({/*m_is_put=*/true, entries[i].m_key, result.m_batch_stored_values[i]});
+    }
+  }
+
+  static auto multi_del(proxy_result& result) -> void
+  {
+    result.m_batch_ops.clear();
+    for (const auto& entry : result.m_batch_entries) {
+      result.m_batch_ops.push_back({/*m_is_put=*/false, entry.m_key, {}});
+    }
+  }
+
+  /* Return the next keys after the cursor in key order, skipping the expired values */
+  auto scan(const query_message& query, proxy_result& result) -> void
+  {
+    auto count = scan_page_size(query.get_value());
+    if (!count.has_value()) {
+      std::cerr << "Invalid query: malformed scan count" << std::endl;
+      return;
+    }
+    const std::string_view cursor = query.get_key();
+    std::unique_ptr<rocksdb::Iterator> iterator(m_rocksdb->NewIterator(rocksdb::ReadOptions()));
+    if (cursor.empty()) {
+      iterator->SeekToFirst();
+    } else {
+      iterator->Seek(cursor);
+      // the cursor itself was returned with the previous page
+      if (iterator->Valid() && std::string_view(iterator->key().data(), iterator->key().size()) == cursor) {
+        iterator->Next();
+      }
+    }
+    const int64_t now = now_in_seconds();
+    for (uint32_t num_keys = 0; num_keys < count.value() && iterator->Valid(); iterator->Next()) {
+      if (is_expired(stored_expiration(iterator->value()), now)) {
+        continue;
+      }
+      const rocksdb::Slice key = iterator->key();
+      append_batch_entry(result.m_batch_data, std::string_view(key.data(), key.size()));
+      num_keys++;
+    }
+    if (!iterator->status().ok()) {
+      std::cerr << "Failed to scan database: " << iterator->status().ToString() << std::endl;
+      return;
+    }
+    result.m_is_success = true;
+    result.m_data = rocksdb::Slice(result.m_batch_data);
   }
 };
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <array>
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <span>
@@ -7,6 +9,7 @@
 #include <thread>
 
 #include "rocksdb_proxy.hpp"
+#include "../common.hpp"
 
 using boost::asio::ip::tcp;
 
@@ -22,76 +25,142 @@ boost::asio::io_context io_context;
  * session class represents a connection handler for a single client.
  * 
  * Given a socket and a rocksdb_proxy, 
- *  it listens the socket asynchronously, parses the requests, executes them, and writes back proper response messages.
+ *  it reads the requests asynchronously, parses and executes them, and writes back proper response messages.
+ * Every step of a request is an async operation whose completion handler starts the next one
+ *  (read length -> read message -> execute -> write response -> read length ...),
+ *  so a session occupies an io_context thread only while a request is being executed.
+ * Reads are executed in place; writes are handed to the write coalescer, which posts their completion
+ *  back to the session, so no io_context thread waits for the commit of a write batch.
+ * The socket is bound to a strand, therefore the handlers of a session never run concurrently.
 */
 class session : public std::enable_shared_from_this<session> {
 public:
   session(tcp::socket socket, std::shared_ptr<rocksdb_proxy> rocksdb_proxy)
       : m_socket(std::move(socket))
       , m_rocksdb_proxy(std::move(rocksdb_proxy))
+      , m_idle_timer(m_socket.get_executor())
   {
   }
 
   void start() {
-    // Set socket timeout in win and unix platforms
-    #ifdef _WIN32
-    DWORD socket_timeout_ms = socket_timeout_seconds * s2ms;
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    setsockopt(m_socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&socket_timeout_ms), sizeof(socket_timeout_ms));
-    #else
-    // Set receive timeout of unix socket. See SO_RCVTIMEO in https://linux.die.net/man/7/socket
-    struct timeval socket_timeout_val{};
-    socket_timeout_val.tv_sec = socket_timeout_seconds;
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    setsockopt(m_socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&socket_timeout_val), sizeof(socket_timeout_val));
-    #endif
-
-    handle_read();
+    do_read_length();
   }
 
 private:
-  void handle_read() {
-    while (m_socket.is_open()) {
-      try {
-        // Read message length
-        // NOLINTNEXTLINE(cppcoreguidelines-avoid-c-arrays,hicpp-avoid-c-arrays,modernize-avoid-c-arrays)
-        char length_buffer[4];  // Assuming message length is a 4-byte integer
-        boost::asio::read(m_socket, boost::asio::buffer(length_buffer, 4));
-        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-        int message_length = *reinterpret_cast<int*>(length_buffer);
-
-        // Read actual message
-        std::vector<char> message_buffer(static_cast<size_t>(message_length));
-        boost::asio::read(m_socket, boost::asio::buffer(message_buffer));
-
-        std::string raw_query(message_buffer.begin(), message_buffer.end());
-        query_message query = query_message::deserialize(raw_query);
-        response_message response = m_rocksdb_proxy->execute(query);
-        std::string raw_response = response.serialize();
-
-        // Send response length
-        int response_size = static_cast<int>(raw_response.size());
-        // Prepend response size to the response
-        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-        raw_response.insert(0, reinterpret_cast<const char*>(&response_size), sizeof(int));
-
-        // Send response
-        boost::asio::write(m_socket, boost::asio::buffer(raw_response));
-
-      } catch(const boost::wrapexcept<boost::system::system_error>& e) {
-        if (e.code() == boost::asio::error::eof) {
-          std::cout << "Client is finished with the queries. Closing the session..." << std::endl;
-        } else {
-          std::cout << "Exception thrown in handle_read: " << e.what() << std::endl;
+  void do_read_length() {
+    reset_idle_timer();
+    auto self(shared_from_this());
+    boost::asio::async_read(m_socket, boost::asio::buffer(&m_message_length, message_length_size),
+      [this, self](boost::system::error_code error_code, size_t /*bytes_transferred*/) {
+        if (error_code) {
+          close(error_code);
+          return;
         }
-        break;
+        if (m_message_length > max_message_size) {
+          close(boost::asio::error::message_size);
+          return;
+        }
+        // Read actual message into the reusable session buffer
+        m_read_start = server_stats::clock::now();
+        m_message_buffer.resize(static_cast<size_t>(m_message_length));
+        do_read_message();
+      });
+  }
+
+  void do_read_message() {
+    auto self(shared_from_this());
+    boost::asio::async_read(m_socket, boost::asio::buffer(m_message_buffer),
+      [this, self](boost::system::error_code error_code, size_t /*bytes_transferred*/) {
+        if (error_code) {
+          close(error_code);
+          return;
+        }
+        m_rocksdb_proxy->stats().network_read().record(elapsed_since(m_read_start));
+        handle_message();
+      });
+  }
+
+  void handle_message() {
+    // The query is parsed in place: its key and value are views over the session buffer
+    auto serialization_start = server_stats::clock::now();
+    query_message query = query_message::deserialize(m_message_buffer);
+    m_serialization_time = elapsed_since(serialization_start);
+
+    // The write completion runs on the commit thread of the write coalescer: resume on the session strand
+    auto self(shared_from_this());
+    const bool is_complete = m_rocksdb_proxy->execute(query, m_result, [this, self]() {
+      boost::asio::post(m_socket.get_executor(), [this, self]() { send_response(); });
+    });
+    if (is_complete) {
+      send_response();
+    }
+  }
+
+  void send_response() {
+    // Response: "<length><status>" header followed by the data, which is sent directly from rocksdb's memory
+    const auto serialization_start = server_stats::clock::now();
+    m_response_status = response_message::status_byte(m_result.m_is_success);
+    m_response_length = static_cast<uint32_t>(sizeof(m_response_status) + m_result.m_data.size());
+    m_rocksdb_proxy->stats().serialization().record(m_serialization_time + elapsed_since(serialization_start));
+
+    do_write_response();
+  }
+
+  void do_write_response() {
+    const std::array<boost::asio::const_buffer, 3> response_buffers {
+      boost::asio::buffer(&m_response_length, message_length_size),
+      boost::asio::buffer(&m_response_status, sizeof(m_response_status)),
+      boost::asio::buffer(m_result.m_data.data(), m_result.m_data.size())
+    };
+    auto self(shared_from_this());
+    const auto write_start = server_stats::clock::now();
+    boost::asio::async_write(m_socket, response_buffers,
+      [this, self, write_start](boost::system::error_code error_code, size_t /*bytes_transferred*/) {
+        m_rocksdb_proxy->stats().network_write().record(elapsed_since(write_start));
+        // Release the value pinned in rocksdb
+        m_result.reset();
+        if (error_code) {
+          close(error_code);
+          return;
+        }
+        do_read_length();
+      });
+  }
+
+  // Close the connection of clients that have been idle for socket_timeout_seconds
+  void reset_idle_timer() {
+    m_idle_timer.expires_after(std::chrono::seconds(socket_timeout_seconds));
+    auto self(shared_from_this());
+    m_idle_timer.async_wait([this, self](boost::system::error_code error_code) {
+      if (error_code != boost::asio::error::operation_aborted) {
+        std::cout << "Client is idle for too long. Closing the session..." << std::endl;
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
       }
+    });
+  }
+
+  void close(boost::system::error_code error_code) {
+    if (error_code == boost::asio::error::eof) {
+      std::cout << "Client is finished with the queries. Closing the session..." << std::endl;
+    } else if (error_code != boost::asio::error::operation_aborted) {
+      std::cout << "Error in session: " << error_code.message() << std::endl;
     }
+    m_idle_timer.cancel();
+    boost::system::error_code ignored;
+    m_socket.close(ignored);
   }
 
   tcp::socket m_socket;
   std::shared_ptr<rocksdb_proxy> m_rocksdb_proxy;
-  boost::asio::streambuf m_buffer;
+  boost::asio::steady_timer m_idle_timer;
+  uint32_t m_message_length {0};
+  std::vector<char> m_message_buffer;
+  proxy_result m_result;
+  server_stats::clock::time_point m_read_start;
+  std::chrono::nanoseconds m_serialization_time {0};
+  uint32_t m_response_length {0};
+  char m_response_status {0};
 };
 
 /**
@@ -104,46 +173,127 @@ private:
 class rocksdb_server {
 public:
   rocksdb_server(uint16_t port,
-                 const std::string& db_path)
+                 const std::string& db_path,
+                 const write_coalescer_options& write_options,
+                 const tuning_profile& profile)
       : m_acceptor(io_context, tcp::endpoint(tcp::v4(), port))
-      , m_socket(io_context)
-      , m_rocksdb_proxy(std::make_shared<rocksdb_proxy>(db_path))
+      , m_rocksdb_proxy(std::make_shared<rocksdb_proxy>(db_path, write_options, profile))
+      , m_stats_timer(io_context)
+      , m_stats_dump_period(profile.m_stats_dump_period_sec)
   {
     std::cout << "Starting server on port: " << port << std::endl;
     do_accept();
+    if (m_stats_dump_period.count() > 0) {
+      schedule_stats_dump();
+    }
+  }
+
+  void print_stats() const {
+    m_rocksdb_proxy->print_stats();
+    std::cout << m_rocksdb_proxy->stats().to_string() << std::flush;
   }
 
 private:
   void do_accept() {
-    std::cout << "Server is waiting to accept a new request!" << std::endl;
-    m_acceptor.async_accept(m_socket, [this](boost::system::error_code error_code) {
-      if (!error_code) {
-        auto session_ptr = std::make_shared<session>(std::move(m_socket), m_rocksdb_proxy);
-        std::thread session_thread([session_ptr]() {
-          session_ptr->start();
-        });
-        session_thread.detach();
+    // Every accepted socket gets its own strand, so that the handlers of a session are serialized
+    m_acceptor.async_accept(boost::asio::make_strand(io_context),
+      [this](boost::system::error_code error_code, tcp::socket socket) {
+        if (!error_code) {
+          socket.set_option(tcp::no_delay(true));
+          std::make_shared<session>(std::move(socket), m_rocksdb_proxy)->start();
+        }
+        do_accept();
+      });
+  }
+
+  // Periodically print the latency histograms of the server (rocksdb dumps its own statistics to its LOG)
+  void schedule_stats_dump() {
+    m_stats_timer.expires_after(m_stats_dump_period);
+    m_stats_timer.async_wait([this](boost::system::error_code error_code) {
+      if (error_code) {
+        return;
       }
-      do_accept();
+      print_stats();
+      schedule_stats_dump();
     });
   }
 
   // tcp connection acceptor to asynchronously accept the connections and delegate the handling to sessions
   tcp::acceptor m_acceptor;
-  tcp::socket m_socket;
   std::shared_ptr<rocksdb_proxy> m_rocksdb_proxy;
+  boost::asio::steady_timer m_stats_timer;
+  std::chrono::seconds m_stats_dump_period;
 };
 
 auto main(int argc, char* argv[]) -> int {
   auto args = std::span(argv, static_cast<size_t>(argc));
 
   try {
-    assert(argc == 3 && "Usage: ./rocksdb_server <port> <db_path>");
+    assert(argc >= 3 && "Usage: ./rocksdb_server <port> <db_path> [--threads <num_threads>] "
+                        "[--sync_writes <true|false>] [--max_batch_size <writes>] [--batch_window_us <us>] "
+                        "[--profile <preset>] [--rocksdb_options <file>] [--stats_dump_period_sec <sec>]");
+
+    // Number of threads serving the io_context, i.e., executing the requests of all sessions
+    std::string threads_arg = get_command_line_argument(args, std::string("--threads"));
+    unsigned int num_threads = threads_arg.empty() ? std::max(1U, std::thread::hardware_concurrency())
+                                                   : static_cast<unsigned int>(std::stoul(threads_arg));
+    if (num_threads == 0) {
+      std::cerr << "--threads must be at least 1" << std::endl;
+      return 1;
+    }
+
+    // Group commit of the writes: durability mode and size/time window of the write batches
+    write_coalescer_options write_options;
+    write_options.m_sync = get_command_line_argument(args, std::string("--sync_writes")) == "true";
+    std::string max_batch_size_arg = get_command_line_argument(args, std::string("--max_batch_size"));
+    if (!max_batch_size_arg.empty()) {
+      write_options.m_max_batch_size = std::stoul(max_batch_size_arg);
+    }
+    std::string batch_window_arg = get_command_line_argument(args, std::string("--batch_window_us"));
+    if (!batch_window_arg.empty()) {
+      write_options.m_window = std::chrono::microseconds(std::stoul(batch_window_arg));
+    }
+
+    // Rocksdb tuning: a preset, optionally overridden by the options of a file
+    std::string profile_arg = get_command_line_argument(args, std::string("--profile"));
+    auto profile = get_tuning_preset(profile_arg.empty() ? "default" : profile_arg);
+    if (!profile.has_value()) {
+      std::cerr << "Unknown rocksdb profile: " << profile_arg
+                << " (available: default, point_lookup, point_lookup_nvme, write_heavy)" << std::endl;
+      return 1;
+    }
+    std::string options_file_arg = get_command_line_argument(args, std::string("--rocksdb_options"));
+    if ((!options_file_arg.empty() && !profile->load_file(options_file_arg)) || !profile->validate()) {
+      return 1;
+    }
+    std::string stats_period_arg = get_command_line_argument(args, std::string("--stats_dump_period_sec"));
+    if (!stats_period_arg.empty()) {
+      profile->m_stats_dump_period_sec = static_cast<unsigned int>(std::stoul(stats_period_arg));
+    }
+    std::cout << "Rocksdb profile: ";
+    profile->print();
+
+    rocksdb_server rocksdb_server(static_cast<uint16_t>(std::stoul(args[1])), args[2], write_options, profile.value());
+    std::cout << "Serving requests with " << num_threads << " threads" << std::endl;
 
-    rocksdb_server rocksdb_server(static_cast<uint16_t>(std::stoul(args[1])), args[2]);
+    // Stop serving on SIGINT/SIGTERM, so that the statistics are reported
+    boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    signals.async_wait([](boost::system::error_code /*error_code*/, int /*signal_number*/) {
+      io_context.stop();
+    });
 
     // run() method is used to dequeue the async operation results and call the respective handlers.
+    // All the threads run the same io_context and pick up the ready handlers of any session.
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads - 1);
+    for (unsigned int i = 1; i < num_threads; i++) {
+      workers.emplace_back([]() { io_context.run(); });
+    }
     io_context.run();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    rocksdb_server.print_stats();
   } catch (std::exception& e) {
     std::cerr << "Exception in Rocksdb server: " << e.what() << std::endl;
     return 1;
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "message.hpp"
+
+/**
+ * latency_histogram records latencies in buckets of powers of two nanoseconds.
+ *
+ * The counters are atomics updated with relaxed ordering, so the sessions of all
+ * threads record into the same histogram without locking. The percentiles are
+ * approximated by the upper bound of the bucket they fall into.
+*/
+class latency_histogram
+{
+public:
+  auto record(std::chrono::nanoseconds latency) -> void
+  {
+    const auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(0, latency.count()));
+    const size_t bucket = std::min<size_t>(num_buckets - 1, static_cast<size_t>(std::bit_width(nanoseconds)));
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum_ns.fetch_add(nanoseconds, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] auto count() const -> uint64_t {
+    return m_count.load(std::memory_order_relaxed);
+  }
+
+  /* Upper bound (in microseconds) of the latency of the given fraction (0-1] of the recorded requests */
+  [[nodiscard]] auto percentile_us(double fraction) const -> double
+  {
+    const uint64_t total = count();
+    if (total == 0) {
+      return 0;
+    }
+    const auto target = static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(total)));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < num_buckets; bucket++) {
+      seen += m_buckets[bucket].load(std::memory_order_relaxed);
+      if (seen >= target && seen != 0) {
+        return static_cast<double>(uint64_t{1} << bucket) / 1000.0;
+      }
+    }
+    return static_cast<double>(uint64_t{1} << (num_buckets - 1)) / 1000.0;
+  }
+
+  [[nodiscard]] auto mean_us() const -> double
+  {
+    const uint64_t total = count();
+    return total == 0 ? 0 : static_cast<double>(m_sum_ns.load(std::memory_order_relaxed)) /
+                              static_cast<double>(total) / 1000.0;
+  }
+
+  auto print(std::ostream& out, std::string_view name) const -> void
+  {
+    out << name << ": count=" << count() << " mean_us=" << mean_us()
+        << " p50_us=" << percentile_us(0.5) << " p99_us=" << percentile_us(0.99)
+        << " p999_us=" << percentile_us(0.999) << '\n';
+  }
+
+private:
+  // bucket i holds the latencies in [2^(i-1), 2^i) ns; the last one everything above ~1 s
+  static constexpr size_t num_buckets = 32;
+
+  std::array<std::atomic<uint64_t>, num_buckets> m_buckets {};
+  std::atomic<uint64_t> m_count {0};
+  std::atomic<uint64_t> m_sum_ns {0};
+};
+
+/**
+ * Latency histograms of the rocksdb_server, to tell the backend stalls apart from the controller overhead:
+ *  - execution time of every operation inside the rocksdb_proxy, per opcode
+ *  - network read time: from the arrival of the length of a request until the whole request is received
+ *  - serialization time: parsing of the request and encoding of the response
+ *  - write queueing time: wait of a write until its batch is committed by the write_coalescer
+ *  - network write time: from the start of the response write until it completes
+*/
+class server_stats
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  auto operation(message_opcode opcode) -> latency_histogram& {
+    return m_operations.at(static_cast<size_t>(opcode));
+  }
+
+  auto network_read() -> latency_histogram& { return m_network_read; }
+  auto serialization() -> latency_histogram& { return m_serialization; }
+  auto write_queueing() -> latency_histogram& { return m_write_queueing; }
+  auto network_write() -> latency_histogram& { return m_network_write; }
+
+  auto to_string() const -> std::string
+  {
+    std::ostringstream out;
+    for (size_t opcode = 1; opcode < num_opcodes; opcode++) {
+      if (m_operations.at(opcode).count() != 0) {
+        m_operations.at(opcode).print(out, opcode_name(static_cast<message_opcode>(opcode)));
+      }
+    }
+    m_network_read.print(out, "network_read");
+    m_serialization.print(out, "serialization");
+    m_write_queueing.print(out, "write_queueing");
+    m_network_write.print(out, "network_write");
+    return out.str();
+  }
+
+private:
+  static constexpr size_t num_opcodes = static_cast<size_t>(message_opcode::cdel) + 1;
+
+  std::array<latency_histogram, num_opcodes> m_operations;
+  latency_histogram m_network_read;
+  latency_histogram m_serialization;
+  latency_histogram m_write_queueing;
+  latency_histogram m_network_write;
+};
+
+/* Time elapsed since start */
+inline auto elapsed_since(server_stats::clock::time_point start) -> std::chrono::nanoseconds {
+  return server_stats::clock::now() - start;
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <rocksdb/cache.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/table.h>
+
+/**
+ * tuning_profile gathers the rocksdb options that matter for the GDPR workloads.
+ *
+ * A profile starts from one of the presets (see get_tuning_preset) and can be
+ * overridden with an options file containing "<option>=<value>" lines, e.g.:
+ *   block_cache_mb=1024
+ *   bloom_bits_per_key=10
+ *   num_levels=7
+ *   compression_per_level=none,none,lz4,lz4,lz4,zstd,zstd
+ * Empty lines and lines starting with '#' are ignored.
+ * The compression list must name one compression per level (see validate).
+*/
+struct tuning_profile
+{
+  // size of the (shared) LRU block cache, 0 keeps the rocksdb default
+  size_t m_block_cache_mb {0};
+  // bits per key of the bloom filters, 0 disables them
+  double m_bloom_bits_per_key {0};
+  // memory budget of all the memtables, split in m_max_write_buffers write buffers
+  size_t m_memtable_budget_mb {0};
+  int m_max_write_buffers {2};
+  // number of background flush and compaction threads
+  int m_max_background_jobs {2};
+  // number of levels of the LSM tree, 0 keeps the rocksdb default
+  int m_num_levels {0};
+  // compression of every level, empty keeps the rocksdb default
+  std::vector<rocksdb::CompressionType> m_compression_per_level;
+  bool m_use_direct_reads {false};
+  bool m_use_direct_io_for_flush_and_compaction {false};
+  // data block hash index, which speeds up the point lookups within a block
+  bool m_data_block_hash_index {false};
+  // keep the index and filter blocks in the block cache, with the level 0 ones pinned
+  bool m_cache_index_and_filter_blocks {false};
+  // period of the statistics dumps (rocksdb LOG and server output), 0 disables them
+  unsigned int m_stats_dump_period_sec {600};
+
+  /* Apply the profile to the options the database is opened with */
+  auto apply(rocksdb::Options& options) const -> void
+  {
+    rocksdb::BlockBasedTableOptions table_options;
+    if (m_block_cache_mb != 0) {
+      table_options.block_cache = rocksdb::NewLRUCache(m_block_cache_mb << 20U);
+    }
+    if (m_bloom_bits_per_key > 0) {
+      table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(m_bloom_bits_per_key));
+      // the filters are built over the whole keys, as all the lookups are point lookups
+      table_options.whole_key_filtering = true;
+    }
+    if (m_data_block_hash_index) {
+      table_options.data_block_index_type = rocksdb::BlockBasedTableOptions::kDataBlockBinaryAndHash;
+    }
+    table_options.cache_index_and_filter_blocks = m_cache_index_and_filter_blocks;
+    table_options.pin_l0_filter_and_index_blocks_in_cache = m_cache_index_and_filter_blocks;
+    options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+
+    if (m_memtable_budget_mb != 0) {
+      options.max_write_buffer_number = std::max(2, m_max_write_buffers);
+      options.write_buffer_size = (m_memtable_budget_mb << 20U) / static_cast<size_t>(options.max_write_buffer_number);
+    }
+    options.max_background_jobs = m_max_background_jobs;
+    if (m_num_levels != 0) {
+      options.num_levels = m_num_levels;
+    }
+    if (!m_compression_per_level.empty()) {
+      options.compression_per_level = m_compression_per_level;
+    }
+    options.use_direct_reads = m_use_direct_reads;
+    options.use_direct_io_for_flush_and_compaction = m_use_direct_io_for_flush_and_compaction;
+    options.stats_dump_period_sec = m_stats_dump_period_sec;
+  }
+
+  /* Override the profile with the options of the file; returns false if the file is invalid */
+  auto load_file(const std::string& path) -> bool
+  {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+      std::cerr << "Failed to open rocksdb options file: " << path << std::endl;
+      return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      const size_t separator = line.find('=');
+      if (separator == std::string::npos || !set_option(line.substr(0, separator), line.substr(separator + 1))) {
+        std::cerr << "Invalid rocksdb option: " << line << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /* Check the consistency of the options, e.g., once overridden by a file; prints the invalid ones */
+  auto validate() const -> bool
+  {
+    const int num_levels = m_num_levels != 0 ? m_num_levels : rocksdb::Options().num_levels;
+    if (num_levels < 1) {
+      std::cerr << "Invalid rocksdb option: num_levels=" << m_num_levels << std::endl;
+      return false;
+    }
+    if (!m_compression_per_level.empty() && m_compression_per_level.size() != static_cast<size_t>(num_levels)) {
+      std::cerr << "Invalid rocksdb options: compression_per_level has " << m_compression_per_level.size()
+                << " levels, num_levels is " << num_levels << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  auto print() const -> void
+  {
+    std::cout << "block_cache_mb=" << m_block_cache_mb
+              << " bloom_bits_per_key=" << m_bloom_bits_per_key
+              << " memtable_budget_mb=" << m_memtable_budget_mb
+              << " max_write_buffers=" << m_max_write_buffers
+              << " max_background_jobs=" << m_max_background_jobs
+              << " num_levels=" << m_num_levels
+              << " compression_levels=" << m_compression_per_level.size()
+              << " use_direct_reads=" << m_use_direct_reads
+              << " use_direct_io_for_flush_and_compaction=" << m_use_direct_io_for_flush_and_compaction
+              << " data_block_hash_index=" << m_data_block_hash_index
+              << " cache_index_and_filter_blocks=" << m_cache_index_and_filter_blocks
+              << " stats_dump_period_sec=" << m_stats_dump_period_sec << std::endl;
+  }
+
+private:
+  auto set_option(std::string_view option, const std::string& value) -> bool
+  {
+    try {
+      if (option == "block_cache_mb") {
+        m_block_cache_mb = std::stoul(value);
+      } else if (option == "bloom_bits_per_key") {
+        m_bloom_bits_per_key = std::stod(value);
+      } else if (option == "memtable_budget_mb") {
+        m_memtable_budget_mb = std::stoul(value);
+      } else if (option == "max_write_buffers") {
+        m_max_write_buffers = std::stoi(value);
+      } else if (option == "max_background_jobs") {
+        m_max_background_jobs = std::stoi(value);
+      } else if (option == "num_levels") {
+        m_num_levels = std::stoi(value);
+      } else if (option == "compression_per_level") {
+        return parse_compression_per_level(value);
+      } else if (option == "use_direct_reads") {
+        m_use_direct_reads = value == "true";
+      } else if (option == "use_direct_io_for_flush_and_compaction") {
+        m_use_direct_io_for_flush_and_compaction = value == "true";
+      } else if (option == "data_block_hash_index") {
+        m_data_block_hash_index = value == "true";
+      } else if (option == "cache_index_and_filter_blocks") {
+        m_cache_index_and_filter_blocks = value == "true";
+      } else if (option == "stats_dump_period_sec") {
+        m_stats_dump_period_sec = static_cast<unsigned int>(std::stoul(value));
+      } else {
+        return false;
+      }
+    } catch (const std::exception&) {
+      return false;
+    }
+    return true;
+  }
+
+  auto parse_compression_per_level(const std::string& value) -> bool
+  {
+    m_compression_per_level.clear();
+    std::stringstream levels(value);
+    std::string level;
+    while (std::getline(levels, level, ',')) {
+      auto compression = parse_compression(level);
+      if (!compression.has_value()) {
+        return false;
+      }
+      m_compression_per_level.push_back(compression.value());
+    }
+    return true;
+  }
+
+  static auto parse_compression(std::string_view name) -> std::optional<rocksdb::CompressionType>
+  {
+    if (name == "none") {
+      return rocksdb::kNoCompression;
+    }
+    if (name == "snappy") {
+      return rocksdb::kSnappyCompression;
+    }
+    if (name == "lz4") {
+      return rocksdb::kLZ4Compression;
+    }
+    if (name == "zstd") {
+      return rocksdb::kZSTD;
+    }
+    return std::nullopt;
+  }
+};
+
+/**
+ * Tuning presets of the rocksdb_server:
+ *  default:           the options rocksdb is opened with when nothing is tuned.
+ *  point_lookup:      the point lookup settings of the rocksdb tuning guide: a large block cache, bloom
+ *                     filters, block hash indexes and uncompressed upper levels.
+ *  point_lookup_nvme: point_lookup with direct I/O for reads, flushes and compactions.
+ *  write_heavy:       larger memtables and more background jobs.
+ * The presets have not been benchmarked on the GDPR workloads yet: they are starting points to be
+ * validated (and overridden with an options file) on the target hardware.
+*/
+inline auto get_tuning_preset(std::string_view name) -> std::optional<tuning_profile>
+{
+  tuning_profile profile;
+  if (name == "default") {
+    return profile;
+  }
+  if (name == "point_lookup" || name == "point_lookup_nvme") {
+    profile.m_block_cache_mb = 1024;
+    profile.m_bloom_bits_per_key = 10;
+    profile.m_memtable_budget_mb = 256;
+    profile.m_max_write_buffers = 4;
+    profile.m_max_background_jobs = 4;
+    profile.m_num_levels = 7;
+    profile.m_compression_per_level = {rocksdb::kNoCompression, rocksdb::kNoCompression, rocksdb::kLZ4Compression,
+                                       rocksdb::kLZ4Compression, rocksdb::kLZ4Compression, rocksdb::kZSTD,
+                                       rocksdb::kZSTD};
+    profile.m_data_block_hash_index = true;
+    profile.m_cache_index_and_filter_blocks = true;
+    if (name == "point_lookup_nvme") {
+      profile.m_use_direct_reads = true;
+      profile.m_use_direct_io_for_flush_and_compaction = true;
+    }
+    return profile;
+  }
+  if (name == "write_heavy") {
+    profile.m_block_cache_mb = 512;
+    profile.m_bloom_bits_per_key = 10;
+    profile.m_memtable_budget_mb = 1024;
+    profile.m_max_write_buffers = 6;
+    profile.m_max_background_jobs = 8;
+    profile.m_num_levels = 7;
+    profile.m_compression_per_level = {rocksdb::kNoCompression, rocksdb::kNoCompression, rocksdb::kLZ4Compression,
+                                       rocksdb::kLZ4Compression, rocksdb::kLZ4Compression, rocksdb::kZSTD,
+                                       rocksdb::kZSTD};
+    return profile;
+  }
+  return std::nullopt;
+}
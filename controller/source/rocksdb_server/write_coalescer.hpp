@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/options.h>
+#include <rocksdb/write_batch.h>
+
+#include "server_stats.hpp"
+
+/**
+ * Configuration of the write_coalescer.
+ *
+ * m_sync: fsync the WAL before acknowledging a batch (durable writes) or leave it to the OS.
+ * m_max_batch_size: maximum number of writes committed with a single WriteBatch
+ *  (a multi-key request is never split, so a single request can exceed it).
+ * m_window: time the commit thread waits for more writes after the first one of a batch; 0 only groups
+ *  the writes that arrived while the previous batch was being committed.
+*/
+struct write_coalescer_options
+{
+  bool m_sync {false};
+  size_t m_max_batch_size {128};
+  std::chrono::microseconds m_window {0};
+};
+
+/**
+ * A single put or delete of a request.
+*/
+struct write_op
+{
+  bool m_is_put;
+  std::string_view m_key;
+  std::string_view m_value;
+};
+
+/* Called with the status of the batch a write was committed with, on the commit thread */
+using write_completion = std::function<void(bool)>;
+
+/**
+ * Condition of a conditional write (compare-and-put/delete): m_holds is called with the value stored for the key
+ *  (nullptr if there is none) right before the ops of the write are added to its batch, which only happens
+ *  if it returns true. The write still completes successfully otherwise, with nothing written.
+*/
+struct write_condition
+{
+  std::string_view m_key;
+  std::function<bool(const rocksdb::Slice*)> m_holds;
+};
+
+/**
+ * write_coalescer groups the concurrent puts and deletes of all sessions into rocksdb::WriteBatches,
+ *  so that many writes share a single WAL append (and fsync, if enabled).
+ *
+ * The writes are queued and committed by a dedicated commit thread: it waits for the first pending write,
+ *  lets the batch fill up for at most the configured window (or until it is full), and commits the pending
+ *  writes with one WriteBatch. Writes that arrive while a batch is committed form the next batch.
+ * Submitting a write never blocks: its completion is called once the batch it joined is committed,
+ *  so the session threads keep serving the other requests meanwhile and the size of a batch is not
+ *  bounded by the number of session threads.
+ * The commit thread is the only writer of the db, so the condition of a conditional write is checked
+ *  atomically with its ops: the writes queued before it are committed first, and no write can land
+ *  between the check and the commit of its batch.
+*/
+class write_coalescer
+{
+public:
+  write_coalescer(rocksdb::DB* rocksdb, const write_coalescer_options& options, latency_histogram& queueing)
+      : m_rocksdb {rocksdb}
+      , m_queueing {queueing}
+      , m_max_batch_size {std::max<size_t>(1, options.m_max_batch_size)}
+      , m_window {options.m_window}
+  {
+    m_write_options.sync = options.m_sync;
+    m_commit_thread = std::thread([this]() { run(); });
+  }
+
+  /* The pending writes are committed before the commit thread stops */
+  ~write_coalescer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_one();
+    m_commit_thread.join();
+  }
+
+  write_coalescer(const write_coalescer&) = delete;
+  auto operator=(const write_coalescer&) -> write_coalescer& = delete;
+  write_coalescer(write_coalescer&&) = delete;
+  auto operator=(write_coalescer&&) -> write_coalescer& = delete;
+
+  /*
+   * Commit the writes of a request atomically, i.e., they end up in the same WriteBatch.
+   * The ops (and the keys and values they view) must stay valid until the completion is called.
+   * With a condition, the ops are only committed if it holds for the stored value of its key.
+   */
+  auto write(std::span<const write_op> ops, write_completion completion, write_condition condition = {}) -> void {
+    if (ops.empty()) {
+      completion(true);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending.push_back({ops, std::move(completion), std::move(condition), server_stats::clock::now()});
+      m_num_pending_ops += ops.size();
+      if (m_pending.size() > 1 && m_num_pending_ops < m_max_batch_size) {
+        // the commit thread is already woken up by the first write of the batch
+        return;
+      }
+    }
+    m_cv.notify_one();
+  }
+
+  auto print_stats() const -> void {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double avg_batch_size =
+      m_num_batches == 0 ? 0 : static_cast<double>(m_num_writes) / static_cast<double>(m_num_batches);
+    std::cout << "Write batches: " << m_num_batches << ", writes: " << m_num_writes
+              << ", average batch size: " << avg_batch_size
+              << ", max batch size: " << m_max_observed_batch_size << std::endl;
+  }
+
+private:
+  /* The writes of a request waiting in the queue, the session keeps them alive until the completion */
+  struct pending_write
+  {
+    std::span<const write_op> m_ops;
+    write_completion m_completion;
+    write_condition m_condition;
+    server_stats::clock::time_point m_submit_time;
+    bool m_is_success {true};
+  };
+
+  auto run() -> void {
+    std::vector<pending_write> batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cv.wait(lock, [this]() { return m_stop || !m_pending.empty(); });
+      if (m_pending.empty()) {
+        return;
+      }
+      // let the batch fill up, then commit the pending writes outside of the lock
+      if (m_window.count() > 0 && !m_stop) {
+        m_cv.wait_for(lock, m_window, [this]() { return m_stop || m_num_pending_ops >= m_max_batch_size; });
+      }
+      // the first write is always committed, the writes beyond the batch size are left for the next batch
+      size_t num_ops = 0;
+      auto batch_end = m_pending.begin();
+      while (batch_end != m_pending.end() &&
+             (batch_end == m_pending.begin() || num_ops + batch_end->m_ops.size() <= m_max_batch_size)) {
+        num_ops += batch_end->m_ops.size();
+        ++batch_end;
+      }
+      batch.assign(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(batch_end));
+      m_pending.erase(m_pending.begin(), batch_end);
+      m_num_pending_ops -= num_ops;
+      // counted before the completions, so that the statistics include every acknowledged write
+      m_num_batches++;
+      m_num_writes += num_ops;
+      m_max_observed_batch_size = std::max(m_max_observed_batch_size, num_ops);
+      lock.unlock();
+
+      commit(batch);
+      for (auto& batched_write : batch) {
+        m_queueing.record(elapsed_since(batched_write.m_submit_time));
+        batched_write.m_completion(batched_write.m_is_success);
+      }
+      batch.clear();
+
+      lock.lock();
+    }
+  }
+
+  /*
+   * Commit the writes with one WriteBatch, unless conditional writes split it: the writes before a conditional
+   *  write are committed first, so that its condition sees them. Sets the status of every write.
+   */
+  auto commit(std::vector<pending_write>& batch) -> void {
+    rocksdb::WriteBatch write_batch;
+    auto uncommitted = batch.begin();
+    for (auto write = batch.begin(); write != batch.end(); ++write) {
+      if (write->m_condition.m_holds) {
+        commit(write_batch, std::span(uncommitted, write));
+        uncommitted = write;
+        if (!condition_holds(*write)) {
+          continue;
+        }
+      }
+      for (const auto& op : write->m_ops) {
+        if (op.m_is_put) {
+          write_batch.Put(op.m_key, op.m_value);
+        } else {
+          write_batch.Delete(op.m_key);
+        }
+      }
+    }
+    commit(write_batch, std::span(uncommitted, batch.end()));
+  }
+
+  /* Commit the write batch of the writes and clear it */
+  auto commit(rocksdb::WriteBatch& write_batch, std::span<pending_write> writes) -> void {
+    if (write_batch.Count() == 0) {
+      return;
+    }
+    rocksdb::Status status = m_rocksdb->Write(m_write_options, &write_batch);
+    if (!status.ok()) {
+      std::cerr << "Failed to write batch: " << status.ToString() << std::endl;
+      for (auto& write : writes) {
+        write.m_is_success = false;
+      }
+    }
+    write_batch.Clear();
+  }
+
+  /* A conditional write whose key cannot be read fails */
+  auto condition_holds(pending_write& write) -> bool {
+    rocksdb::PinnableSlice stored_value;
+    rocksdb::Status status = m_rocksdb->Get(rocksdb::ReadOptions(), m_rocksdb->DefaultColumnFamily(),
+                                            write.m_condition.m_key, &stored_value);
+    if (!status.ok() && !status.IsNotFound()) {
+      std::cerr << "Failed to read the key of a conditional write: " << status.ToString() << std::endl;
+      write.m_is_success = false;
+      return false;
+    }
+    return write.m_condition.m_holds(status.ok() ? &stored_value : nullptr);
+  }
+
+  rocksdb::DB* m_rocksdb;
+  rocksdb::WriteOptions m_write_options;
+  latency_histogram& m_queueing;
+  size_t m_max_batch_size;
+  std::chrono::microseconds m_window;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<pending_write> m_pending;
+  size_t m_num_pending_ops {0};
+  bool m_stop {false};
+
+  uint64_t m_num_batches {0};
+  uint64_t m_num_writes {0};
+  size_t m_max_observed_batch_size {0};
+
+  // started last, once the members it uses are initialized
+  std::thread m_commit_thread;
+};
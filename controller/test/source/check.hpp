@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <source_location>
+
+/*
+ * The assert of the tests, which also checks in the release builds (NDEBUG): unlike assert, its
+ * argument is always evaluated, so the calls under test are never compiled out.
+ */
+inline auto check(bool condition, std::source_location location = std::source_location::current()) -> void {
+  if (!condition) {
+    std::cerr << location.file_name() << ":" << location.line() << ": check failed" << std::endl;
+    std::abort();
+  }
+}
@@ -0,0 +1,168 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "encryption/cipher_engine.hpp"
+
+using controller::cipher_engine;
+
+auto main() -> int
+{
+  cipher_engine* cipher = cipher_engine::get_instance();
+
+  // payload sizes from small metadata-only values up to large objects
+  constexpr std::array<size_t, 5> payload_sizes {100, 1024, 4096, 16384, 65536};
+  // process roughly the same number of bytes for every payload size
+  constexpr size_t bytes_per_size = size_t{256} << 20U;
+
+  for (const size_t payload_size : payload_sizes) {
+    const std::string payload(payload_size, 'x');
+    const size_t iterations = bytes_per_size / payload_size;
+
+    std::string ciphertext;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      auto encrypt_result = cipher->encrypt(payload, cipher_key_type::db_key);
+      check(encrypt_result.m_success);
+      ciphertext = std::move(encrypt_result.m_ciphertext);
+    }
+    std::chrono::duration<double> encrypt_duration = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      auto decrypt_result = cipher->decrypt(ciphertext, cipher_key_type::db_key);
+      check(decrypt_result.m_success && decrypt_result.m_plaintext == payload);
+    }
+    std::chrono::duration<double> decrypt_duration = std::chrono::steady_clock::now() - start;
+
+    // same operations with the caller-provided buffers, which are reused across the iterations
+    std::string buffer(cipher_engine::encrypted_size(payload_size), '\0');
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      auto ciphertext_len = cipher->encrypt(payload, cipher_key_type::db_key, std::span<char>(buffer));
+      check(ciphertext_len.has_value() && ciphertext_len.value() == buffer.size());
+    }
+    std::chrono::duration<double> encrypt_buffer_duration = std::chrono::steady_clock::now() - start;
+
+    std::string plaintext(payload_size, '\0');
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      auto plaintext_len = cipher->decrypt(buffer, cipher_key_type::db_key, std::span<char>(plaintext));
+      check(plaintext_len.has_value() && plaintext_len.value() == payload_size);
+    }
+    std::chrono::duration<double> decrypt_buffer_duration = std::chrono::steady_clock::now() - start;
+    check(plaintext == payload);
+
+    // access check of a value in the split format, which decrypts only its metadata envelope
+    const std::string_view metadata = "user1|1|1|0|origin|0|user2|0|";
+    std::string split(cipher_engine::split_encrypted_size(metadata.size(), payload_size), '\0');
+    auto split_len =
+        cipher->encrypt_split(metadata, payload, cipher_key_type::db_key, std::span<char>(split));
+    check(split_len.has_value());
+    const size_t envelope_size = cipher_engine::message_size(split).value();
+    std::string metadata_plaintext(metadata.size(), '\0');
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      auto metadata_len = cipher->decrypt(std::string_view(split).substr(0, envelope_size), cipher_key_type::db_key,
+                                          std::span<char>(metadata_plaintext));
+      check(metadata_len.has_value() && metadata_len.value() == metadata.size());
+    }
+    std::chrono::duration<double> metadata_duration = std::chrono::steady_clock::now() - start;
+
+    // same check of a non-sensitive value, stored in plaintext: its envelope authenticates the whole value
+    auto plain_split_len = cipher->encrypt_split(metadata, payload, cipher_key_type::db_key, std::span<char>(split),
+                                                 cipher_suite::none);
+    check(plain_split_len.has_value());
+    const std::string_view plain_split = std::string_view(split).substr(0, plain_split_len.value());
+    const size_t plain_envelope_size = cipher_engine::message_size(plain_split).value();
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      auto metadata_len = cipher->decrypt_split_envelope(plain_split, plain_envelope_size, cipher_key_type::db_key,
+                                                         std::span<char>(metadata_plaintext));
+      check(metadata_len.has_value() && metadata_len.value() == metadata.size());
+    }
+    std::chrono::duration<double> plain_metadata_duration = std::chrono::steady_clock::now() - start;
+
+    const double megabytes = static_cast<double>(iterations * payload_size) / (1U << 20U);
+    const auto print_result = [&](std::string_view name, std::chrono::duration<double> duration) {
+      std::cout << name << " " << duration.count() * 1e9 / static_cast<double>(iterations) << " ns/op ("
+                << megabytes / duration.count() << " MB/s)";
+    };
+    std::cout << "payload " << payload_size << " B: ";
+    print_result("encrypt", encrypt_duration);
+    print_result(", decrypt", decrypt_duration);
+    print_result(", encrypt into buffer", encrypt_buffer_duration);
+    print_result(", decrypt into buffer", decrypt_buffer_duration);
+    print_result(", decrypt metadata only", metadata_duration);
+    print_result(", decrypt metadata of a plaintext value", plain_metadata_duration);
+    std::cout << std::endl;
+  }
+
+  // batches of small values, as sent by mput/mget, against the same number of single operations
+  constexpr size_t batch_size = 64;
+  for (const size_t payload_size : {size_t{100}, size_t{1024}}) {
+    const std::string payload(payload_size, 'x');
+    const std::vector<std::string_view> inputs(batch_size, payload);
+    const size_t iterations = bytes_per_size / (payload_size * batch_size);
+
+    std::string buffer(batch_size * cipher_engine::encrypted_size(payload_size), '\0');
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      size_t offset = 0;
+      for (const auto input : inputs) {
+        auto ciphertext_len = cipher->encrypt(input, cipher_key_type::db_key, std::span<char>(buffer).subspan(offset));
+        check(ciphertext_len.has_value());
+        offset += ciphertext_len.value();
+      }
+    }
+    std::chrono::duration<double> single_duration = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::string_view> ciphertexts(batch_size);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      check(cipher->encrypt_batch(inputs, cipher_key_type::db_key, std::span<char>(buffer), ciphertexts));
+    }
+    std::chrono::duration<double> batch_duration = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::optional<std::string>> values(batch_size);
+    std::chrono::duration<double> single_decrypt_duration {0};
+    for (size_t i = 0; i < iterations; i++) {
+      for (size_t j = 0; j < batch_size; j++) {
+        values[j].emplace(ciphertexts[j]);
+      }
+      start = std::chrono::steady_clock::now();
+      for (auto& value : values) {
+        check(cipher->decrypt_in_place(value.value(), cipher_key_type::db_key));
+      }
+      single_decrypt_duration += std::chrono::steady_clock::now() - start;
+    }
+    std::chrono::duration<double> batch_decrypt_duration {0};
+    for (size_t i = 0; i < iterations; i++) {
+      for (size_t j = 0; j < batch_size; j++) {
+        values[j].emplace(ciphertexts[j]);
+      }
+      start = std::chrono::steady_clock::now();
+      const size_t failures = cipher->decrypt_batch_in_place(values, cipher_key_type::db_key);
+      batch_decrypt_duration += std::chrono::steady_clock::now() - start;
+      check(failures == 0);
+    }
+    check(values.front() == payload);
+
+    const auto per_message = [&](std::chrono::duration<double> duration) {
+      return duration.count() * 1e9 / static_cast<double>(iterations * batch_size);
+    };
+    std::cout << "batch of " << batch_size << " x " << payload_size << " B: encrypt singly "
+              << per_message(single_duration) << " ns/msg, encrypt_batch " << per_message(batch_duration)
+              << " ns/msg, decrypt singly " << per_message(single_decrypt_duration)
+              << " ns/msg, decrypt_batch_in_place " << per_message(batch_decrypt_duration) << " ns/msg" << std::endl;
+  }
+
+  return 0;
+}
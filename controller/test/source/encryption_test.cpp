@@ -1,6 +1,10 @@
 #include <iostream>
+#include "check.hpp"
 #include "encryption/cipher_engine.hpp"
-#include <cassert>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
 
 using controller::cipher_engine;
 
@@ -33,7 +37,7 @@ auto main() -> int
         if (decryption_res.m_success) {
             std::cout << "Decryption successful!" << std::endl;
             std::cout << "Decrypted text: " << decryption_res.m_plaintext << std::endl;
-            assert(plaintext == decryption_res.m_plaintext);
+            check(plaintext == decryption_res.m_plaintext);
         } else {
             std::cout << "Decryption failed!" << std::endl;
         }
@@ -41,5 +45,133 @@ auto main() -> int
         std::cout << "Encryption failed!" << std::endl;
     }
 
+    // Every encryption uses a fresh initialization vector
+    auto first = encryption->encrypt(plaintext, cipher_key_type::db_key);
+    auto second = encryption->encrypt(plaintext, cipher_key_type::db_key);
+    check(first.m_success && second.m_success);
+    check(first.m_ciphertext.substr(controller::initialization_vector_offset, controller::initialization_vector_len) !=
+          second.m_ciphertext.substr(controller::initialization_vector_offset, controller::initialization_vector_len));
+
+    // Encryption into a caller-provided buffer and in-place decryption
+    std::string buffer(cipher_engine::encrypted_size(plaintext.size()), '\0');
+    auto ciphertext_len = encryption->encrypt(plaintext, cipher_key_type::db_key, std::span<char>(buffer));
+    check(ciphertext_len.has_value() && ciphertext_len.value() == buffer.size());
+    check(encryption->decrypt_in_place(buffer, cipher_key_type::db_key) && buffer == plaintext);
+
+    // Batch encryption: every ciphertext is independent and decrypts on its own
+    std::vector<std::string_view> batch {"first", "", "third value of the batch"};
+    size_t batch_size = 0;
+    for (auto message : batch) {
+        batch_size += cipher_engine::encrypted_size(message.size());
+    }
+    std::string batch_buffer(batch_size, '\0');
+    std::vector<std::string_view> batch_ciphertexts(batch.size());
+    check(encryption->encrypt_batch(batch, cipher_key_type::db_key, std::span<char>(batch_buffer), batch_ciphertexts));
+    std::vector<std::optional<std::string>> batch_plaintexts;
+    for (size_t i = 0; i < batch.size(); i++) {
+        check(encryption->decrypt(batch_ciphertexts[i], cipher_key_type::db_key).m_plaintext == batch[i]);
+        batch_plaintexts.emplace_back(batch_ciphertexts[i]);
+    }
+    // a tampered ciphertext fails alone, the missing values are skipped
+    batch_plaintexts[0].value().back() ^= 1;
+    batch_plaintexts.emplace_back(std::nullopt);
+    check(encryption->decrypt_batch_in_place(batch_plaintexts, cipher_key_type::db_key) == 1);
+    check(!batch_plaintexts[0].has_value() && !batch_plaintexts[3].has_value());
+    check(batch_plaintexts[1] == batch[1] && batch_plaintexts[2] == batch[2]);
+
+    // Split format: the metadata envelope decrypts alone, the value only with the MAC of its envelope
+    std::string_view metadata = "user1|0|1|0|origin|0|user2|0|";
+    std::string split(cipher_engine::split_encrypted_size(metadata.size(), plaintext.size()), '\0');
+    auto split_len = encryption->encrypt_split(metadata, plaintext, cipher_key_type::db_key, std::span<char>(split));
+    check(split_len.has_value() && split_len.value() == split.size());
+    auto envelope_size = cipher_engine::message_size(split);
+    check(envelope_size.has_value() && envelope_size.value() == cipher_engine::encrypted_size(metadata.size()));
+    check(encryption->decrypt(std::string_view(split).substr(0, envelope_size.value()),
+                              cipher_key_type::db_key).m_plaintext == metadata);
+    std::string split_value(plaintext.size(), '\0');
+    check(encryption->decrypt_split_value(split, envelope_size.value(), cipher_key_type::db_key,
+                                          std::span<char>(split_value)) == plaintext.size());
+    check(split_value == plaintext);
+    // the value does not decrypt without its envelope
+    check(!encryption->decrypt(std::string_view(split).substr(envelope_size.value()), cipher_key_type::db_key).m_success);
+
+    // A non-sensitive value is stored in plaintext behind the same headers, its metadata remain encrypted
+    auto plain_len = encryption->encrypt_split(metadata, plaintext, cipher_key_type::db_key, std::span<char>(split),
+                                               cipher_suite::none);
+    check(plain_len.has_value() && cipher_engine::ciphertext_suite(split) == cipher_suite::aes_128_gcm);
+    check(split.substr(split.size() - plaintext.size()) == plaintext);
+    std::string envelope(split.size(), '\0');
+    check(encryption->decrypt_split_envelope(split, envelope_size.value(), cipher_key_type::db_key,
+                                             std::span<char>(envelope)) == metadata.size());
+    check(envelope.substr(0, metadata.size()) == metadata);
+    // the plaintext value is only returned to a caller that asks for a non-sensitive value
+    check(!encryption->decrypt_split_value(split, envelope_size.value(), cipher_key_type::db_key,
+                                           std::span<char>(split_value)).has_value());
+    check(encryption->decrypt_split_value(split, envelope_size.value(), cipher_key_type::db_key,
+                                          std::span<char>(split_value), /*non_sensitive*/ true) == plaintext.size());
+    // the envelope authenticates the plaintext value: it can be neither modified nor passed as encrypted
+    std::string forged = split;
+    forged.back() ^= 1;
+    check(!encryption->decrypt_split_envelope(forged, envelope_size.value(), cipher_key_type::db_key,
+                                              std::span<char>(envelope)).has_value());
+    forged = split;
+    forged[envelope_size.value()] = controller::format_tag(cipher_suite::aes_128_gcm, 0);
+    check(!encryption->decrypt_split_envelope(forged, envelope_size.value(), cipher_key_type::db_key,
+                                              std::span<char>(envelope)).has_value());
+    // a message downgraded to the none suite is refused
+    std::string downgraded = encryption->encrypt(plaintext, cipher_key_type::db_key).m_ciphertext;
+    downgraded.replace(controller::ciphertext_header_len, plaintext.size(), plaintext);
+    downgraded[0] = controller::format_tag(cipher_suite::none, 0);
+    check(!encryption->decrypt(downgraded, cipher_key_type::db_key).m_success);
+
+    // Every cipher suite, with the ciphertexts of the other suites remaining readable
+    std::vector<std::string> mixed;
+    for (size_t suite = 0; suite < controller::num_cipher_suites; suite++) {
+        check(encryption->set_cipher_suite(cipher_key_type::db_key, static_cast<cipher_suite>(suite)));
+        auto suite_result = encryption->encrypt(plaintext, cipher_key_type::db_key);
+        check(suite_result.m_success && suite_result.m_ciphertext[0] == static_cast<char>(suite));
+        mixed.push_back(std::move(suite_result.m_ciphertext));
+    }
+    // the plaintext messages are only accepted while none is the suite of the key type
+    for (const auto& ciphertext : mixed) {
+        const bool plaintext_message = cipher_engine::ciphertext_suite(ciphertext) == cipher_suite::none;
+        check(encryption->decrypt(ciphertext, cipher_key_type::db_key).m_success == !plaintext_message);
+    }
+    check(encryption->set_cipher_suite(cipher_key_type::db_key, cipher_suite::none));
+    for (const auto& ciphertext : mixed) {
+        check(encryption->decrypt(ciphertext, cipher_key_type::db_key).m_plaintext == plaintext);
+    }
+    check(encryption->set_cipher_suite(cipher_key_type::db_key, cipher_suite::aes_128_gcm));
+    check(controller::parse_cipher_suite("chacha20-poly1305") == cipher_suite::chacha20_poly1305);
+    check(!controller::parse_cipher_suite("aes-192-gcm").has_value());
+
+    // Ciphertexts written before the format tag (AES-128-GCM under the key id 0) remain readable
+    std::string legacy = first.m_ciphertext.substr(controller::format_tag_len);
+    check(cipher_engine::is_legacy_ciphertext(legacy) && !cipher_engine::is_legacy_ciphertext(first.m_ciphertext));
+    check(encryption->decrypt(legacy, cipher_key_type::db_key).m_plaintext == plaintext);
+    check(!encryption->uses_active_key(legacy, cipher_key_type::db_key));
+    check(cipher_engine::upgrade_legacy_ciphertext(legacy) && legacy == first.m_ciphertext);
+
+    // The cached cipher contexts pick up a key change
+    cipher_engine::get_instance()->init_encryption_key("5432109876543210", cipher_key_type::db_key);
+    check(!encryption->decrypt(first.m_ciphertext, cipher_key_type::db_key).m_success);
+    auto rekeyed = encryption->encrypt(plaintext, cipher_key_type::db_key);
+    check(encryption->decrypt(rekeyed.m_ciphertext, cipher_key_type::db_key).m_plaintext == plaintext);
+
+    // Key rotation: the ciphertexts of the previous key remain readable until the key is retired
+    auto rotated_id = encryption->rotate_encryption_key("abcdefghijklmnopqrstuvwxyz012345", cipher_key_type::db_key);
+    check(rotated_id.has_value() && encryption->active_key_id(cipher_key_type::db_key) == rotated_id.value());
+    check(!encryption->uses_active_key(rekeyed.m_ciphertext, cipher_key_type::db_key));
+    check(encryption->decrypt(rekeyed.m_ciphertext, cipher_key_type::db_key).m_plaintext == plaintext);
+    auto rotated = encryption->encrypt(plaintext, cipher_key_type::db_key);
+    check(cipher_engine::ciphertext_key_id(rotated.m_ciphertext) == rotated_id.value());
+    check(encryption->uses_active_key(rotated.m_ciphertext, cipher_key_type::db_key));
+    split_len = encryption->encrypt_split(metadata, plaintext, cipher_key_type::db_key, std::span<char>(split));
+    check(split_len.has_value() && encryption->uses_active_key(split, cipher_key_type::db_key));
+    check(!encryption->retire_encryption_key(cipher_key_type::db_key, rotated_id.value()));
+    check(encryption->retire_encryption_key(cipher_key_type::db_key, 0));
+    check(!encryption->decrypt(rekeyed.m_ciphertext, cipher_key_type::db_key).m_success);
+    check(encryption->decrypt(rotated.m_ciphertext, cipher_key_type::db_key).m_plaintext == plaintext);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "metadata_resolver.hpp"
+#include "kv_client/kv_client.hpp"
+#include "rocksdb_server/rocksdb_proxy.hpp"
+
+/**
+ * kv_client served by an in-process rocksdb_proxy. The requests and the responses go through the
+ * same encoding as the rocksdb_client (framed query_message, batch entries and batch results),
+ * only the socket is left out.
+ */
+class proxy_client : public kv_client
+{
+public:
+  explicit proxy_client(rocksdb_proxy& proxy)
+      : m_proxy {proxy}
+  {
+  }
+
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  auto compare_and_put(std::string_view key, std::string_view expected, std::string_view value,
+                       int64_t expiration) -> std::optional<bool> override {
+    std::string raw_value;
+    append_compare_and_put_value(raw_value, expected, value);
+    response_message response = execute(message_opcode::cput, key, raw_value, expiration);
+    if (!response.op_is_successful()) {
+      return std::nullopt;
+    }
+    return response.get_data() == "\x01";
+  }
+
+  auto compare_and_del(std::string_view key, std::string_view expected) -> std::optional<bool> override {
+    response_message response = execute(message_opcode::cdel, key, expected, 0);
+    if (!response.op_is_successful()) {
+      return std::nullopt;
+    }
+    return response.get_data() == "\x01";
+  }
+
+protected:
+  auto get(std::string_view key) -> std::optional<std::string> override {
+    return single_get(message_opcode::get, key);
+  }
+
+  auto getm(std::string_view key) -> std::optional<std::string> override {
+    return single_get(message_opcode::getm, key);
+  }
+
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  auto put(std::string_view key, std::string_view value, int64_t expiration) -> bool override {
+    return execute(message_opcode::put, key, value, expiration).op_is_successful();
+  }
+
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  auto putm(std::string_view key, std::string_view value, int64_t expiration) -> bool override {
+    return execute(message_opcode::putm, key, value, expiration).op_is_successful();
+  }
+
+  auto del(std::string_view key) -> bool override {
+    return execute(message_opcode::del, key, {}, 0).op_is_successful();
+  }
+
+  auto mget(std::span<const std::string_view> keys) -> std::vector<std::optional<std::string>> override {
+    std::string raw_batch;
+    for (const auto& key : keys) {
+      append_batch_entry(raw_batch, key);
+    }
+    response_message response = execute(message_opcode::mget, {}, raw_batch, 0);
+    check(response.op_is_successful());
+    auto values = parse_batch_results(response.get_data(), keys.size());
+    check(values.has_value());
+    return std::move(values.value());
+  }
+
+  auto mput(std::span<const kv_entry> entries) -> bool override {
+    std::string raw_batch;
+    for (const auto& entry : entries) {
+      append_batch_entry(raw_batch, entry.m_key, entry.m_value, entry.m_expiration);
+    }
+    return execute(message_opcode::mput, {}, raw_batch, 0).op_is_successful();
+  }
+
+  auto mdel(std::span<const std::string_view> keys) -> bool override {
+    std::string raw_batch;
+    for (const auto& key : keys) {
+      append_batch_entry(raw_batch, key);
+    }
+    return execute(message_opcode::mdel, {}, raw_batch, 0).op_is_successful();
+  }
+
+private:
+  rocksdb_proxy& m_proxy;
+
+  auto single_get(message_opcode opcode, std::string_view key) -> std::optional<std::string> {
+    response_message response = execute(opcode, key, {}, 0);
+    if (!response.op_is_successful()) {
+      return std::nullopt;
+    }
+    return response.get_data();
+  }
+
+  // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+  auto execute(message_opcode opcode, std::string_view key, std::string_view value, int64_t expiration)
+      -> response_message {
+    query_message query;
+    query.set_opcode(opcode);
+    query.set_key(key);
+    query.set_value(value);
+    query.set_expiration(expiration);
+    // the framed request as the server receives it
+    const request_header header = query.serialize_header();
+    std::vector<char> raw_query(sizeof(header));
+    std::memcpy(raw_query.data(), &header, sizeof(header));
+    raw_query.insert(raw_query.end(), key.begin(), key.end());
+    raw_query.insert(raw_query.end(), value.begin(), value.end());
+    const query_message received = query_message::deserialize(raw_query);
+
+    // the writes complete on the commit thread of the write coalescer
+    proxy_result result;
+    std::promise<void> written;
+    if (!m_proxy.execute(received, result, [&written]() { written.set_value(); })) {
+      written.get_future().wait();
+    }
+    std::string raw_response(1, response_message::status_byte(result.m_is_success));
+    raw_response.append(result.m_data.data(), result.m_data.size());
+    return response_message::deserialize(raw_response);
+  }
+};
+
+/* A stored value "<metadata>|<payload>" of the owner */
+static auto make_value(std::string_view owner, bool encryption, int64_t expiration, std::string_view payload)
+    -> std::string {
+  controller::gdpr_metadata metadata;
+  metadata.m_owner = controller::user_dictionary::get_instance()->get_or_assign_id(owner).value();
+  metadata.m_encryption = encryption;
+  metadata.m_purpose = controller::purpose_bitmap(0x3ULL);
+  metadata.m_origin = "origin";
+  metadata.m_expiration = expiration;
+  metadata.m_monitor = false;
+  return controller::metadata_to_text(metadata) + std::string(payload);
+}
+
+auto main() -> int
+{
+  #ifdef ENCRYPTION_ENABLED
+    controller::cipher_engine::get_instance()->init_encryption_key("0123456789012345", cipher_key_type::db_key);
+  #endif
+  const std::filesystem::path db_path = std::filesystem::temp_directory_path() / "kv_batch_test_db";
+  std::filesystem::remove_all(db_path);
+  {
+    rocksdb_proxy proxy(db_path.string());
+    proxy_client client(proxy);
+
+    const int64_t now = now_in_seconds();
+    const std::string value1 = make_value("user1", /*encryption=*/true, 0, "value1");
+    const std::string value2 = make_value("user2", /*encryption=*/false, now + 3600, "a non-sensitive value");
+    const std::string value3 = make_value("user3", /*encryption=*/true, now - 10, "expired");
+    const std::string value4 = make_value("user4", /*encryption=*/true, now + 3600, "");
+    const std::array<kv_entry, 4> entries {{
+        {"key1", value1, 0},
+        {"key2", value2, now + 3600},
+        {"key3", value3, now - 10},
+        {"key4", value4, now + 3600},
+    }};
+    check(client.gdpr_mput(entries));
+
+    // mixed hits and misses: the unknown key and the expired value are reported as missing, in key order
+    const std::array<std::string_view, 6> keys {"key4", "unknown", "key1", "key3", "key2", "key1"};
+    const std::array<std::optional<std::string_view>, 6> expected {
+        value4, std::nullopt, value1, std::nullopt, value2, value1};
+    auto values = client.gdpr_mget(keys);
+    check(values.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      check(values[i] == expected[i]);
+      if (!values[i].has_value()) {
+        continue;
+      }
+      // the metadata of every key decode to the ones it was written with
+      auto metadata = controller::decode_metadata(values[i].value());
+      auto written = controller::decode_metadata(expected[i].value());
+      check(metadata.has_value() && written.has_value());
+      check(metadata->m_owner == written->m_owner && metadata->m_encryption == written->m_encryption);
+      check(metadata->m_expiration == written->m_expiration && metadata->m_purpose == written->m_purpose);
+      check(values[i]->substr(metadata->m_prefix_length) == expected[i]->substr(written->m_prefix_length));
+    }
+    // the single-key and the batched paths read the same values
+    check(client.gdpr_get("key2") == value2 && !client.gdpr_get("key3").has_value());
+    check(client.gdpr_getm("key1") == controller::preserve_only_gdpr_metadata(value1));
+
+    // the deletion of existing and missing keys, then all the keys are missing
+    const std::array<std::string_view, 3> deleted_keys {"key1", "key2", "unknown"};
+    check(client.gdpr_mdel(deleted_keys));
+    values = client.gdpr_mget(keys);
+    check(!values[1].has_value() && !values[2].has_value() && !values[4].has_value() && !values[5].has_value());
+    check(values[0] == value4);
+
+    // empty batches
+    check(client.gdpr_mput(std::span<const kv_entry>{}));
+    check(client.gdpr_mget(std::span<const std::string_view>{}).empty());
+    check(client.gdpr_mdel(std::span<const std::string_view>{}));
+
+    // the compare-and-put only writes over the expected value
+    check(client.compare_and_put("key5", "", "v1", 0) == false && !client.gdpr_get("key5").has_value());
+    check(client.gdpr_put("key5", value1));
+    check(client.compare_and_put("key4", value1, "v1", 0) == false && client.gdpr_get("key4") == value4);
+
+    // the values of the previous key are rewritten once, the ones written meanwhile are left alone
+    #ifdef ENCRYPTION_ENABLED
+      check(client.gdpr_rekey("key5") == rekey_result::skipped);
+      check(controller::cipher_engine::get_instance()->rotate_encryption_key("5432109876543210", cipher_key_type::db_key)
+                .has_value());
+      check(client.gdpr_rekey("key5") == rekey_result::rewritten);
+      check(client.gdpr_get("key5") == value1);
+      check(client.gdpr_rekey("key5") == rekey_result::skipped);
+      check(client.gdpr_rekey("unknown") == rekey_result::skipped);
+    #else
+      check(client.gdpr_rekey("key5") == rekey_result::skipped);
+    #endif
+
+    // the conditional delete keeps a value put since it was read
+    auto stored = client.gdpr_get_stored("key5");
+    check(stored.has_value() && client.gdpr_seal("key5", stored.value()).has_value());
+    check(client.gdpr_put("key5", value4));
+    check(client.gdpr_del_if("key5", stored.value()) == false && client.gdpr_get("key5") == value4);
+    stored = client.gdpr_get_stored("key5");
+    check(client.gdpr_del_if("key5", stored.value()) == true && !client.gdpr_get("key5").has_value());
+    check(client.gdpr_del_if("key5", stored.value()) == false);
+  }
+  std::filesystem::remove_all(db_path);
+  std::cout << "kv batch test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,304 @@
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "gdpr_filter.hpp"
+#include "metadata_resolver.hpp"
+#include "purpose_registry.hpp"
+
+using controller::gdpr_metadata;
+using controller::query;
+
+auto main() -> int
+{
+  // a typical prefix: a few purposes and objections, an expiration time and a short share list
+  auto *dictionary = controller::user_dictionary::get_instance();
+  gdpr_metadata metadata;
+  metadata.m_owner = dictionary->get_or_assign_id("user1").value();
+  metadata.m_encryption = true;
+  metadata.m_purpose = controller::purpose_bitmap(0x8000'0000'0000'1013ULL);
+  metadata.m_objection = controller::purpose_bitmap(0x24ULL);
+  metadata.m_origin = "origin";
+  metadata.m_expiration = 1'700'000'000;
+  controller::set_share_list(metadata, "user2,user3,user4");
+  metadata.m_monitor = true;
+
+  constexpr std::array<size_t, 3> value_sizes {0, 100, 1024};
+  constexpr size_t iterations = size_t{1} << 22U;
+
+  for (const size_t value_size : value_sizes) {
+    const std::string payload(value_size, 'x');
+    const std::string text = controller::metadata_to_text(metadata) + payload;
+    std::string binary;
+    controller::append_metadata(binary, metadata);
+    binary.append(payload);
+    std::string reference;
+    controller::append_metadata_reference(reference, metadata);
+    reference.append(payload);
+    check(controller::is_binary_metadata(binary) && !controller::is_binary_metadata(text));
+    check(controller::is_current_metadata(reference) && reference.size() < binary.size());
+
+    // all formats decode to the same metadata and locate the same value
+    for (const std::string_view value :
+         {std::string_view(text), std::string_view(binary), std::string_view(reference)}) {
+      auto decoded = controller::decode_metadata(value);
+      check(decoded.has_value());
+      check(decoded->m_owner == metadata.m_owner && decoded->m_encryption == metadata.m_encryption);
+      check(decoded->m_purpose == metadata.m_purpose && decoded->m_objection == metadata.m_objection);
+      check(decoded->m_origin == metadata.m_origin && decoded->m_expiration == metadata.m_expiration);
+      check(decoded->m_share == metadata.m_share && decoded->m_share_overflow == metadata.m_share_overflow);
+      check(decoded->m_monitor == metadata.m_monitor);
+      check(value.substr(decoded->m_prefix_length) == payload);
+      check(controller::metadata_prefix_length(value) == decoded->m_prefix_length);
+      check(controller::remove_gdpr_metadata(std::string(value)) == payload);
+      check(controller::preserve_only_gdpr_metadata(std::string(value)) == controller::metadata_to_text(metadata));
+    }
+
+    const auto measure = [&](std::string_view value) {
+      size_t checksum = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; i++) {
+        auto decoded = controller::decode_metadata(value);
+        checksum += decoded->m_purpose.count() + decoded->m_share.count() + static_cast<size_t>(decoded->m_expiration);
+      }
+      std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+      check(checksum != 0);
+      return std::pair{duration.count() * 1e9 / static_cast<double>(iterations), checksum};
+    };
+    const auto [text_ns, text_checksum] = measure(text);
+    const auto [binary_ns, binary_checksum] = measure(binary);
+    const auto [reference_ns, reference_checksum] = measure(reference);
+    check(text_checksum == binary_checksum && binary_checksum == reference_checksum);
+
+    // an owner, share and purpose check through the lazy view, which decodes only these fields
+    const auto measure_view = [&](std::string_view value) {
+      size_t checksum = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; i++) {
+        const controller::metadata_view view(value);
+        checksum += static_cast<size_t>(view.owner() == metadata.m_owner || view.is_shared_with(3)) +
+                    static_cast<size_t>(view.purpose().contains_all(metadata.m_purpose));
+      }
+      std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+      check(checksum != 0);
+      return duration.count() * 1e9 / static_cast<double>(iterations);
+    };
+    const double text_view_ns = measure_view(text);
+    const double binary_view_ns = measure_view(binary);
+    const double reference_view_ns = measure_view(reference);
+
+    std::cout << "value " << value_size << " B: text prefix " << text.size() - value_size << " B, decode "
+              << text_ns << " ns/op, access check view " << text_view_ns << " ns/op; binary prefix "
+              << binary.size() - value_size << " B, decode " << binary_ns << " ns/op, access check view "
+              << binary_view_ns << " ns/op; policy reference prefix " << reference.size() - value_size
+              << " B, decode " << reference_ns << " ns/op, access check view " << reference_view_ns << " ns/op"
+              << std::endl;
+  }
+
+  // the strings of the binary format are length-prefixed and may contain the text delimiter
+  metadata.m_origin = "a|b";
+  std::string binary;
+  controller::append_metadata(binary, metadata);
+  binary.append("value|with|delimiters");
+  check(controller::decode_metadata(binary)->m_origin == "a|b");
+  check(controller::remove_gdpr_metadata(binary) == "value|with|delimiters");
+
+  // the users beyond the share bitmap are listed after the header
+  std::string share_list;
+  for (int user = 0; user < controller::num_users + 2; user++) {
+    share_list.append("sharee").append(std::to_string(user)).append(1, ',');
+  }
+  controller::set_share_list(metadata, share_list);
+  check(!metadata.m_share_overflow.empty());
+  binary.clear();
+  controller::append_metadata(binary, metadata);
+  const controller::metadata_view view(binary);
+  check(view.is_valid() && view.prefix_length() == binary.size());
+  check(view.is_shared_with(metadata.m_share_overflow.back()) && !view.is_shared_with(UINT32_MAX));
+  check(view.is_shared_with(dictionary->find_id("sharee0").value()));
+  check(controller::decode_metadata(binary)->m_share_overflow == metadata.m_share_overflow);
+  share_list.pop_back();
+  check(controller::get_share_list(metadata).size() == share_list.size());
+
+  // version 1 of the binary prefix, with the user keys as strings, is still read
+  controller::metadata_header_v1 header_v1;
+  header_v1.m_user_key_length = 5;
+  header_v1.m_origin_length = 6;
+  header_v1.m_share_length = 5;
+  header_v1.m_purpose = 3;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  std::string binary_v1(reinterpret_cast<const char*>(&header_v1), sizeof(header_v1));
+  binary_v1.append("user1").append("origin").append("user2").append("value");
+  auto decoded_v1 = controller::decode_metadata(binary_v1);
+  check(decoded_v1.has_value() && decoded_v1->m_owner == dictionary->find_id("user1").value());
+  check(decoded_v1->m_origin == "origin" && decoded_v1->m_purpose.word(0) == 3);
+  check(controller::metadata_view(binary_v1).is_shared_with(dictionary->find_id("user2").value()));
+  check(controller::remove_gdpr_metadata(binary_v1) == "value");
+  // their reads do not assign ids to the unknown users, which neither own nor are shared the value
+  const size_t num_user_ids = dictionary->size();
+  header_v1.m_user_key_length = 8;
+  header_v1.m_share_length = 12;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  std::string unknown_v1(reinterpret_cast<const char*>(&header_v1), sizeof(header_v1));
+  unknown_v1.append("stranger").append("origin").append("user2,nobody").append("value");
+  auto decoded_unknown = controller::decode_metadata(unknown_v1);
+  check(decoded_unknown.has_value() && decoded_unknown->m_owner == controller::unknown_user);
+  check(decoded_unknown->m_share_overflow.empty() && decoded_unknown->m_share.count() == 1);
+  check(dictionary->size() == num_user_ids && !dictionary->find_id("stranger").has_value());
+  // the writes that convert the value to the current format assign them
+  decoded_unknown = controller::decode_metadata(unknown_v1, controller::user_lookup::assign);
+  check(decoded_unknown->m_owner == dictionary->find_id("stranger").value());
+  check(dictionary->size() == num_user_ids + 2);
+
+  // the values with the same metadata but their expiration share one policy record
+  auto *store = controller::policy_store::get_instance();
+  std::string reference;
+  controller::append_metadata_reference(reference, metadata);
+  const size_t num_policies = store->size();
+  metadata.m_expiration = 42;
+  std::string other_reference;
+  controller::append_metadata_reference(other_reference, metadata);
+  check(store->size() == num_policies && reference.size() == sizeof(controller::metadata_reference));
+  check(reference.substr(0, offsetof(controller::metadata_reference, m_expiration)) ==
+        other_reference.substr(0, offsetof(controller::metadata_reference, m_expiration)));
+  other_reference.append("value");
+  const controller::metadata_view reference_view(other_reference);
+  check(reference_view.is_valid() && reference_view.expiration() == 42);
+  check(reference_view.is_shared_with(metadata.m_share_overflow.back()));
+  check(controller::remove_gdpr_metadata(other_reference) == "value");
+  // a reference to an unknown policy record is rejected
+  other_reference[offsetof(controller::metadata_reference, m_policy_id)] ^= 1;
+  check(!controller::decode_metadata(other_reference).has_value());
+
+  // the checks of a session policy are compiled once, and specialized with the conditions of every query
+  gdpr_metadata policy_metadata;
+  policy_metadata.m_owner = dictionary->get_or_assign_id("user1").value();
+  controller::set_bitmap(policy_metadata.m_purpose, "purpose1,purpose4,purpose7");
+  controller::set_bitmap(policy_metadata.m_objection, "purpose2");
+  policy_metadata.m_origin = "origin";
+  policy_metadata.m_expiration = 4'000'000'000;
+  controller::set_share_list(policy_metadata, "user2,user3");
+  std::string policy_value;
+  controller::append_metadata_reference(policy_value, policy_metadata);
+  policy_value.append("value");
+  const controller::default_policy session_policy(
+      "user_policy -sessionKey user1 -encryption false -purpose purpose1,purpose4 -objection purpose0 "
+      "-origin origin -expTime 0 -objShare user2 -monitor false");
+  const controller::policy_validator session_validator(session_policy);
+  const controller::gdpr_filter filter(policy_value);
+  const auto validates = [&](std::string_view predicates) {
+    const std::string input = R"(query(get("key1")))" + std::string(predicates);
+    const query policy_query(input);
+    check(policy_query.error() == controller::query_error::none);
+    // the compiled checks agree with the generic path
+    const bool valid = filter.validate(session_validator.specialize(policy_query));
+    check(valid == filter.validate(policy_query, session_policy));
+    return valid;
+  };
+  check(validates(""));
+  check(validates(R"(&sessionKey("user3"))") && !validates(R"(&sessionKey("user4"))") && !validates(R"(&sessionKey("nobody"))"));
+  check(validates(R"(&objPurIs("purpose7"))") && !validates(R"(&objPurIs("purpose2"))") && !validates(R"(&objPurIs("purpose3"))"));
+  check(validates(R"(&objOrigIs("origin"))") && !validates(R"(&objOrigIs("elsewhere"))"));
+  check(validates(R"(&objShareIs("user2,user3"))") && !validates(R"(&objShareIs("user2,user4"))"));
+  check(!validates(R"(&objShareIs("nobody"))") && !validates(R"(&objShareIs("sharee70"))"));
+  check(validates(R"(&objExpIs("3999999999"))") && !validates(R"(&objExpIs("4000000001"))"));
+  // an unknown session user is not the owner of a legacy value whose owner is unknown as well
+  header_v1.m_purpose = UINT64_MAX;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  unknown_v1.replace(0, sizeof(header_v1), reinterpret_cast<const char*>(&header_v1), sizeof(header_v1));
+  const query owner_query(R"(query(get("key1"))&sessionKey("stranger"))");
+  check(controller::gdpr_filter(unknown_v1).validate(session_validator.specialize(owner_query)));
+  unknown_v1.replace(sizeof(header_v1), 8, "outsider");
+  const query unknown_query(R"(query(get("key1"))&sessionKey("someone"))");
+  check(!controller::gdpr_filter(unknown_v1).validate(session_validator.specialize(unknown_query)));
+
+  const std::string policy_input = R"(query(get("key1"))&objPurIs("purpose1")&objOrigIs("origin"))";
+  const query policy_query(policy_input);
+  const auto measure_policy = [&](auto validate) {
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      checksum += static_cast<size_t>(validate());
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    check(checksum == iterations);
+    return duration.count() * 1e9 / static_cast<double>(iterations);
+  };
+  const double generic_ns = measure_policy([&] { return filter.validate(policy_query, session_policy); });
+  const double compiled_ns = measure_policy([&] { return filter.validate(session_validator.specialize(policy_query)); });
+  const controller::policy_validator query_validator = session_validator.specialize(policy_query);
+  const double specialized_ns = measure_policy([&] { return filter.validate(query_validator); });
+  std::cout << "policy checks of a query: generic " << generic_ns << " ns/op, compiled session " << compiled_ns
+            << " ns/op, specialized validator " << specialized_ns << " ns/op" << std::endl;
+
+  // the purpose names are resolved by the perfect hash of the registry
+  constexpr size_t lookups = size_t{1} << 20U;
+  size_t lookup_checksum = 0;
+  auto lookup_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < lookups; i++) {
+    controller::purpose_bitmap bits;
+    controller::set_bitmap(bits, "purpose1,purpose7,purpose42");
+    lookup_checksum += bits.count();
+  }
+  std::chrono::duration<double> lookup_duration = std::chrono::steady_clock::now() - lookup_start;
+  check(lookup_checksum == 3 * lookups);
+  std::cout << "purpose list of 3 names: " << lookup_duration.count() * 1e9 / static_cast<double>(lookups)
+            << " ns/op" << std::endl;
+
+  // a registry beyond 64 purposes: the words of the bitmaps beyond the first follow the header
+  auto *registry = controller::purpose_registry::get_instance();
+  std::vector<std::string> names;
+  for (int purpose = 0; purpose < 200; purpose++) {
+    names.push_back("marketing-" + std::to_string(purpose));
+  }
+  check(registry->load(names) && registry->size() == names.size());
+  for (size_t purpose = 0; purpose < names.size(); purpose++) {
+    check(registry->find(names[purpose]) == purpose && registry->name(purpose) == names[purpose]);
+  }
+  check(!registry->find("purpose1").has_value() && !registry->find("marketing-200").has_value());
+  names.push_back("marketing-0");
+  check(!registry->load(names) && registry->size() == names.size() - 1);
+  metadata.m_purpose.reset();
+  metadata.m_objection.reset();
+  metadata.m_origin = "origin";
+  controller::set_bitmap(metadata.m_purpose, "marketing-1,marketing-130");
+  controller::set_bitmap(metadata.m_objection, "marketing-70");
+  check(metadata.m_purpose.count() == 2 && metadata.m_purpose.test(130) && metadata.m_objection.test(70));
+  check(controller::get_purposes_string(metadata.m_purpose) == "marketing-1,marketing-130,");
+  check(!controller::set_bitmap(metadata.m_purpose, "marketing-1,purpose1"));
+  binary.clear();
+  controller::append_metadata(binary, metadata);
+  check(binary.size() == controller::encoded_metadata_size(metadata));
+  reference.clear();
+  controller::append_metadata_reference(reference, metadata);
+  const std::string text = controller::metadata_to_text(metadata);
+  for (const std::string_view value : {std::string_view(binary), std::string_view(reference), std::string_view(text)}) {
+    auto decoded = controller::decode_metadata(value);
+    check(decoded.has_value() && decoded->m_prefix_length == value.size());
+    check(decoded->m_purpose == metadata.m_purpose && decoded->m_objection == metadata.m_objection);
+    check(decoded->m_share_overflow == metadata.m_share_overflow && decoded->m_origin == metadata.m_origin);
+    const controller::metadata_view purpose_view(value);
+    check(purpose_view.purpose() == metadata.m_purpose && purpose_view.objection() == metadata.m_objection);
+    check(purpose_view.is_shared_with(metadata.m_share_overflow.back()) && purpose_view.origin() == "origin");
+    check(purpose_view.purpose().contains_all(controller::purpose_bitmap().set(130)));
+    check(!purpose_view.objection().intersects(metadata.m_purpose));
+  }
+
+  // truncated or malformed prefixes are rejected
+  check(!controller::decode_metadata(std::string_view(binary).substr(0, 20)).has_value());
+  check(!controller::decode_metadata(std::string_view(binary).substr(0, 42)).has_value());
+  check(!controller::decode_metadata("user1|1|x|0|origin|0|user2|0|value").has_value());
+  check(!controller::decode_metadata("user1|1|1|0|origin").has_value());
+  check(!controller::decode_metadata("user1|1|0x|0|origin|0|user2|0|value").has_value());
+  check(!controller::decode_metadata("user1|1|0xg1|0|origin|0|user2|0|value").has_value());
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string_view>
+
+#include "query.hpp"
+
+/* The fields of the query are views into the input */
+static auto within(std::string_view field, std::string_view input) -> bool
+{
+  return field.empty() || (field.data() >= input.data() && field.data() + field.size() <= input.data() + input.size());
+}
+
+static auto within(std::optional<std::string_view> field, std::string_view input) -> bool
+{
+  return !field.has_value() || within(field.value(), input);
+}
+
+// NOLINTNEXTLINE(readability-identifier-naming)
+extern "C" auto LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) -> int
+{
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  const std::string_view input(reinterpret_cast<const char*>(data), size);
+  const controller::query parsed(input);
+
+  // a query is either valid with a known operation, or rejected with an error and the invalid operation
+  if ((parsed.error() == controller::query_error::none) == (parsed.opcode() == controller::operation::invalid) ||
+      parsed.opcode() >= controller::num_operations) {
+    std::abort();
+  }
+  if (!within(parsed.key(), input) || !within(parsed.value(), input) || !within(parsed.log_key(), input) ||
+      !within(parsed.user_key(), input) || !within(parsed.origin(), input) || !within(parsed.share(), input) ||
+      !within(parsed.cond_origin(), input) || !within(parsed.cond_share(), input)) {
+    std::abort();
+  }
+  // an execution binds the key and the value of the input to the predicates of its template
+  static const controller::prepared_queries prepared = [] {
+    controller::prepared_queries templates;
+    templates.prepare(R"(query(prepare("get"))&sessionKey("user1")&objPurIs("purpose1")&objExpIs("10"))");
+    templates.prepare(R"(query(prepare("put"))&objPur("purpose1,purpose2")&monitor("true"))");
+    return templates;
+  }();
+  auto bound = prepared.bind(parsed);
+  if (bound.has_value() && (bound->opcode() == controller::operation::execute ||
+                            !within(bound->key(), input) || !within(bound->value(), input))) {
+    std::abort();
+  }
+  return 0;
+}
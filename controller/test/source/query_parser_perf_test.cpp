@@ -0,0 +1,121 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "query.hpp"
+
+using controller::query;
+using controller::query_error;
+
+auto main() -> int
+{
+  // the fields are views into the input
+  const std::string put_input =
+      R"q(query(PUT("gdpr1","a&b(c)"))&sessionKey("user1")&objOrig("src1")&monitor("false")&objObjections("purpose3"))q"
+      R"(&objPur("purpose0,purpose1,purpose2")&objShare("user0")&objExp("3600"))";
+  const query put_query(put_input);
+  check(put_query.error() == query_error::none && put_query.opcode() == controller::operation::put);
+  check(put_query.key() == "gdpr1" && put_query.value() == "a&b(c)");
+  check(put_query.key().data() >= put_input.data() && put_query.key().data() < put_input.data() + put_input.size());
+  check(put_query.user_key() == "user1" && put_query.origin() == "src1" && put_query.share() == "user0");
+  check(put_query.monitor() == false && put_query.expiration() == 3600);
+  check(put_query.purpose()->count() == 3 && put_query.objection()->test(3));
+
+  const query get_query("query(GET(\"key0\"))&objPurIs(\"purpose1,purpose2\")&objExpIs(\"10\")&monitorIs(\"TRUE\")\n");
+  check(get_query.error() == query_error::none && get_query.cmd() == "get" && get_query.key() == "key0");
+  check(get_query.cond_purpose().count() == 2 && get_query.cond_expiration() == 10 && get_query.cond_monitor());
+  check(!get_query.purpose().has_value() && !get_query.user_key().has_value());
+
+  // the spaces between the tokens are skipped, the commands are case-insensitive
+  const query spaced_query(R"(query(Put("1", "VALUE_1")) & sessionKey("user2"))");
+  check(spaced_query.error() == query_error::none && spaced_query.opcode() == controller::operation::put);
+  check(spaced_query.key() == "1" && spaced_query.value() == "VALUE_1" && spaced_query.user_key() == "user2");
+  check(query("query(exit)\n").opcode() == controller::operation::quit);
+  check(query(R"(query(countKeys("purpose1")))").cmd() == "countkeys");
+  check(controller::convert_enum_to_operation(controller::operation::get_logs) == "getLogs");
+  check(query(R"(query(getLogs("dir"))&sessionKey("reg"))").log_key() == "dir");
+  check(query(R"(query(countKeys("purpose1,purpose5")))").cond_purpose().count() == 2);
+
+  // malformed queries are rejected with an error code and the invalid operation
+  const std::array<std::pair<std::string_view, query_error>, 12> invalid_queries = {{
+      {"", query_error::syntax},
+      {R"(query(GET("key0"))&)", query_error::syntax},
+      {R"(query(GET("key0)))", query_error::syntax},
+      {R"(query(PUT("key0")))", query_error::syntax},
+      {R"(query(GET("key0")) trailing)", query_error::syntax},
+      {R"(query(GET("key0"))&objPurIs(purpose1))", query_error::syntax},
+      {R"(query(FETCH("key0")))", query_error::unknown_command},
+      {R"(query(GET("key0"))&!objObjectionsIs("purpose1"))", query_error::syntax},
+      {R"(query(GET("key0"))&objOwnerIs("user1"))", query_error::unsupported_predicate},
+      {R"(query(PUT("key0","v"))&objExp("2015-05-16T05:50:06"))", query_error::invalid_number},
+      {R"(query(PUT("key0","v"))&monitor("yes"))", query_error::invalid_bool},
+      {R"(query(GET("key0"))&objPurIs("purpose1,unknown"))", query_error::unknown_purpose},
+  }};
+  for (const auto& [input, error] : invalid_queries) {
+    const query invalid_query(input);
+    check(invalid_query.error() == error && invalid_query.opcode() == controller::operation::invalid);
+  }
+
+  // the prepared templates keep their decoded predicates, the executions only pass the key and the value
+  controller::prepared_queries prepared;
+  const std::string get_template = R"(query(prepare("GET"))&sessionKey("user1")&objPurIs("purpose1,purpose2"))";
+  const std::string put_template = R"(query(prepare("put"))&sessionKey("user1")&objPur("purpose1")&objExp("60"))";
+  const auto get_id = prepared.prepare(get_template);
+  const auto put_id = prepared.prepare(put_template);
+  check(get_id == 0U && put_id == 1U);
+  check(!prepared.prepare(R"(query(prepare("exit")))").has_value());
+  check(!prepared.prepare(R"(query(GET("key0")))").has_value() && prepared.size() == 2);
+  const std::string get_exec = R"(query(exec("0","key1")))";
+  auto bound_get = prepared.bind(query(get_exec));
+  check(bound_get.has_value() && bound_get->opcode() == controller::operation::get && bound_get->key() == "key1");
+  check(bound_get->user_key() == "user1" && bound_get->cond_purpose().count() == 2);
+  auto bound_put = prepared.bind(query(R"(query(exec("1","key2","")))"));
+  check(bound_put.has_value() && bound_put->opcode() == controller::operation::put && bound_put->value().empty());
+  check(bound_put->key() == "key2" && bound_put->expiration() == 60 && bound_put->purpose()->test(1));
+  check(!prepared.bind(query(R"(query(exec("1","key2")))")).has_value());
+  check(!prepared.bind(query(R"(query(exec("0","key2","value")))")).has_value());
+  check(!prepared.bind(query(R"(query(exec("2","key2")))")).has_value());
+  check(query(R"(query(exec("x","key2")))").error() == query_error::invalid_number);
+
+  // parser throughput on the query shapes of the workload traces
+  const std::string value(1024, 'x');
+  const std::array<std::string, 3> inputs = {
+      R"(query(GET("user6284781860667377211"))&objPurIs("purpose1,purpose2"))",
+      R"(query(PUT("user6284781860667377211",")" + value + R"("))&sessionKey("user1")&objPur("purpose1"))",
+      put_input,
+  };
+  constexpr size_t iterations = size_t{1} << 20U;
+  for (const auto& input : inputs) {
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      const query parsed(input);
+      checksum += parsed.key().size() + parsed.value().size() + parsed.cond_purpose().count();
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    check(checksum != 0);
+    const double seconds = duration.count();
+    std::cout << "query of " << input.size() << " B: " << seconds * 1e9 / static_cast<double>(iterations)
+              << " ns/query, " << static_cast<double>(iterations) / seconds / 1e6 << " Mqueries/s, "
+              << static_cast<double>(iterations * input.size()) / seconds / 1e9 << " GB/s" << std::endl;
+  }
+
+  // the execution of the prepared template of the first query shape
+  size_t prepared_checksum = 0;
+  auto prepared_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    auto bound = prepared.bind(query(get_exec));
+    check(bound.has_value());
+    prepared_checksum += bound->key().size() + bound->cond_purpose().count();
+  }
+  std::chrono::duration<double> prepared_duration = std::chrono::steady_clock::now() - prepared_start;
+  check(prepared_checksum == 6 * iterations);
+  std::cout << "prepared query of " << get_exec.size()
+            << " B: " << prepared_duration.count() * 1e9 / static_cast<double>(iterations) << " ns/query" << std::endl;
+
+  return 0;
+}
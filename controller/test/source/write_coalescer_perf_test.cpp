@@ -0,0 +1,102 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/options.h>
+
+#include "check.hpp"
+#include "rocksdb_server/server_stats.hpp"
+#include "rocksdb_server/write_coalescer.hpp"
+
+/* A run of the benchmark: the coalescing of the writes and the shape of the requests */
+struct write_run
+{
+  std::string_view m_name;
+  size_t m_max_batch_size;
+  std::chrono::microseconds m_window;
+  size_t m_ops_per_request;
+};
+
+/*
+ * The clients submit their requests one after the other, like the sessions of the server: a request
+ *  is only submitted once the previous one of the client is committed. Returns the writes per second.
+ */
+static auto run_clients(write_coalescer& coalescer, size_t num_clients, size_t requests_per_client,
+                        size_t ops_per_request) -> double
+{
+  const std::string value(256, 'v');
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  clients.reserve(num_clients);
+  for (size_t client = 0; client < num_clients; client++) {
+    clients.emplace_back([&coalescer, &value, client, requests_per_client, ops_per_request]() {
+      std::vector<std::string> keys(ops_per_request);
+      std::vector<write_op> ops(ops_per_request);
+      for (size_t request = 0; request < requests_per_client; request++) {
+        for (size_t op = 0; op < ops_per_request; op++) {
+          keys[op] = "key" + std::to_string(client) + "_" + std::to_string(request) + "_" + std::to_string(op);
+          ops[op] = {true, keys[op], value};
+        }
+        std::promise<bool> committed;
+        coalescer.write(ops, [&committed](bool is_success) { committed.set_value(is_success); });
+        check(committed.get_future().get());
+      }
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+  const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(num_clients * requests_per_client * ops_per_request) / duration.count();
+}
+
+auto main() -> int
+{
+  constexpr size_t num_clients = 16;
+  constexpr size_t requests_per_client = 500;
+  // a batch size of 1 commits every request with its own WriteBatch, i.e., without any coalescing
+  constexpr std::array<write_run, 6> runs {{
+      {"put, no coalescing", 1, std::chrono::microseconds(0), 1},
+      {"put, window 0us", 128, std::chrono::microseconds(0), 1},
+      {"put, window 100us", 128, std::chrono::microseconds(100), 1},
+      {"mput of 8, no coalescing", 1, std::chrono::microseconds(0), 8},
+      {"mput of 8, window 0us", 128, std::chrono::microseconds(0), 8},
+      {"mput of 8, window 100us", 128, std::chrono::microseconds(100), 8},
+  }};
+
+  const std::filesystem::path db_path = std::filesystem::temp_directory_path() / "write_coalescer_perf_test_db";
+  for (const bool sync : {true, false}) {
+    for (const write_run& run : runs) {
+      std::filesystem::remove_all(db_path);
+      rocksdb::Options options;
+      options.create_if_missing = true;
+      rocksdb::DB* rocksdb = nullptr;
+      check(rocksdb::DB::Open(options, db_path.string(), &rocksdb).ok());
+      {
+        write_coalescer_options write_options;
+        write_options.m_sync = sync;
+        write_options.m_max_batch_size = run.m_max_batch_size;
+        write_options.m_window = run.m_window;
+        latency_histogram queueing;
+        write_coalescer coalescer(rocksdb, write_options, queueing);
+
+        const double writes_per_second =
+          run_clients(coalescer, num_clients, requests_per_client, run.m_ops_per_request);
+        std::cout << (sync ? "sync" : "no sync") << ", " << run.m_name << ": " << writes_per_second
+                  << " writes/s, mean queueing " << queueing.mean_us() << " us" << std::endl;
+        coalescer.print_stats();
+      }
+      delete rocksdb;
+    }
+  }
+  std::filesystem::remove_all(db_path);
+  return 0;
+}
@@ -132,6 +132,7 @@ function run_gdpr_controller() {
     exit
   fi
   ctl="$controller --db $db --logpath $log_path --db_address $db_address \
+  --users_path $log_path/users.dict --policies_path $log_path/policies.dict \
   --controller_address $controller_address --controller_port $controller_port"
 
   echo "Starting the GDPR controller"
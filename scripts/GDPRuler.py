@@ -11,10 +11,12 @@ sys.path.insert(0, parent_dir)
 
 # Define a custom validation function for the --db_encryptionkey argument
 def validate_encryption_key(key):
-  if len(key) != 16:
-    raise argparse.ArgumentTypeError('Encryption keys must be exactly 16 characters long')
+  if len(key) != 16 and len(key) != 32:
+    raise argparse.ArgumentTypeError('Encryption keys must be exactly 16 or 32 characters long')
   return key
 
+cipher_suites = ['aes-128-gcm', 'aes-256-gcm', 'chacha20-poly1305', 'none']
+
 def main():
   default_db_encryption_key = "0123456789abcdef"
   default_log_encryption_key = "abcdef0123456789"
@@ -22,10 +24,19 @@ def main():
   parser.add_argument('--db', help='db to use, one of {rocksdb,redis}', default=DbType.ROCKSDB, required=False, type=DbType)
   parser.add_argument('--db_address', help='db ip address for client to connect', default=None, required=False, type=str)
   parser.add_argument('--logpath', help='folder to place the gdpr log files', default="./logs", required=False, type=str)
-  parser.add_argument('--db_encryptionkey', help='DB encryption/decryption key. Expected to be exactly 16 chars', 
+  parser.add_argument('--users_path', help='file of the user dictionary (user keys to the ids stored in the metadata), kept along with the db', required=True, type=str)
+  parser.add_argument('--policies_path', help='file of the policy store (metadata shared by the values), kept along with the db', required=True, type=str)
+  parser.add_argument('--purposes_path', help='file of the purpose names, one per line in the order of their bits (default: purpose0..purpose63)', default=None, required=False, type=str)
+  parser.add_argument('--db_encryptionkey', help='DB encryption/decryption key. Expected to be exactly 16 or 32 chars', 
                       default=default_db_encryption_key, required=False, type=validate_encryption_key)
-  parser.add_argument('--log_encryptionkey', help='Log encryption/decryption key. Expected to be exactly 16 chars', 
+  parser.add_argument('--log_encryptionkey', help='Log encryption/decryption key. Expected to be exactly 16 or 32 chars', 
                       default=default_log_encryption_key, required=False, type=validate_encryption_key)
+  parser.add_argument('--db_keyid', help='id (0-15) of the DB encryption key', default=None, required=False, type=str)
+  parser.add_argument('--log_keyid', help='id (0-15) of the log encryption key', default=None, required=False, type=str)
+  parser.add_argument('--db_oldkeys', help='previous DB keys, valid for decryption, as <id>:<key>,...', default=None, required=False, type=str)
+  parser.add_argument('--log_oldkeys', help='previous log keys, valid for decryption, as <id>:<key>,...', default=None, required=False, type=str)
+  parser.add_argument('--db_cipher', help='cipher suite of the DB values', default=None, required=False, choices=cipher_suites)
+  parser.add_argument('--log_cipher', help='cipher suite of the log entries', default=None, required=False, choices=cipher_suites)
   parser.add_argument('--controller_address', help='controller IP address', default="127.0.0.1", required=False, type=str)
   parser.add_argument('--controller_port', help='controller port', default="1312", required=False, type=str)
   args = parser.parse_args()
@@ -36,10 +47,21 @@ def main():
   if args.db_address:
     process_args += ['--db_address', args.db_address]
   process_args += ['--logpath', args.logpath]
+  process_args += ['--users_path', args.users_path]
+  process_args += ['--policies_path', args.policies_path]
+  if args.purposes_path:
+    process_args += ['--purposes_path', args.purposes_path]
   if args.db_encryptionkey:
     process_args += ['--db_encryptionkey', args.db_encryptionkey]
   if args.log_encryptionkey:
     process_args += ['--log_encryptionkey', args.log_encryptionkey]
+  for option in ['db_keyid', 'log_keyid', 'db_oldkeys', 'log_oldkeys']:
+    if getattr(args, option):
+      process_args += ['--' + option, getattr(args, option)]
+  if args.db_cipher:
+    process_args += ['--db_cipher', args.db_cipher]
+  if args.log_cipher:
+    process_args += ['--log_cipher', args.log_cipher]
   process_args += ['--controller_address', args.controller_address]
   process_args += ['--controller_port', args.controller_port]
   controller = subprocess.Popen(process_args, stdin=subprocess.PIPE, stderr=subprocess.PIPE)
@@ -6,6 +6,7 @@ import os
 import sys
 import glob
 import json
+import re
 
 curr_dir = os.path.dirname(os.path.abspath(__file__))
 parent_dir = os.path.dirname(curr_dir)
@@ -16,6 +17,8 @@ from policy_compiler.policy_config import parse_user_policy
 workload_trace_dir = os.path.join(curr_dir, '..', 'workload_traces')
 exit_query="query(exit)\n"
 msg_header_size=4
+# the command of a query, with its key and value: query(CMD("key"[,"value"]))
+command_pattern = re.compile(r'query\((get|put|delete|getm|putm)\("([^"]*)"(?:,"([^"]*)")?\)\)', re.IGNORECASE)
 
 def generate_value(size):
     """Generate a string of the specified size in bytes."""
@@ -105,7 +108,26 @@ def safe_receive(socket, size):
       total_bytes_received += len(chunk)
     return data
 
-def send_queries(server_address, server_port, queries, latency_results, config_path, client_num):
+def prepare_query(client_socket, templates, query):
+  """Return the execution of the prepared template of the query, preparing the template on first use."""
+  match = command_pattern.search(query)
+  if match is None:
+    return query
+  template = query[:match.start()] + f'query(prepare("{match.group(1)}"))' + query[match.end():]
+  template = template.strip()
+  if template not in templates:
+    template_encoded = template.encode()
+    client_socket.sendall(len(template_encoded).to_bytes(msg_header_size, 'big') + template_encoded)
+    response_size = int.from_bytes(safe_receive(client_socket, msg_header_size), 'big')
+    response = safe_receive(client_socket, response_size).decode()
+    # the controller answers the handle as "#<handle>", or INVALID_COMMAND for an invalid template
+    templates[template] = response[1:] if response.startswith('#') else None
+  if templates[template] is None:
+    return query
+  value = f',"{match.group(3)}"' if match.group(3) is not None else ''
+  return f'query(exec("{templates[template]}","{match.group(2)}"{value}))'
+
+def send_queries(server_address, server_port, queries, latency_results, config_path, client_num, prepare):
     # Open a connection to the server
     client_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     client_socket.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
@@ -122,9 +144,13 @@ def send_queries(server_address, server_port, queries, latency_results, config_p
     # Read the contents of the workload file line by line
     total_latency = 0
     request_count = 0
+    # the handles of the prepared templates of this connection
+    templates = {}
 
     for query in queries:
       start_time = time.perf_counter()  # Start the timer
+      if prepare:
+        query = prepare_query(client_socket, templates, query)
       # Send each line to the server with message size header
       query_encoded = query.encode()
       msg_size = len(query_encoded).to_bytes(msg_header_size, 'big')
@@ -154,8 +180,8 @@ def send_queries(server_address, server_port, queries, latency_results, config_p
       average_latency = total_latency / request_count
       latency_results.append(average_latency)
 
-def create_client_process(server_address, server_port, queries, latency_results, config_path, client_num):
-  process = multiprocessing.Process(target=send_queries, args=(server_address, server_port, queries, latency_results, config_path, client_num))
+def create_client_process(server_address, server_port, queries, latency_results, config_path, client_num, prepare):
+  process = multiprocessing.Process(target=send_queries, args=(server_address, server_port, queries, latency_results, config_path, client_num, prepare))
   process.start()
   return process
 
@@ -167,6 +193,7 @@ def main():
   parser.add_argument('--port', help='Port of the running server to connect', default=1312, required=False, type=int)
   parser.add_argument('--clients', help='Number of clients to spawn', default=1, type=int)
   parser.add_argument('--value_size', help='Size of the value in bytes for PUT queries', default=64, type=int)
+  parser.add_argument('--prepare', help='Send the run phase queries as executions of prepared query templates', action='store_true')
   args = parser.parse_args()
 
   # Perform the load phase of the workload
@@ -190,7 +217,7 @@ def main():
   latency_results = manager.list()
   processes = []
   for i, client_queries in enumerate(queries_per_client):
-    process = create_client_process(args.address, args.port, client_queries, latency_results, args.config, i)
+    process = create_client_process(args.address, args.port, client_queries, latency_results, args.config, i, args.prepare)
     processes.append(process)
 
   # Wait for all client processes to finish